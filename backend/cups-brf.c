@@ -6,17 +6,293 @@
 // Licensed under Apache License v2.0.  See the file "LICENSE" for more
 // information.
 //
+// Jobs are saved as ~/BRF/<title>.XXXXXX.brf.  On Linux the data is moved
+// by the kernel with copy_file_range() when the input is a file and
+// splice() when it is a pipe, and files of known size are preallocated.
+// Other inputs are copied through a large buffer.
+//
+// Options are given in the device URI, for example
+// "cups-brf:/?durable=yes&index=yes":
+//
+//   durable=yes  The file is on disk when the job completes.  Writeback is
+//                started every 16 MiB and the file and directory are
+//                synced once at the end, instead of syncing every write.
+//   index=yes    A page index <title>.XXXXXX.idx is written next to the
+//                file, in the format of the Braille Printer Application's
+//                cache: "BRFI", 32-bit 0, 64-bit file size, 64-bit page
+//                count, then the 64-bit offset of every page.
+//
 
 #include <cups/backend.h>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <pwd.h>
 
+#define COPY_BUFFER	(1024 * 1024)		// Size of the copy buffer
+#define COPY_CHUNK	(16 * 1024 * 1024)	// Bytes per kernel copy and writeback batch
+
+enum
+{
+  COPY_READ,					// read() and write()
+  COPY_RANGE,					// copy_file_range() from a file
+  COPY_SPLICE					// splice() from a pipe
+};
+
+
+// Write a whole buffer.
+static int
+write_all(int fd,
+          const char *buffer,
+          size_t bytes)
+{
+  ssize_t sizeout;
+
+  while (bytes > 0)
+  {
+    sizeout = write(fd, buffer, bytes);
+    if (sizeout < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return (-1);
+    }
+
+    buffer += sizeout;
+    bytes  -= (size_t)sizeout;
+  }
+
+  return (0);
+}
+
+
+// Copy standard input to the output file.
+static int
+copy_data(int fd,
+          const char *outfile,
+          int durable)
+{
+  struct stat st;
+  off_t total = 0, synced = 0, size = 0;
+  ssize_t sizein;
+  char *buffer = NULL;
+  int method = COPY_READ;
+
+#ifdef __linux__
+  if (!fstat(STDIN_FILENO, &st))
+  {
+    if (S_ISREG(st.st_mode))
+    {
+      // The size is known, allocate the space up front...
+      method = COPY_RANGE;
+      size   = st.st_size - lseek(STDIN_FILENO, 0, SEEK_CUR);
+      if (size > 0 && fallocate(fd, 0, 0, size))
+        size = 0;
+    }
+    else if (S_ISFIFO(st.st_mode))
+      method = COPY_SPLICE;
+  }
+#else
+  (void)st;
+#endif
+
+  while (1)
+  {
+#ifdef __linux__
+    if (method == COPY_RANGE)
+      sizein = copy_file_range(STDIN_FILENO, NULL, fd, NULL, COPY_CHUNK, 0);
+    else if (method == COPY_SPLICE)
+      sizein = splice(STDIN_FILENO, NULL, fd, NULL, COPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+    else
+#endif
+    {
+      if (!buffer && posix_memalign((void **)&buffer, 4096, COPY_BUFFER))
+      {
+        fprintf(stderr, "ERROR: could not allocate memory\n");
+        return (-1);
+      }
+
+      sizein = read(STDIN_FILENO, buffer, COPY_BUFFER);
+      if (sizein > 0 && write_all(fd, buffer, (size_t)sizein) < 0)
+      {
+        fprintf(stderr, "ERROR: while writing to \"%s\": %s\n",
+                outfile, strerror(errno));
+        free(buffer);
+        return (-1);
+      }
+    }
+
+    if (sizein < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (method != COPY_READ && (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF))
+      {
+        // Not supported for these files, the file offsets are where the
+        // kernel copy stopped so just go on with the buffer...
+        fprintf(stderr, "DEBUG: kernel copy not available (%s), using a buffer\n", strerror(errno));
+        method = COPY_READ;
+        continue;
+      }
+
+      fprintf(stderr, "ERROR: while copying input to \"%s\": %s\n",
+              outfile, strerror(errno));
+      free(buffer);
+      return (-1);
+    }
+    if (sizein == 0)
+      // We are done!
+      break;
+
+    total += sizein;
+
+#ifdef __linux__
+    // Start writing back what we have so far, without waiting for it...
+    if (durable && total - synced >= COPY_CHUNK)
+    {
+      sync_file_range(fd, synced, total - synced, SYNC_FILE_RANGE_WRITE);
+      synced = total;
+    }
+#endif
+  }
+
+  free(buffer);
+
+  // The input was shorter than the space allocated for it
+  if (size > total && ftruncate(fd, total))
+  {
+    fprintf(stderr, "ERROR: while truncating \"%s\": %s\n",
+            outfile, strerror(errno));
+    return (-1);
+  }
+
+  if (durable && fdatasync(fd))
+  {
+    fprintf(stderr, "ERROR: while syncing \"%s\": %s\n",
+            outfile, strerror(errno));
+    return (-1);
+  }
+
+  return (0);
+}
+
+
+// Write the page index of the output file, pages end with a form feed.
+static int
+write_index(int fd,
+            const char *outfile,
+            int durable)
+{
+  struct stat st;
+  const char *map, *ptr, *end;
+  char *index, *tempfile;
+  uint64_t header[3], offsets[4096];
+  size_t count = 0;
+  int indexfd, ret = 0;
+
+  if (fstat(fd, &st) || st.st_size == 0)
+    return (-1);
+
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return (-1);
+  madvise((void *)map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+  // <title>.XXXXXX.brf becomes <title>.XXXXXX.idx
+  if (asprintf(&index, "%.*s.idx", (int)strlen(outfile) - 4, outfile) < 0)
+  {
+    munmap((void *)map, (size_t)st.st_size);
+    return (-1);
+  }
+  if (asprintf(&tempfile, "%s.tmp", index) < 0)
+  {
+    munmap((void *)map, (size_t)st.st_size);
+    free(index);
+    return (-1);
+  }
+
+  fprintf(stderr, "DEBUG: creating page index \"%s\n", index);
+  indexfd = open(tempfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (indexfd < 0)
+    ret = -1;
+
+  // The header is written last, once the page count is known.
+  memcpy(header, "BRFI\0\0\0\0", 8);
+  header[1] = (uint64_t)st.st_size;
+  header[2] = 0;
+
+  if (!ret && lseek(indexfd, sizeof(header), SEEK_SET) < 0)
+    ret = -1;
+
+  for (ptr = map, end = map + st.st_size; !ret && ptr < end; header[2]++)
+  {
+    offsets[count++] = (uint64_t)(ptr - map);
+    if (count == sizeof(offsets) / sizeof(offsets[0]))
+    {
+      ret   = write_all(indexfd, (const char *)offsets, sizeof(offsets));
+      count = 0;
+    }
+
+    ptr = memchr(ptr, '\f', (size_t)(end - ptr));
+    if (ptr == NULL)
+      ptr = end;
+    else
+      ptr++;
+  }
+
+  munmap((void *)map, (size_t)st.st_size);
+
+  if (!ret && count > 0)
+    ret = write_all(indexfd, (const char *)offsets, count * sizeof(offsets[0]));
+  if (!ret && lseek(indexfd, 0, SEEK_SET) == 0)
+    ret = write_all(indexfd, (const char *)header, sizeof(header));
+  else
+    ret = -1;
+  if (!ret && durable && fdatasync(indexfd))
+    ret = -1;
+  if (indexfd >= 0 && close(indexfd))
+    ret = -1;
+
+  if (ret || rename(tempfile, index))
+  {
+    unlink(tempfile);
+    ret = -1;
+  }
+
+  free(tempfile);
+  free(index);
+
+  return (ret);
+}
+
+
+// Get an option from the device URI, "cups-brf:/?name=value&...".
+static int
+uri_option(const char *name)
+{
+  const char *uri = getenv("DEVICE_URI");
+  const char *opt;
+  size_t len = strlen(name);
+
+  if (!uri || (opt = strchr(uri, '?')) == NULL)
+    return (0);
+
+  for (opt++; *opt; opt += strcspn(opt, "&"), opt += (*opt == '&'))
+  {
+    if (!strncmp(opt, name, len) && opt[len] == '=')
+      return (!strncmp(opt + len + 1, "yes", 3) || !strncmp(opt + len + 1, "true", 4) || !strncmp(opt + len + 1, "on", 2));
+  }
+
+  return (0);
+}
+
 
 int
 main(int argc,
@@ -27,11 +303,11 @@ main(int argc,
   char *title;
   char *outfile;
   char *c;
-  char buffer[4096];
-  ssize_t sizein, sizeout, done;
   struct passwd *pw;
   int ret;
   int fd;
+  int durable = uri_option("durable");
+  int index = uri_option("index");
 
   if (setuid(0))
   {
@@ -135,31 +411,13 @@ main(int argc,
   }
 
   // We are all set, copy data.
-  while (1)
-  {
-    // Read some.
-    sizein = read(STDIN_FILENO, buffer, sizeof(buffer));
-    if (sizein < 0)
-    {
-      fprintf(stderr, "ERROR: while reading input: %s\n", strerror(errno));
-      return (CUPS_BACKEND_FAILED);
-    }
-    if (sizein == 0)
-      // We are done!
-      break;
+  if (copy_data(fd, outfile, durable) < 0)
+    return (CUPS_BACKEND_FAILED);
+
+  if (index && write_index(fd, outfile, durable) < 0)
+    fprintf(stderr, "WARNING: could not write the page index of \"%s\"\n",
+            outfile);
 
-    // Write it.
-    for (done = 0; done < sizein; done += sizeout)
-    {
-      sizeout = write(fd, buffer + done, sizein - done);
-      if (sizeout < 0)
-      {
-	fprintf(stderr, "ERROR: while writing to \"%s\": %s\n",
-		outfile, strerror(errno));
-	return (CUPS_BACKEND_FAILED);
-      }
-    }
-  }
   if (close(fd) < 0)
   {
     fprintf(stderr, "ERROR: while closing \"%s\": %s\n",
@@ -167,5 +425,18 @@ main(int argc,
     return (CUPS_BACKEND_FAILED);
   }
 
+  // The new directory entries must be on disk too
+  if (durable)
+  {
+    fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0 || fsync(fd))
+    {
+      fprintf(stderr, "ERROR: while syncing \"%s\": %s\n",
+	      dir, strerror(errno));
+      return (CUPS_BACKEND_FAILED);
+    }
+    close(fd);
+  }
+
   return (CUPS_BACKEND_OK);
 }
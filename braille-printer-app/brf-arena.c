@@ -0,0 +1,230 @@
+//
+// Per-job memory arenas for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The filter data, chain entries, parameters and strings of a job are
+// allocated from one arena and released together when the job is done, so
+// nothing is left behind by early returns.  PAPPL runs every job on a new
+// thread, so released arenas are kept on a small shared free list instead
+// of per thread; a job usually fits in the first chunk, which is kept with
+// the arena.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <pthread.h>
+
+
+//
+// Constants...
+//
+
+#define BRF_ARENA_ALIGN		16	// Alignment of allocations
+#define BRF_ARENA_CHUNK		16384	// Size of a chunk
+#define BRF_ARENA_KEEP		8	// Released arenas kept for reuse
+
+
+//
+// Local types...
+//
+
+typedef struct brf_arena_chunk_s	// Block of arena memory
+{
+  struct brf_arena_chunk_s *next;	// Next chunk
+  size_t	size,			// Bytes in chunk
+		used;			// Bytes allocated
+  _Alignas(BRF_ARENA_ALIGN) unsigned char data[];
+					// Memory
+} brf_arena_chunk_t;
+
+struct brf_arena_s			// Arena
+{
+  brf_arena_chunk_t *chunks;		// Chunks, current first
+  brf_arena_t	*next;			// Next free arena
+};
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t	brf_arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for the free list
+static brf_arena_t	*brf_arena_free = NULL;
+					// Released arenas
+static int		brf_arena_num_free = 0;
+					// Number of released arenas
+
+
+//
+// Local functions...
+//
+
+static brf_arena_chunk_t *brf_arena_chunk(size_t size);
+
+
+//
+// 'brf_arena_alloc()' - Allocate zeroed memory from an arena.
+//
+
+void *					// O - Memory or `NULL` on error
+brf_arena_alloc(brf_arena_t *arena,	// I - Arena
+                size_t      size)	// I - Number of bytes
+{
+  brf_arena_chunk_t	*chunk = arena->chunks;
+					// Current chunk
+  size_t		offset;		// Offset of allocation
+  void			*ptr;		// Allocation
+
+
+  size   = (size + BRF_ARENA_ALIGN - 1) & ~(size_t)(BRF_ARENA_ALIGN - 1);
+  offset = chunk ? chunk->used : 0;
+
+  if (!chunk || size > chunk->size - offset)
+  {
+    // Start a new chunk, big allocations get one of their own...
+    if ((chunk = brf_arena_chunk(size > BRF_ARENA_CHUNK ? size : BRF_ARENA_CHUNK)) == NULL)
+      return (NULL);
+
+    chunk->next   = arena->chunks;
+    arena->chunks = chunk;
+    offset        = 0;
+  }
+
+  ptr         = chunk->data + offset;
+  chunk->used = offset + size;
+
+  memset(ptr, 0, size);
+
+  return (ptr);
+}
+
+
+//
+// 'brf_arena_delete()' - Release an arena and everything allocated from it.
+//
+
+void
+brf_arena_delete(brf_arena_t *arena)	// I - Arena
+{
+  brf_arena_chunk_t	*chunk,		// Current chunk
+			*next;		// Next chunk
+
+
+  if (!arena)
+    return;
+
+  // Keep one standard chunk and free the rest...
+  for (chunk = arena->chunks, arena->chunks = NULL; chunk; chunk = next)
+  {
+    next = chunk->next;
+
+    if (!arena->chunks && chunk->size == BRF_ARENA_CHUNK)
+    {
+      chunk->next   = NULL;
+      chunk->used   = 0;
+      arena->chunks = chunk;
+    }
+    else
+      free(chunk);
+  }
+
+  pthread_mutex_lock(&brf_arena_mutex);
+
+  if (brf_arena_num_free < BRF_ARENA_KEEP)
+  {
+    arena->next    = brf_arena_free;
+    brf_arena_free = arena;
+    brf_arena_num_free ++;
+    arena          = NULL;
+  }
+
+  pthread_mutex_unlock(&brf_arena_mutex);
+
+  if (arena)
+  {
+    free(arena->chunks);
+    free(arena);
+  }
+}
+
+
+//
+// 'brf_arena_new()' - Get an empty arena.
+//
+
+brf_arena_t *				// O - Arena or `NULL` on error
+brf_arena_new(void)
+{
+  brf_arena_t	*arena;			// Arena
+
+
+  pthread_mutex_lock(&brf_arena_mutex);
+
+  if ((arena = brf_arena_free) != NULL)
+  {
+    brf_arena_free = arena->next;
+    brf_arena_num_free --;
+  }
+
+  pthread_mutex_unlock(&brf_arena_mutex);
+
+  if (!arena && (arena = (brf_arena_t *)calloc(1, sizeof(brf_arena_t))) == NULL)
+    return (NULL);
+
+  arena->next = NULL;
+
+  return (arena);
+}
+
+
+//
+// 'brf_arena_strdup()' - Copy a string into an arena.
+//
+
+char *					// O - Copy or `NULL` on error
+brf_arena_strdup(brf_arena_t *arena,	// I - Arena
+                 const char  *s)	// I - String or `NULL`
+{
+  size_t	len;			// Length of string
+  char		*copy;			// Copy
+
+
+  if (!s)
+    return (NULL);
+
+  len = strlen(s) + 1;
+
+  if ((copy = (char *)brf_arena_alloc(arena, len)) != NULL)
+    memcpy(copy, s, len);
+
+  return (copy);
+}
+
+
+//
+// 'brf_arena_chunk()' - Allocate a chunk.
+//
+
+static brf_arena_chunk_t *		// O - Chunk or `NULL` on error
+brf_arena_chunk(size_t size)		// I - Bytes in chunk
+{
+  brf_arena_chunk_t	*chunk;		// Chunk
+
+
+  if ((chunk = (brf_arena_chunk_t *)malloc(sizeof(brf_arena_chunk_t) + size)) == NULL)
+    return (NULL);
+
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+
+  return (chunk);
+}
@@ -0,0 +1,561 @@
+//
+// Multi-document batches for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// PAPPL jobs hold a single document, so a batch of documents is submitted as
+// one "multipart/mixed" document (RFC 2046) with a part per document.  All
+// parts are translated in one pass with the filter data of the job and the
+// compiled tables of the printer, so a burst of small documents costs one
+// job, one filter chain and one connection to the embosser.  Documents are
+// separated like the SendFF and SendSUB options of brftoembosser do it.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <strings.h>
+#include <sys/mman.h>
+
+
+//
+// Constants...
+//
+
+#define BRF_BATCH_FF		0x0c	// Form feed, ends a BRF page
+#define BRF_BATCH_SUB		0x1a	// SUB, ends a document on embossers
+
+
+//
+// Local types...
+//
+
+typedef enum brf_batch_separator_e	// Document separator
+{
+  BRF_BATCH_NONE,			// Documents are concatenated
+  BRF_BATCH_FORM_FEED,			// Documents start on a new page
+  BRF_BATCH_SUB_CHAR			// SUB character between documents
+} brf_batch_separator_t;
+
+typedef struct brf_batch_s		// Batch state
+{
+  cf_filter_data_t *data;		// Job and printer data
+  cups_array_t	*chain;			// Pre-filter chain of the current document
+  int		outputfd,		// Output file descriptor
+		docfd,			// Temporary file for a document
+		brffd,			// Temporary file for its translation
+		documents;		// Documents seen
+  size_t	written;		// Bytes written
+  char		last;			// Last byte written
+} brf_batch_t;
+
+
+//
+// Local globals...
+//
+
+static brf_batch_separator_t brf_batch_separator = BRF_BATCH_FORM_FEED;
+					// Configured separator
+
+
+//
+// Local functions...
+//
+
+static bool	brf_batch_document(brf_batch_t *batch, const char *type, const char *body, size_t bytes);
+static const char *brf_batch_line(const char *ptr, const char *end, const char **next);
+static bool	brf_batch_separate(brf_batch_t *batch);
+static int	brf_batch_tempfile(brf_batch_t *batch);
+static bool	brf_batch_write(brf_batch_t *batch, const char *buffer, size_t bytes);
+
+
+//
+// 'brf_batch_filter_function()' - Translate the documents of a batch to BRF.
+//
+// The boundary is taken from the first delimiter line, as "document-format"
+// has no room for MIME parameters.  Every part is translated with the
+// pre-filter chain for its "Content-Type" (text/plain by default), BRF parts
+// are copied as they are.  Parts in other formats are skipped.
+//
+
+int					// O - Error status
+brf_batch_filter_function(
+    int              inputfd,		// I - File descriptor input stream
+    int              outputfd,		// I - File descriptor output stream
+    int              inputseekable,	// I - Is input stream seekable?
+    cf_filter_data_t *data,		// I - Job and printer data
+    void             *parameters)	// I - Filter parameters (unused)
+{
+  brf_batch_t	batch;			// Batch state
+  cf_logfunc_t	log = data->logfunc;	// Log function
+  void		*ld = data->logdata;	// Log function data
+  struct stat	fileinfo;		// Input file information
+  void		*map = MAP_FAILED;	// Mapped input file
+  char		*buffer = NULL,		// Input data
+		*temp,			// New input buffer
+		type[256],		// Content type of the part
+		*typeptr;		// Pointer into type
+  size_t	bytes = 0,		// Bytes of input
+		bufsize = 0,		// Size of input buffer
+		delimlen;		// Length of delimiter
+  ssize_t	rbytes;			// Bytes read
+  const char	*end,			// End of input
+		*ptr,			// Current line
+		*eol,			// End of current line
+		*next,			// Next line
+		*delim,			// Delimiter line
+		*body,			// Body of the part
+		*found;			// Next delimiter
+  int		ret = 0;		// Return value
+
+
+  (void)parameters;
+
+  memset(&batch, 0, sizeof(batch));
+  batch.data     = data;
+  batch.outputfd = outputfd;
+  batch.docfd    = -1;
+  batch.brffd    = -1;
+
+  // Map or read the whole batch...
+  if (inputseekable && !fstat(inputfd, &fileinfo) && S_ISREG(fileinfo.st_mode) && fileinfo.st_size > 0)
+    map = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, inputfd, 0);
+
+  if (map != MAP_FAILED)
+  {
+    buffer = (char *)map;
+    bytes  = (size_t)fileinfo.st_size;
+  }
+  else
+  {
+    for (;;)
+    {
+      if (bytes == bufsize)
+      {
+        if ((temp = (char *)realloc(buffer, bufsize + 262144)) == NULL)
+        {
+          if (log)
+            log(ld, CF_LOGLEVEL_ERROR, "Batch: Unable to allocate memory.");
+          ret = 1;
+          goto done;
+        }
+
+        buffer  = temp;
+        bufsize += 262144;
+      }
+
+      if ((rbytes = read(inputfd, buffer + bytes, bufsize - bytes)) == 0)
+        break;
+      else if (rbytes < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "Batch: Unable to read input: %s", strerror(errno));
+        ret = 1;
+        goto done;
+      }
+
+      bytes += (size_t)rbytes;
+    }
+  }
+
+  // Find the first delimiter, skipping any preamble...
+  end = buffer + bytes;
+
+  for (ptr = buffer, eol = NULL; ptr < end; ptr = next)
+  {
+    eol = brf_batch_line(ptr, end, &next);
+
+    if (eol - ptr > 2 && ptr[0] == '-' && ptr[1] == '-')
+      break;
+  }
+
+  if (ptr >= end)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Batch: No multipart boundary found.");
+    ret = 1;
+    goto done;
+  }
+
+  for (delim = ptr, delimlen = (size_t)(eol - ptr); delimlen > 2 && isspace(delim[delimlen - 1] & 255); delimlen --);
+
+  batch.chain = cupsArrayNew(NULL, NULL);
+
+  for (ptr = next; ptr < end; ptr = next)
+  {
+    if (data->iscanceledfunc && data->iscanceledfunc(data->iscanceleddata))
+      break;
+
+    // Part headers, only the content type matters...
+    papplCopyString(type, "text/plain", sizeof(type));
+
+    while (ptr < end)
+    {
+      eol = brf_batch_line(ptr, end, &next);
+
+      if (eol == ptr)
+      {
+        ptr = next;
+        break;
+      }
+
+      if (eol - ptr > 13 && !strncasecmp(ptr, "Content-Type:", 13))
+      {
+        for (ptr += 13; ptr < eol && isspace(*ptr & 255); ptr ++);
+
+        for (typeptr = type; ptr < eol && *ptr != ';' && !isspace(*ptr & 255) && typeptr < (type + sizeof(type) - 1); ptr ++)
+          *typeptr++ = (char)tolower(*ptr & 255);
+
+        *typeptr = '\0';
+      }
+
+      ptr = next;
+    }
+
+    // Body, up to the next delimiter at the start of a line...
+    for (body = ptr, found = ptr; (found = memmem(found, (size_t)(end - found), delim, delimlen)) != NULL; found ++)
+    {
+      if (found == body || found[-1] == '\n')
+        break;
+    }
+
+    if (!found)
+    {
+      // No close delimiter, take the rest of the input...
+      if (log)
+        log(ld, CF_LOGLEVEL_WARN, "Batch: Missing close delimiter.");
+
+      found = end;
+    }
+
+    // The line break before the delimiter belongs to the delimiter...
+    eol = found;
+
+    if (eol > body && eol[-1] == '\n')
+      eol --;
+    if (eol > body && eol[-1] == '\r')
+      eol --;
+
+    if (!brf_batch_document(&batch, type, body, (size_t)(eol - body)))
+    {
+      ret = 1;
+      break;
+    }
+
+    if (found == end)
+      break;
+
+    // Close delimiter?
+    eol = brf_batch_line(found, end, &next);
+
+    if ((size_t)(eol - found) >= delimlen + 2 && found[delimlen] == '-' && found[delimlen + 1] == '-')
+      break;
+  }
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "Batch: Wrote %d document(s), %lu bytes.", batch.documents, (unsigned long)batch.written);
+
+  brf_stats_bytes(bytes, batch.written);
+
+  done:
+
+  cupsArrayDelete(batch.chain);
+
+  if (batch.docfd >= 0)
+    close(batch.docfd);
+  if (batch.brffd >= 0)
+    close(batch.brffd);
+
+  if (map != MAP_FAILED)
+    munmap(map, (size_t)fileinfo.st_size);
+  else
+    free(buffer);
+
+  close(inputfd);
+  close(outputfd);
+
+  return (ret);
+}
+
+
+//
+// 'brf_batch_set_separator()' - Set the separator between documents.
+//
+// "form-feed" (the default) starts every document on a new page, "sub"
+// writes a SUB character between documents and "none" concatenates them.
+//
+
+bool					// O - `true` on success, `false` on bad value
+brf_batch_set_separator(
+    const char *value)			// I - Separator keyword or `NULL`
+{
+  if (!value || !strcmp(value, "form-feed"))
+    brf_batch_separator = BRF_BATCH_FORM_FEED;
+  else if (!strcmp(value, "sub"))
+    brf_batch_separator = BRF_BATCH_SUB_CHAR;
+  else if (!strcmp(value, "none"))
+    brf_batch_separator = BRF_BATCH_NONE;
+  else
+    return (false);
+
+  return (true);
+}
+
+
+//
+// 'brf_batch_document()' - Write one document of a batch.
+//
+// Documents are translated into a temporary file first so that the
+// separator can depend on how the document ends.  Both temporary files are
+// reused for the whole batch.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_batch_document(
+    brf_batch_t *batch,			// I - Batch state
+    const char  *type,			// I - Content type
+    const char  *body,			// I - Document data
+    size_t      bytes)			// I - Size of document data
+{
+  cf_filter_data_t *data = batch->data;	// Job and printer data
+  cf_logfunc_t	log = data->logfunc;	// Log function
+  void		*ld = data->logdata;	// Log function data
+  brf_spooling_conversion_t *conversion;// Pre-filter chain
+  char		*content_type;		// Content type of the job
+  char		buffer[65536];		// Copy buffer
+  ssize_t	rbytes;			// Bytes read
+  off_t		size;			// Size of translation
+  int		i,			// Looping var
+		status;			// Filter chain status
+
+
+  batch->documents ++;
+
+  if (!strcmp(type, "application/vnd.cups-paged-brf") || !strcmp(type, "application/vnd.cups-brf"))
+  {
+    if (bytes == 0)
+      return (true);
+
+    return (brf_batch_separate(batch) && brf_batch_write(batch, body, bytes));
+  }
+
+  // Parts convert to the format of the batch, but not through another batch...
+  if ((conversion = brf_find_conversion(type, data->final_content_type ? data->final_content_type : "application/vnd.cups-paged-brf")) != NULL)
+  {
+    for (i = 0; i < conversion->num_filters; i ++)
+    {
+      if (conversion->filters[i].function == brf_batch_filter_function)
+        break;
+    }
+
+    if (i < conversion->num_filters)
+      conversion = NULL;
+  }
+
+  if (!conversion)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_WARN, "Batch: Skipping document %d, unsupported format %s.", batch->documents, type);
+    return (true);
+  }
+
+  if ((batch->docfd < 0 && (batch->docfd = brf_batch_tempfile(batch)) < 0) || (batch->brffd < 0 && (batch->brffd = brf_batch_tempfile(batch)) < 0))
+    return (false);
+
+  if (ftruncate(batch->docfd, 0) || lseek(batch->docfd, 0, SEEK_SET) || ftruncate(batch->brffd, 0) || lseek(batch->brffd, 0, SEEK_SET))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Batch: Unable to reuse temporary files: %s", strerror(errno));
+    return (false);
+  }
+
+  while (bytes > 0)
+  {
+    if ((rbytes = write(batch->docfd, body, bytes)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "Batch: Unable to write document %d: %s", batch->documents, strerror(errno));
+      return (false);
+    }
+
+    body  += rbytes;
+    bytes -= (size_t)rbytes;
+  }
+
+  lseek(batch->docfd, 0, SEEK_SET);
+
+  // Translate with the same filter data, the filters close their copies of
+  // the file descriptors...
+  cupsArrayClear(batch->chain);
+
+  for (i = 0; i < conversion->num_filters; i ++)
+    cupsArrayAdd(batch->chain, &(conversion->filters[i]));
+
+  content_type       = data->content_type;
+  data->content_type = conversion->srctype;
+  status             = cfFilterChain(dup(batch->docfd), dup(batch->brffd), 1, data, batch->chain);
+  data->content_type = content_type;
+
+  if (status)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Batch: Unable to translate document %d.", batch->documents);
+    return (false);
+  }
+
+  if ((size = lseek(batch->brffd, 0, SEEK_END)) <= 0)
+    return (true);
+
+  if (!brf_batch_separate(batch))
+    return (false);
+
+  lseek(batch->brffd, 0, SEEK_SET);
+
+  while ((rbytes = read(batch->brffd, buffer, sizeof(buffer))) != 0)
+  {
+    if (rbytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "Batch: Unable to read translation of document %d: %s", batch->documents, strerror(errno));
+      return (false);
+    }
+
+    if (!brf_batch_write(batch, buffer, (size_t)rbytes))
+      return (false);
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_batch_line()' - Find the end of a line.
+//
+
+static const char *			// O - End of line, without CR LF
+brf_batch_line(const char  *ptr,	// I - Start of line
+               const char  *end,	// I - End of data
+               const char  **next)	// O - Start of next line
+{
+  const char	*eol;			// End of line
+
+
+  if ((eol = memchr(ptr, '\n', (size_t)(end - ptr))) == NULL)
+  {
+    *next = end;
+    return (end);
+  }
+
+  *next = eol + 1;
+
+  if (eol > ptr && eol[-1] == '\r')
+    eol --;
+
+  return (eol);
+}
+
+
+//
+// 'brf_batch_separate()' - Write the separator before a document.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_batch_separate(brf_batch_t *batch)	// I - Batch state
+{
+  char	separator;			// Separator character
+
+
+  if (batch->written == 0)
+    return (true);
+
+  if (brf_batch_separator == BRF_BATCH_SUB_CHAR)
+    separator = BRF_BATCH_SUB;
+  else if (brf_batch_separator == BRF_BATCH_FORM_FEED && batch->last != BRF_BATCH_FF)
+    separator = BRF_BATCH_FF;
+  else
+    return (true);
+
+  return (brf_batch_write(batch, &separator, 1));
+}
+
+
+//
+// 'brf_batch_tempfile()' - Create an unlinked temporary file.
+//
+
+static int				// O - File descriptor or -1 on error
+brf_batch_tempfile(brf_batch_t *batch)	// I - Batch state
+{
+  const char	*tmpdir;		// Temporary directory
+  char		filename[1024];		// Temporary filename
+  int		fd;			// File descriptor
+
+
+  if ((tmpdir = getenv("TMPDIR")) == NULL)
+    tmpdir = "/tmp";
+
+  snprintf(filename, sizeof(filename), "%s/brf-batch-XXXXXX", tmpdir);
+
+  if ((fd = mkstemp(filename)) < 0)
+  {
+    if (batch->data->logfunc)
+      batch->data->logfunc(batch->data->logdata, CF_LOGLEVEL_ERROR, "Batch: Unable to create temporary file '%s': %s", filename, strerror(errno));
+    return (-1);
+  }
+
+  unlink(filename);
+
+  return (fd);
+}
+
+
+//
+// 'brf_batch_write()' - Write data to the output.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_batch_write(brf_batch_t *batch,	// I - Batch state
+                const char  *buffer,	// I - Data
+                size_t      bytes)	// I - Number of bytes
+{
+  ssize_t	wbytes;			// Bytes written
+
+
+  if (bytes == 0)
+    return (true);
+
+  batch->last = buffer[bytes - 1];
+
+  while (bytes > 0)
+  {
+    if ((wbytes = write(batch->outputfd, buffer, bytes)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (batch->data->logfunc)
+        batch->data->logfunc(batch->data->logdata, CF_LOGLEVEL_ERROR, "Batch: Unable to write output: %s", strerror(errno));
+      return (false);
+    }
+
+    buffer         += wbytes;
+    bytes          -= (size_t)wbytes;
+    batch->written += (size_t)wbytes;
+  }
+
+  return (true);
+}
@@ -0,0 +1,777 @@
+//
+// Translation cache for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Translated BRF files are kept in the "cache" subdirectory of the spool
+// directory, named after the SHA-256 of the job data and everything that
+// changes the translation: content types, driver, media and margins, and
+// the filters with their options and environment.  Reprinting a document
+// then skips pdftotext and liblouis.  The least recently used files are
+// removed when the cache grows beyond its size limit.
+//
+// When output to an embosser fails part way, the number of pages it took
+// and the job are kept next to the cached file as "KEY-PRINTER.resume" for
+// a day.  Printing the document again on that printer continues with the
+// next page when it is for that job, or for a job that names it with the
+// "braille-resume-job" option; other jobs print the whole document.  A
+// record is only written while its printer runs the job, so they are plain
+// files without any locking.
+//
+// Each cached file also gets a page index, "KEY.idx", with the offsets of
+// its pages, so that page ranges of a cached book are copied without
+// scanning it again.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <utime.h>
+
+
+//
+// Constants...
+//
+
+#define BRF_CACHE_JOBS		64	// Recent job keys remembered
+#define BRF_CACHE_RESUME_AGE	86400	// Seconds a resume record is kept
+
+
+//
+// Local types...
+//
+
+typedef struct brf_cache_entry_s	// Cached translation
+{
+  char		key[65];		// SHA-256 key in hex
+  size_t	size;			// Size of the BRF file
+  time_t	used;			// Last use
+} brf_cache_entry_t;
+
+typedef struct brf_cache_job_s		// Cache key of a recent job
+{
+  int		printer_id,		// Printer ID
+		job_id;			// Job ID
+  char		key[65];		// SHA-256 key in hex
+} brf_cache_job_t;
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t	brf_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for the cache
+static cups_array_t	*brf_cache_entries = NULL;
+					// Cached translations by key
+static char		brf_cache_dir[1024] = "",
+					// Cache directory
+			brf_cache_spool[1024] = "";
+					// Directory for uncached translations
+static size_t		brf_cache_max_size = 0,
+					// Maximum size of the cache
+			brf_cache_size = 0;
+					// Current size of the cache
+static time_t		brf_cache_stamp = 0;
+					// Last use time handed out
+static brf_cache_job_t	brf_cache_jobs[BRF_CACHE_JOBS];
+					// Keys of recent jobs
+static int		brf_cache_next_job = 0;
+					// Next slot in brf_cache_jobs
+static unsigned long	brf_cache_hits = 0,
+					// Number of cache hits
+			brf_cache_misses = 0;
+					// Number of cache misses
+
+
+//
+// Local functions...
+//
+
+static bool	brf_cache_add(const char *key, size_t size, time_t used);
+static int	brf_cache_compare(brf_cache_entry_t *a, brf_cache_entry_t *b, void *data);
+static void	brf_cache_evict(void);
+static time_t	brf_cache_now(void);
+static bool	brf_cache_key(pappl_job_t *job, brf_spooling_conversion_t *conversion, char *key, size_t keysize);
+static bool	brf_cache_status_cb(pappl_client_t *client, void *data);
+static int	brf_cache_translate(pappl_job_t *job, brf_spooling_conversion_t *conversion, const char *tempfile);
+
+
+//
+// 'brf_cache_enabled()' - Tell whether translations are cached.
+//
+
+bool					// O - `true` if enabled, `false` otherwise
+brf_cache_enabled(void)
+{
+  return (brf_cache_entries != NULL);
+}
+
+
+//
+// 'brf_cache_get_resume()' - Get the number of pages already embossed.
+//
+
+int					// O - Pages embossed or 0 for none
+brf_cache_get_resume(
+    const char *key,			// I - Cache key
+    int        printer_id,		// I - Printer ID
+    int        *job_id)			// O - Job that embossed them
+{
+  char		filename[2048];		// Resume record
+  FILE		*fp;			// Resume record file
+  struct stat	fileinfo;		// File information
+  int		pages = 0;		// Pages embossed
+
+
+  *job_id = 0;
+
+  if (!brf_cache_dir[0])
+    return (0);
+
+  snprintf(filename, sizeof(filename), "%s/%s-%d.resume", brf_cache_dir, key, printer_id);
+
+  if (stat(filename, &fileinfo) || fileinfo.st_mtime < time(NULL) - BRF_CACHE_RESUME_AGE || (fp = fopen(filename, "r")) == NULL)
+    return (0);
+
+  if (fscanf(fp, "%d%d", &pages, job_id) != 2 || pages < 0 || *job_id <= 0)
+  {
+    pages   = 0;
+    *job_id = 0;
+  }
+
+  fclose(fp);
+
+  return (pages);
+}
+
+
+//
+// 'brf_cache_index()' - Get the page index of a cached translation.
+//
+// The index is made if the translation does not have one yet.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_cache_index(const char *key,	// I - Cache key
+                char       *filename,	// O - Index file
+                size_t     filesize)	// I - Size of filename buffer
+{
+  char	brffile[2048];			// Cached translation
+  int	fd;				// Translation file descriptor
+  bool	ret;				// Return value
+
+
+  if (!brf_cache_dir[0])
+    return (false);
+
+  snprintf(filename, filesize, "%s/%s.idx", brf_cache_dir, key);
+
+  if (!access(filename, R_OK))
+    return (true);
+
+  snprintf(brffile, sizeof(brffile), "%s/%s.brf", brf_cache_dir, key);
+
+  if ((fd = open(brffile, O_RDONLY)) < 0)
+    return (false);
+
+  ret = brf_pages_build_index(fd, filename);
+
+  close(fd);
+
+  return (ret);
+}
+
+
+//
+// 'brf_cache_job_key()' - Get the cache key brf_cache_open() used for a job.
+//
+
+bool					// O - `true` if known, `false` otherwise
+brf_cache_job_key(pappl_job_t *job,	// I - Job
+                  char        *key,	// O - Cache key
+                  size_t      keysize)	// I - Size of key buffer
+{
+  int	i,				// Looping var
+	printer_id = papplPrinterGetID(papplJobGetPrinter(job)),
+					// Printer ID
+	job_id = papplJobGetID(job);	// Job ID
+  bool	found = false;			// Found the job?
+
+
+  pthread_mutex_lock(&brf_cache_mutex);
+
+  for (i = 0; i < BRF_CACHE_JOBS; i ++)
+  {
+    if (brf_cache_jobs[i].job_id == job_id && brf_cache_jobs[i].printer_id == printer_id)
+    {
+      papplCopyString(key, brf_cache_jobs[i].key, keysize);
+      found = true;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&brf_cache_mutex);
+
+  return (found);
+}
+
+
+//
+// 'brf_cache_open()' - Open the BRF translation of a job.
+//
+// The translation is taken from the cache or made and added to it.  With
+// the cache disabled the job is translated into a temporary file.  The
+// file is unlinked or may be evicted any time, the returned file descriptor
+// stays valid until closed.
+//
+
+int					// O - File descriptor or -1 on error
+brf_cache_open(
+    pappl_job_t               *job,	// I - Job
+    brf_spooling_conversion_t *conversion)
+					// I - Pre-filter chain
+{
+  char		key[65],		// Cache key
+		filename[2048],		// Cached file
+		tempfile[2048];		// Translation in progress
+  brf_cache_entry_t *entry,		// Cached translation
+		search;			// Search key
+  struct stat	fileinfo;		// Translated file information
+  int		fd;			// File descriptor
+  bool		added = false;		// Added to the cache?
+
+
+  if (!brf_cache_entries || !brf_cache_key(job, conversion, key, sizeof(key)))
+  {
+    snprintf(tempfile, sizeof(tempfile), "%s/brf-translate-%d-%d.brf", brf_cache_spool, papplPrinterGetID(papplJobGetPrinter(job)), papplJobGetID(job));
+
+    if ((fd = brf_cache_translate(job, conversion, tempfile)) >= 0)
+      unlink(tempfile);
+
+    return (fd);
+  }
+
+  snprintf(filename, sizeof(filename), "%s/%s.brf", brf_cache_dir, key);
+
+  pthread_mutex_lock(&brf_cache_mutex);
+
+  brf_cache_jobs[brf_cache_next_job].printer_id = papplPrinterGetID(papplJobGetPrinter(job));
+  brf_cache_jobs[brf_cache_next_job].job_id     = papplJobGetID(job);
+  papplCopyString(brf_cache_jobs[brf_cache_next_job].key, key, sizeof(brf_cache_jobs[0].key));
+  brf_cache_next_job = (brf_cache_next_job + 1) % BRF_CACHE_JOBS;
+
+  papplCopyString(search.key, key, sizeof(search.key));
+
+  if ((entry = (brf_cache_entry_t *)cupsArrayFind(brf_cache_entries, &search)) != NULL)
+  {
+    if ((fd = open(filename, O_RDONLY)) >= 0)
+    {
+      brf_cache_hits ++;
+      entry->used = brf_cache_now();
+      utime(filename, NULL);
+
+      pthread_mutex_unlock(&brf_cache_mutex);
+
+      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Using cached translation '%s'.", filename);
+
+      return (fd);
+    }
+
+    // File is gone, forget it...
+    snprintf(filename, sizeof(filename), "%s/%s.idx", brf_cache_dir, key);
+    unlink(filename);
+
+    brf_cache_size -= entry->size;
+    cupsArrayRemove(brf_cache_entries, entry);
+    free(entry);
+  }
+
+  brf_cache_misses ++;
+
+  pthread_mutex_unlock(&brf_cache_mutex);
+
+  // Translate into a temporary file and move it into place, unless another
+  // job with the same document got there first...
+  snprintf(tempfile, sizeof(tempfile), "%s/%s.tmp-%d-%d", brf_cache_dir, key, papplPrinterGetID(papplJobGetPrinter(job)), papplJobGetID(job));
+
+  if ((fd = brf_cache_translate(job, conversion, tempfile)) < 0)
+    return (-1);
+
+  pthread_mutex_lock(&brf_cache_mutex);
+
+  if (!cupsArrayFind(brf_cache_entries, &search) && !fstat(fd, &fileinfo) && !rename(tempfile, filename))
+  {
+    brf_cache_add(key, (size_t)fileinfo.st_size, brf_cache_now());
+    brf_cache_evict();
+    added = true;
+  }
+  else
+    unlink(tempfile);
+
+  pthread_mutex_unlock(&brf_cache_mutex);
+
+  // Index the pages while the file is still in memory...
+  if (added)
+  {
+    snprintf(filename, sizeof(filename), "%s/%s.idx", brf_cache_dir, key);
+    brf_pages_build_index(fd, filename);
+  }
+
+  return (fd);
+}
+
+
+//
+// 'brf_cache_set_resume()' - Record the number of pages already embossed.
+//
+// A count of 0 removes the record if it is for the job.
+//
+
+void
+brf_cache_set_resume(
+    const char *key,			// I - Cache key
+    int        printer_id,		// I - Printer ID
+    int        job_id,			// I - Job that embossed them
+    int        pages)			// I - Pages embossed
+{
+  char		filename[2048],		// Resume record
+		tempfile[2048];		// Record being written
+  FILE		*fp;			// Resume record file
+  int		record_job;		// Job of current record
+
+
+  if (!brf_cache_dir[0])
+    return;
+
+  snprintf(filename, sizeof(filename), "%s/%s-%d.resume", brf_cache_dir, key, printer_id);
+
+  if (pages <= 0)
+  {
+    if (brf_cache_get_resume(key, printer_id, &record_job) > 0 && record_job == job_id)
+      unlink(filename);
+    return;
+  }
+
+  snprintf(tempfile, sizeof(tempfile), "%s/%s-%d.tmp-%d", brf_cache_dir, key, printer_id, (int)getpid());
+
+  if ((fp = fopen(tempfile, "w")) == NULL)
+    return;
+
+  fprintf(fp, "%d %d\n", pages, job_id);
+
+  if (fclose(fp) || rename(tempfile, filename))
+    unlink(tempfile);
+}
+
+
+//
+// 'brf_cache_start()' - Set up the translation cache.
+//
+// The cache is enabled when "max_size" is not 0.  Files left from earlier
+// runs are added back, the web interface gets a page with the cache
+// statistics.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_cache_start(
+    pappl_system_t *system,		// I - System
+    const char     *spool_dir,		// I - Spool directory
+    size_t         max_size)		// I - Maximum size of the cache
+{
+  DIR		*dir;			// Cache directory
+  struct dirent	*dent;			// Directory entry
+  struct stat	fileinfo;		// File information
+  char		filename[2048];		// File in cache directory
+  size_t	len;			// Length of file name
+
+
+  papplCopyString(brf_cache_spool, spool_dir, sizeof(brf_cache_spool));
+
+  if (max_size == 0)
+    return (true);
+
+  snprintf(brf_cache_dir, sizeof(brf_cache_dir), "%s/cache", spool_dir);
+
+  if (mkdir(brf_cache_dir, 0700) && errno != EEXIST)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to create translation cache directory '%s': %s", brf_cache_dir, strerror(errno));
+    return (false);
+  }
+
+  if ((dir = opendir(brf_cache_dir)) == NULL)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to open translation cache directory '%s': %s", brf_cache_dir, strerror(errno));
+    return (false);
+  }
+
+  brf_cache_entries  = cupsArrayNew((cups_array_func_t)brf_cache_compare, NULL);
+  brf_cache_max_size = max_size;
+
+  while ((dent = readdir(dir)) != NULL)
+  {
+    if (dent->d_name[0] == '.')
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s/%s", brf_cache_dir, dent->d_name);
+
+    if ((len = strlen(dent->d_name)) > 72 && dent->d_name[64] == '-' && !strcmp(dent->d_name + len - 7, ".resume") && !stat(filename, &fileinfo) && fileinfo.st_mtime >= time(NULL) - BRF_CACHE_RESUME_AGE)
+      continue;				// Keep recent resume records
+
+    if (len == 68 && !strcmp(dent->d_name + 64, ".idx"))
+      continue;				// Page index, checked below
+
+    if ((len = strlen(dent->d_name)) != 68 || strcmp(dent->d_name + 64, ".brf") || stat(filename, &fileinfo) || !S_ISREG(fileinfo.st_mode))
+    {
+      // Remove unfinished translations...
+      unlink(filename);
+      continue;
+    }
+
+    dent->d_name[64] = '\0';
+    brf_cache_add(dent->d_name, (size_t)fileinfo.st_size, fileinfo.st_mtime);
+  }
+
+  // Remove page indexes of translations that are gone...
+  rewinddir(dir);
+
+  while ((dent = readdir(dir)) != NULL)
+  {
+    brf_cache_entry_t search;		// Search key
+
+    if (strlen(dent->d_name) != 68 || strcmp(dent->d_name + 64, ".idx"))
+      continue;
+
+    papplCopyString(search.key, dent->d_name, sizeof(search.key));
+
+    if (!cupsArrayFind(brf_cache_entries, &search))
+    {
+      snprintf(filename, sizeof(filename), "%s/%s", brf_cache_dir, dent->d_name);
+      unlink(filename);
+    }
+  }
+
+  closedir(dir);
+
+  brf_cache_evict();
+
+  papplSystemAddResourceCallback(system, "/cache", "text/html", brf_cache_status_cb, NULL);
+  papplSystemAddLink(system, "Translation Cache", "/cache", PAPPL_LOPTIONS_OTHER);
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Translation cache '%s' has %d file(s), %lu of %lu KiB used.", brf_cache_dir, cupsArrayCount(brf_cache_entries), (unsigned long)(brf_cache_size / 1024), (unsigned long)(brf_cache_max_size / 1024));
+
+  return (true);
+}
+
+
+//
+// 'brf_cache_add()' - Add an entry to the cache index.
+//
+// The cache mutex must be held.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_cache_add(const char *key,		// I - Cache key
+              size_t     size,		// I - Size of the BRF file
+              time_t     used)		// I - Last use
+{
+  brf_cache_entry_t *entry;		// New entry
+
+
+  if ((entry = (brf_cache_entry_t *)calloc(1, sizeof(brf_cache_entry_t))) == NULL)
+    return (false);
+
+  papplCopyString(entry->key, key, sizeof(entry->key));
+  entry->size = size;
+  entry->used = used;
+
+  if (used > brf_cache_stamp)
+    brf_cache_stamp = used;
+
+  cupsArrayAdd(brf_cache_entries, entry);
+  brf_cache_size += size;
+
+  return (true);
+}
+
+
+//
+// 'brf_cache_compare()' - Compare two cache entries.
+//
+
+static int				// O - Result of comparison
+brf_cache_compare(brf_cache_entry_t *a,	// I - First entry
+                  brf_cache_entry_t *b,	// I - Second entry
+                  void              *data)
+					// I - Callback data (unused)
+{
+  (void)data;
+
+  return (strcmp(a->key, b->key));
+}
+
+
+//
+// 'brf_cache_evict()' - Remove the least recently used files until the
+//                       cache fits its size limit.
+//
+// The cache mutex must be held.
+//
+
+static void
+brf_cache_evict(void)
+{
+  brf_cache_entry_t *entry,		// Current entry
+		*oldest;		// Least recently used entry
+  char		filename[2048];		// Cached file
+
+
+  while (brf_cache_size > brf_cache_max_size && cupsArrayCount(brf_cache_entries) > 0)
+  {
+    for (oldest = entry = (brf_cache_entry_t *)cupsArrayFirst(brf_cache_entries); entry; entry = (brf_cache_entry_t *)cupsArrayNext(brf_cache_entries))
+    {
+      if (entry->used < oldest->used)
+        oldest = entry;
+    }
+
+    snprintf(filename, sizeof(filename), "%s/%s.brf", brf_cache_dir, oldest->key);
+    unlink(filename);
+    snprintf(filename, sizeof(filename), "%s/%s.idx", brf_cache_dir, oldest->key);
+    unlink(filename);
+
+    brf_cache_size -= oldest->size;
+    cupsArrayRemove(brf_cache_entries, oldest);
+    free(oldest);
+  }
+}
+
+
+//
+// 'brf_cache_key()' - Compute the cache key of a job.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_cache_key(
+    pappl_job_t               *job,	// I - Job
+    brf_spooling_conversion_t *conversion,
+					// I - Pre-filter chain
+    char                      *key,	// O - Cache key
+    size_t                    keysize)	// I - Size of key buffer
+{
+  int		fd,			// Job file descriptor
+		i, j;			// Looping vars
+  struct stat	fileinfo;		// Job file information
+  void		*map;			// Mapped job file
+  unsigned char	hash[32];		// SHA-256 hash
+  char		buffer[8192],		// Translation settings
+		*bufptr,		// Pointer into buffer
+		*bufend = buffer + sizeof(buffer);
+					// End of buffer
+  cf_filter_data_t *filter_data;	// Options for the filters
+  cf_filter_external_t *params;		// External filter parameters
+  const brf_louis_t *louis;		// In-process translation tables
+  pappl_pr_options_t *options;		// Job options
+  ssize_t	hashlen;		// Length of hash
+
+
+  // Hash the job data...
+  if ((fd = open(papplJobGetFilename(job), O_RDONLY)) < 0)
+    return (false);
+
+  if (fstat(fd, &fileinfo) || !S_ISREG(fileinfo.st_mode))
+  {
+    close(fd);
+    return (false);
+  }
+
+  if (fileinfo.st_size == 0)
+  {
+    hashlen = cupsHashData("sha2-256", "", 0, hash, sizeof(hash));
+  }
+  else if ((map = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+  {
+    hashlen = cupsHashData("sha2-256", map, (size_t)fileinfo.st_size, hash, sizeof(hash));
+    munmap(map, (size_t)fileinfo.st_size);
+  }
+  else
+    hashlen = -1;
+
+  close(fd);
+
+  if (hashlen != (ssize_t)sizeof(hash))
+    return (false);
+
+  // Then add everything that changes the translation...
+  if ((filter_data = brf_job_filter_data(job, conversion)) == NULL)
+    return (false);
+
+  options = papplJobCreatePrintOptions(job, INT_MAX, false);
+
+  cupsHashString(hash, sizeof(hash), buffer, sizeof(buffer));
+  bufptr = buffer + strlen(buffer);
+
+  snprintf(bufptr, (size_t)(bufend - bufptr), "\n%s\n%s\n%s\n%s %dx%d %d,%d,%d,%d\n", conversion->srctype, conversion->dsttype, papplPrinterGetDriverName(papplJobGetPrinter(job)), options->media.size_name, options->media.size_width, options->media.size_length, options->media.left_margin, options->media.top_margin, options->media.right_margin, options->media.bottom_margin);
+  bufptr += strlen(bufptr);
+
+  for (i = 0; i < filter_data->num_options; i ++)
+  {
+    // Pages are picked from the cached BRF and copies are made by the
+    // embosser or by sending the BRF again (brf_pool_copy())...
+    if (!strcmp(filter_data->options[i].name, "page-ranges") || !strcmp(filter_data->options[i].name, "copies"))
+      continue;
+
+    snprintf(bufptr, (size_t)(bufend - bufptr), "%s=%s\n", filter_data->options[i].name, filter_data->options[i].value);
+    bufptr += strlen(bufptr);
+  }
+
+  for (i = 0; i < conversion->num_filters; i ++)
+  {
+    snprintf(bufptr, (size_t)(bufend - bufptr), "%s\n", conversion->filters[i].name);
+    bufptr += strlen(bufptr);
+
+    if (conversion->filters[i].function == brf_louis_filter_function && (louis = (const brf_louis_t *)cfFilterDataGetExt(filter_data, BRF_LOUIS_EXT)) != NULL)
+    {
+      snprintf(bufptr, (size_t)(bufend - bufptr), "liblouis %s %dx%d\n", louis->tables, louis->width, louis->height);
+      bufptr += strlen(bufptr);
+    }
+
+    if ((conversion->filters[i].function != cfFilterExternal && conversion->filters[i].function != brf_helper_filter_function && conversion->filters[i].function != brf_louis_filter_function) || (params = (cf_filter_external_t *)conversion->filters[i].parameters) == NULL)
+      continue;
+
+    snprintf(bufptr, (size_t)(bufend - bufptr), "%s\n", params->filter);
+    bufptr += strlen(bufptr);
+
+    for (j = 0; j < params->num_options; j ++)
+    {
+      snprintf(bufptr, (size_t)(bufend - bufptr), "%s=%s\n", params->options[j].name, params->options[j].value);
+      bufptr += strlen(bufptr);
+    }
+
+    for (j = 0; params->envp && params->envp[j]; j ++)
+    {
+      snprintf(bufptr, (size_t)(bufend - bufptr), "%s\n", params->envp[j]);
+      bufptr += strlen(bufptr);
+    }
+  }
+
+  papplJobDeletePrintOptions(options);
+  brf_filter_data_delete(filter_data);
+
+  // Too many settings to tell jobs apart reliably, don't cache...
+  if (bufptr >= bufend - 1)
+    return (false);
+
+  if (cupsHashData("sha2-256", buffer, (size_t)(bufptr - buffer), hash, sizeof(hash)) != (ssize_t)sizeof(hash))
+    return (false);
+
+  cupsHashString(hash, sizeof(hash), key, keysize);
+
+  return (true);
+}
+
+
+//
+// 'brf_cache_now()' - Get the time of a use.
+//
+// Uses within the same second still get increasing times, so that the
+// eviction order is exact.  The cache mutex must be held.
+//
+
+static time_t				// O - Use time
+brf_cache_now(void)
+{
+  time_t	now = time(NULL);	// Current time
+
+
+  if (now <= brf_cache_stamp)
+    now = brf_cache_stamp + 1;
+
+  return (brf_cache_stamp = now);
+}
+
+
+//
+// 'brf_cache_status_cb()' - Show the translation cache statistics.
+//
+
+static bool				// O - `true` if handled, `false` otherwise
+brf_cache_status_cb(
+    pappl_client_t *client,		// I - Client
+    void           *data)		// I - Callback data (unused)
+{
+  unsigned long	hits,			// Number of cache hits
+		misses;			// Number of cache misses
+  int		count;			// Number of cached files
+  size_t	size;			// Size of the cache
+
+
+  (void)data;
+
+  pthread_mutex_lock(&brf_cache_mutex);
+  hits   = brf_cache_hits;
+  misses = brf_cache_misses;
+  count  = cupsArrayCount(brf_cache_entries);
+  size   = brf_cache_size;
+  pthread_mutex_unlock(&brf_cache_mutex);
+
+  papplClientHTMLHeader(client, "Translation Cache", 0);
+  papplClientHTMLPrintf(client,
+			"    <div class=\"content\">\n"
+			"      <div class=\"row\">\n"
+			"        <div class=\"col-12\">\n"
+			"          <h1 class=\"title\">Translation Cache</h1>\n"
+			"          <table class=\"form\">\n"
+			"            <tbody>\n"
+			"              <tr><th>Hits:</th><td>%lu</td></tr>\n"
+			"              <tr><th>Misses:</th><td>%lu</td></tr>\n"
+			"              <tr><th>Hit rate:</th><td>%.1f%%</td></tr>\n"
+			"              <tr><th>Files:</th><td>%d</td></tr>\n"
+			"              <tr><th>Size:</th><td>%lu of %lu KiB</td></tr>\n"
+			"            </tbody>\n"
+			"          </table>\n"
+			"        </div>\n"
+			"      </div>\n"
+			"    </div>\n", hits, misses, hits + misses ? 100.0 * hits / (hits + misses) : 0.0, count, (unsigned long)(size / 1024), (unsigned long)(brf_cache_max_size / 1024));
+  papplClientHTMLFooter(client);
+
+  return (true);
+}
+
+
+//
+// 'brf_cache_translate()' - Translate a job into a file and open it.
+//
+
+static int				// O - File descriptor or -1 on error
+brf_cache_translate(
+    pappl_job_t               *job,	// I - Job
+    brf_spooling_conversion_t *conversion,
+					// I - Pre-filter chain
+    const char                *tempfile)// I - File to translate into
+{
+  int	fd;				// File descriptor
+
+
+  if (!brf_job_translate(job, conversion, tempfile))
+  {
+    unlink(tempfile);
+    return (-1);
+  }
+
+  if ((fd = open(tempfile, O_RDONLY)) < 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open translation file '%s': %s", tempfile, strerror(errno));
+    unlink(tempfile);
+  }
+
+  return (fd);
+}
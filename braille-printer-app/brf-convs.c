@@ -0,0 +1,481 @@
+//
+// Conversion graph for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Every way of converting one format to another is an edge with a cost:
+// the in-process filter functions are added by the server and the CUPS
+// filters come from "braille.convs", the same file CUPS uses.  The chain
+// for a job is the cheapest path from its format to the printer's format.
+// On equal costs in-process filters win over external ones, then shorter
+// chains over longer ones.
+//
+// Chains are resolved once per input and printer format and kept for the
+// life of the server, including the formats that cannot be converted.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <pthread.h>
+
+
+//
+// Constants...
+//
+
+#define BRF_CONVS_MAX_TYPES	256	// Maximum number of formats in a route
+#define BRF_CONVS_MAX_FILTERS	8	// Maximum number of filters in a chain
+#define BRF_CONVS_COST_SCALE	128	// Scale of conversion costs, more than
+					// the 9 per filter of a longest chain
+
+
+//
+// Local types...
+//
+
+typedef struct brf_convs_edge_s		// Conversion between two formats
+{
+  char		*srctype,		// Input format
+		*dsttype;		// Output format
+  int		cost;			// Relative cost
+  bool		external;		// Runs a CUPS filter?
+  cf_filter_filter_in_chain_t filter;	// Filter, `function` is `NULL` for none
+} brf_convs_edge_t;
+
+typedef struct brf_convs_route_s	// Resolved chain
+{
+  char		*srctype,		// Input format
+		*dsttype;		// Printer format
+  brf_spooling_conversion_t *conversion;// Chain or `NULL` if there is none
+} brf_convs_route_t;
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t	brf_convs_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for the routes
+static cups_array_t	*brf_convs_edges = NULL;
+					// Conversions, in the order added
+static cups_array_t	*brf_convs_routes = NULL;
+					// Resolved chains
+
+
+//
+// Local functions...
+//
+
+static int	brf_convs_compare(brf_convs_route_t *a, brf_convs_route_t *b, void *data);
+static brf_spooling_conversion_t *brf_convs_route(const char *srctype, const char *dsttype);
+static int	brf_convs_type(const char **types, int *num_types, const char *type);
+
+
+//
+// 'brf_convs_add()' - Add a conversion.
+//
+// A `NULL` function converts without a filter, for formats that are the
+// same data under another name.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_convs_add(
+    const char           *srctype,	// I - Input format
+    const char           *dsttype,	// I - Output format
+    int                  cost,		// I - Relative cost
+    cf_filter_function_t function,	// I - Filter function or `NULL`
+    void                 *parameters,	// I - Filter parameters
+    const char           *name)		// I - Filter name
+{
+  brf_convs_edge_t	*edge;		// New conversion
+
+
+  if (!brf_convs_edges && (brf_convs_edges = cupsArrayNew(NULL, NULL)) == NULL)
+    return (false);
+
+  if ((edge = calloc(1, sizeof(brf_convs_edge_t))) == NULL)
+    return (false);
+
+  edge->srctype           = strdup(srctype);
+  edge->dsttype           = strdup(dsttype);
+  edge->cost              = cost;
+  edge->external          = function == cfFilterExternal || function == brf_helper_filter_function;
+  edge->filter.function   = function;
+  edge->filter.parameters = parameters;
+  edge->filter.name       = (char *)name;
+
+  if (!edge->srctype || !edge->dsttype)
+  {
+    free(edge->srctype);
+    free(edge->dsttype);
+    free(edge);
+    return (false);
+  }
+
+  cupsArrayAdd(brf_convs_edges, edge);
+
+  return (true);
+}
+
+
+//
+// 'brf_convs_load()' - Load the CUPS filters of a ".convs" file.
+//
+// Lines are "srctype dsttype cost program".  Wildcard formats and filters
+// that are not installed are skipped.
+//
+
+int					// O - Number of conversions added or -1 on error
+brf_convs_load(
+    pappl_system_t *system,		// I - System
+    const char     *filename)		// I - ".convs" file
+{
+  cups_file_t	*fp;			// File
+  char		line[1024],		// Line from file
+		srctype[256],		// Input format
+		dsttype[256],		// Output format
+		program[256],		// Filter program
+		filter[1024];		// Filter path
+  int		cost,			// Cost of conversion
+		linenum = 0,		// Line number
+		count = 0;		// Number of conversions added
+  cf_filter_external_t *params;		// Filter parameters
+
+
+  if ((fp = cupsFileOpen(filename, "r")) == NULL)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to open conversions file '%s': %s", filename, strerror(errno));
+    return (-1);
+  }
+
+  while (cupsFileGets(fp, line, sizeof(line)))
+  {
+    linenum ++;
+
+    if (line[0] == '#' || !line[0])
+      continue;
+
+    if (sscanf(line, "%255s%255s%d%255s", srctype, dsttype, &cost, program) != 4)
+    {
+      papplLog(system, PAPPL_LOGLEVEL_WARN, "Bad conversion on line %d of '%s'.", linenum, filename);
+      continue;
+    }
+
+    if (strchr(srctype, '*') || strchr(dsttype, '*'))
+      continue;
+
+    if (!strcmp(program, "-"))
+    {
+      if (brf_convs_add(srctype, dsttype, cost, NULL, NULL, "-"))
+        count ++;
+      continue;
+    }
+
+    if (program[0] == '/')
+      papplCopyString(filter, program, sizeof(filter));
+    else
+      snprintf(filter, sizeof(filter), CUPS_SERVERBIN "/filter/%s", program);
+
+    if (access(filter, X_OK))
+    {
+      papplLog(system, PAPPL_LOGLEVEL_DEBUG, "Skipping %s to %s conversion, '%s' is not installed.", srctype, dsttype, filter);
+      continue;
+    }
+
+    // The parameters and names are kept for the life of the server...
+    if ((params = calloc(1, sizeof(cf_filter_external_t))) == NULL || (params->filter = strdup(filter)) == NULL)
+    {
+      free(params);
+      break;
+    }
+
+    if (brf_convs_add(srctype, dsttype, cost, brf_helper_filter_function, params, strrchr(params->filter, '/') + 1))
+      count ++;
+  }
+
+  cupsFileClose(fp);
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Loaded %d conversion(s) from '%s'.", count, filename);
+
+  return (count);
+}
+
+
+//
+// 'brf_convs_register()' - Register the formats that convert to a printer format.
+//
+// Formats PAPPL prints by itself (raster and images) are left to PAPPL.
+//
+
+void
+brf_convs_register(
+    pappl_system_t         *system,	// I - System
+    const char             *dsttype,	// I - Printer format
+    pappl_mime_filter_cb_t cb)		// I - Filter callback
+{
+  int			i,		// Looping var
+			count;		// Number of conversions
+  brf_convs_edge_t	*edge;		// Current conversion
+  cups_array_t		*added;		// Formats registered so far
+
+
+  if ((added = cupsArrayNew((cups_array_func_t)strcmp, NULL)) == NULL)
+    return;
+
+  // Index the conversions, routing walks them too...
+  for (i = 0, count = cupsArrayCount(brf_convs_edges); i < count; i ++)
+  {
+    edge = (brf_convs_edge_t *)cupsArrayIndex(brf_convs_edges, i);
+
+    if (!strcmp(edge->srctype, dsttype) || !strcmp(edge->srctype, "image/png") || !strcmp(edge->srctype, "image/jpeg") || !strcmp(edge->srctype, "image/pwg-raster") || !strcmp(edge->srctype, "image/urf"))
+      continue;
+
+    if (cupsArrayFind(added, edge->srctype) || !brf_find_conversion(edge->srctype, dsttype))
+      continue;
+
+    cupsArrayAdd(added, edge->srctype);
+    papplSystemAddMIMEFilter(system, edge->srctype, dsttype, cb, NULL);
+  }
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "%d format(s) can be converted to %s.", cupsArrayCount(added), dsttype);
+
+  cupsArrayDelete(added);
+}
+
+
+//
+// 'brf_find_conversion()' - Find the pre-filter chain from one format to another.
+//
+
+brf_spooling_conversion_t *		// O - Conversion or `NULL` if none
+brf_find_conversion(
+    const char *srctype,		// I - Input format
+    const char *dsttype)		// I - Printer format
+{
+  brf_convs_route_t	key,		// Search key
+			*route;		// Resolved chain
+
+
+  key.srctype = (char *)srctype;
+  key.dsttype = (char *)dsttype;
+
+  pthread_mutex_lock(&brf_convs_mutex);
+
+  if (!brf_convs_routes)
+    brf_convs_routes = cupsArrayNew((cups_array_func_t)brf_convs_compare, NULL);
+
+  if ((route = (brf_convs_route_t *)cupsArrayFind(brf_convs_routes, &key)) == NULL && (route = calloc(1, sizeof(brf_convs_route_t))) != NULL)
+  {
+    route->srctype = strdup(srctype);
+    route->dsttype = strdup(dsttype);
+
+    if (route->srctype && route->dsttype)
+    {
+      route->conversion = brf_convs_route(route->srctype, route->dsttype);
+      cupsArrayAdd(brf_convs_routes, route);
+    }
+    else
+    {
+      free(route->srctype);
+      free(route->dsttype);
+      free(route);
+      route = NULL;
+    }
+  }
+
+  pthread_mutex_unlock(&brf_convs_mutex);
+
+  return (route ? route->conversion : NULL);
+}
+
+
+//
+// 'brf_find_job_conversion()' - Find the pre-filter chain for a job.
+//
+
+brf_spooling_conversion_t *		// O - Conversion or `NULL` if none
+brf_find_job_conversion(
+    pappl_job_t *job)			// I - Job
+{
+  pappl_pr_driver_data_t driver_data;	// Printer driver data
+
+
+  if (!papplPrinterGetDriverData(papplJobGetPrinter(job), &driver_data) || !driver_data.format)
+    driver_data.format = "application/vnd.cups-paged-brf";
+
+  return (brf_find_conversion(papplJobGetFormat(job), driver_data.format));
+}
+
+
+//
+// 'brf_convs_compare()' - Compare two resolved chains.
+//
+
+static int				// O - Result of comparison
+brf_convs_compare(
+    brf_convs_route_t *a,		// I - First chain
+    brf_convs_route_t *b,		// I - Second chain
+    void              *data)		// I - Callback data (unused)
+{
+  int	ret;				// Result of comparison
+
+
+  (void)data;
+
+  if ((ret = strcmp(a->srctype, b->srctype)) == 0)
+    ret = strcmp(a->dsttype, b->dsttype);
+
+  return (ret);
+}
+
+
+//
+// 'brf_convs_route()' - Find the cheapest chain between two formats.
+//
+// Costs are scaled so that they always decide, an external filter adds 8
+// to the cost of its conversion and every filter adds 1 to the cost of a
+// chain.  Up to BRF_CONVS_MAX_FILTERS filters add less than one step of
+// the scale.
+//
+
+static brf_spooling_conversion_t *	// O - New chain or `NULL` if none
+brf_convs_route(const char *srctype,	// I - Input format, kept by the chain
+                const char *dsttype)	// I - Printer format, kept by the chain
+{
+  const char	*types[BRF_CONVS_MAX_TYPES];
+					// Formats seen so far
+  int		dist[BRF_CONVS_MAX_TYPES];
+					// Cost of the cheapest path to format
+  brf_convs_edge_t *prev[BRF_CONVS_MAX_TYPES];
+					// Last conversion of that path
+  bool		done[BRF_CONVS_MAX_TYPES];
+					// Cheapest path known?
+  brf_convs_edge_t *edge,		// Current conversion
+		*path[BRF_CONVS_MAX_FILTERS];
+					// Conversions in the chain
+  int		num_types = 0,		// Number of formats
+		num_path = 0,		// Number of conversions in the chain
+		num_filters = 0,	// Number of filters in the chain
+		num_edges = cupsArrayCount(brf_convs_edges),
+					// Number of conversions
+		current,		// Current format
+		next,			// Format reached by a conversion
+		cost,			// Cost through current format
+		i, j;			// Looping vars
+  brf_spooling_conversion_t *conversion;// New chain
+
+
+  if (brf_convs_type(types, &num_types, srctype) < 0)
+    return (NULL);
+
+  dist[0] = 0;
+  prev[0] = NULL;
+  done[0] = false;
+
+  for (;;)
+  {
+    // Take the cheapest format not done yet...
+    for (current = -1, i = 0; i < num_types; i ++)
+    {
+      if (!done[i] && dist[i] >= 0 && (current < 0 || dist[i] < dist[current]))
+        current = i;
+    }
+
+    if (current < 0)
+      return (NULL);			// No path
+
+    if (!strcmp(types[current], dsttype))
+      break;
+
+    done[current] = true;
+
+    for (j = 0; j < num_edges; j ++)
+    {
+      edge = (brf_convs_edge_t *)cupsArrayIndex(brf_convs_edges, j);
+
+      if (strcmp(edge->srctype, types[current]))
+        continue;
+
+      i = num_types;
+      if ((next = brf_convs_type(types, &num_types, edge->dsttype)) < 0)
+        continue;
+
+      if (next == i)
+      {
+        // First conversion to this format...
+        dist[next] = -1;
+        prev[next] = NULL;
+        done[next] = false;
+      }
+
+      cost = dist[current] + edge->cost * BRF_CONVS_COST_SCALE + (edge->external ? 8 : 0) + 1;
+
+      if (!done[next] && (dist[next] < 0 || cost < dist[next]))
+      {
+        dist[next] = cost;
+        prev[next] = edge;
+      }
+    }
+  }
+
+  // Walk back from the printer format...
+  for (edge = prev[current]; edge; edge = prev[brf_convs_type(types, &num_types, edge->srctype)])
+  {
+    if (num_path >= BRF_CONVS_MAX_FILTERS)
+      return (NULL);
+
+    path[num_path ++] = edge;
+
+    if (edge->filter.function)
+      num_filters ++;
+  }
+
+  if ((conversion = calloc(1, sizeof(brf_spooling_conversion_t) + (size_t)num_filters * sizeof(cf_filter_filter_in_chain_t))) == NULL)
+    return (NULL);
+
+  conversion->srctype = (char *)srctype;
+  conversion->dsttype = (char *)dsttype;
+
+  while (num_path > 0)
+  {
+    edge = path[-- num_path];
+
+    if (edge->filter.function)
+      conversion->filters[conversion->num_filters ++] = edge->filter;
+  }
+
+  return (conversion);
+}
+
+
+//
+// 'brf_convs_type()' - Find or add a format in a route.
+//
+
+static int				// O - Index or -1 if too many formats
+brf_convs_type(const char **types,	// I - Formats
+               int        *num_types,	// IO - Number of formats
+               const char *type)	// I - Format to find
+{
+  int	i;				// Looping var
+
+
+  for (i = 0; i < *num_types; i ++)
+  {
+    if (!strcmp(types[i], type))
+      return (i);
+  }
+
+  if (*num_types >= BRF_CONVS_MAX_TYPES)
+    return (-1);
+
+  types[*num_types] = type;
+
+  return ((*num_types) ++);
+}
@@ -0,0 +1,524 @@
+//
+// Device output for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// PAPPL does not give access to the device file descriptor, so sendfile()
+// and splice() are not available.  Spooled files are instead mapped into
+// memory and handed to papplDeviceWrite() in large slices, which PAPPL
+// passes straight to the device without going through its own buffer.
+//
+// Data from a pipe goes through a bounded ring buffer: a writer thread
+// drains it to the device at the embosser's speed while the filter chain
+// keeps filling it, so a slow embosser does not stall translation until the
+// buffer is full.  Before writing, the device status is checked at most once
+// per second; while the embosser reports it is out of paper, jammed, open
+// or offline, the output waits with a growing back-off instead of failing
+// the job, and the condition is shown in the printer's state reasons.
+//
+// The BRF of a job is encoded for the printer's embosser model on the way,
+// pages are counted in what the device accepted: by the encoder for the
+// form feeds it sent, otherwise in the data written.  The count is added to
+// the job's completed impressions with the status checks, so progress is
+// shown while the job prints without locking the job for every write.
+//
+// All of this runs in the server process, on the job thread and the writer
+// thread it starts, never in a filter process forked by cfFilterChain():
+// the copy must be able to change the job and printer, and a forked child
+// of the multithreaded server must not create threads.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+
+
+//
+// Constants...
+//
+
+#define BRF_DEVICE_SLICE	1048576	// Bytes per papplDeviceWrite() of mapped data
+#define BRF_DEVICE_RING		4194304	// Bytes buffered from a pipe
+#define BRF_DEVICE_READ		65536	// Bytes per read() from a pipe
+#define BRF_DEVICE_STOPPED	(PAPPL_PREASON_COVER_OPEN | PAPPL_PREASON_MEDIA_EMPTY | PAPPL_PREASON_MEDIA_JAM | PAPPL_PREASON_MEDIA_NEEDED | PAPPL_PREASON_OFFLINE)
+					// Device status reasons to wait out
+
+
+//
+// Local types...
+//
+
+typedef struct brf_device_out_s		// Device output state
+{
+  pappl_device_t	*device;	// Output device
+  pappl_job_t		*job;		// Job or `NULL`
+  int			*debug_fd;	// Debug copy file descriptor or `NULL`
+  brf_encode_t		*encode;	// Embosser encoder or `NULL`
+  int			pages,		// Form feeds written
+			reported;	// Pages added to the job's impressions
+  bool			partial;	// Data after the last form feed?
+  time_t		checked;	// Time of last status check
+  pthread_mutex_t	mutex;		// Mutex for ring buffer
+  pthread_cond_t	cond;		// Data/space available condition
+  char			*ring;		// Ring buffer
+  size_t		start,		// Offset of first buffered byte
+			used;		// Bytes buffered
+  bool			eof,		// All input is in the buffer
+			error;		// Write error or canceled
+} brf_device_out_t;
+
+
+//
+// Local functions...
+//
+
+static bool	brf_device_data(brf_device_out_t *out, const char *buffer, size_t bytes);
+static bool	brf_device_finish(brf_device_out_t *out, bool ok);
+static void	brf_device_progress(brf_device_out_t *out, bool done);
+static bool	brf_device_ready(brf_device_out_t *out);
+static bool	brf_device_write(brf_device_out_t *out, const char *buffer, size_t bytes);
+static void	*brf_device_writer(brf_device_out_t *out);
+
+
+//
+// 'brf_device_copy()' - Copy a file or pipe to the device.
+//
+// Regular files are mapped, anything else is copied through the ring buffer
+// by a writer thread.  If "job" is not `NULL`, the copy stops when it is
+// canceled.  If "debug_fd" points to an open file descriptor, the data is
+// also copied there; on a write error to it the copy is stopped and it is
+// set to -1.  If "pages" is not `NULL`, it is set to the number of form
+// feeds the device has accepted, also when the copy fails.
+//
+
+ssize_t					// O  - Bytes copied or -1 on error
+brf_device_copy(
+    pappl_device_t *device,		// I  - Output device
+    pappl_job_t    *job,		// I  - Job or `NULL`
+    int            fd,			// I  - Input file descriptor
+    int            *debug_fd,		// IO - Debug copy file descriptor or `NULL`
+    int            *pages)		// O  - Pages sent or `NULL`
+{
+  brf_device_out_t out;			// Output state
+  struct stat	fileinfo;		// Input file information
+  void		*map = MAP_FAILED;	// Mapped input file
+  ssize_t	bytes = 0,		// Bytes read
+		total = 0;		// Total bytes copied
+  size_t	offset,			// Offset in mapped file or ring
+		slice;			// Bytes in current slice
+  pthread_t	writer;			// Writer thread
+  bool		error;			// Did the output fail?
+  char		buffer[65536];		// Read buffer, without a writer thread
+
+
+  memset(&out, 0, sizeof(out));
+  out.device   = device;
+  out.job      = job;
+  out.debug_fd = debug_fd;
+  out.encode   = brf_encode_new(job, (brf_encode_cb_t)brf_device_write, &out);
+
+  if (!fstat(fd, &fileinfo) && S_ISREG(fileinfo.st_mode) && fileinfo.st_size > 0 && lseek(fd, 0, SEEK_CUR) == 0)
+    map = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (map != MAP_FAILED)
+  {
+    madvise(map, (size_t)fileinfo.st_size, MADV_SEQUENTIAL);
+
+    for (offset = 0; offset < (size_t)fileinfo.st_size; offset += slice)
+    {
+      if ((slice = (size_t)fileinfo.st_size - offset) > BRF_DEVICE_SLICE)
+        slice = BRF_DEVICE_SLICE;
+
+      if (!brf_device_data(&out, (const char *)map + offset, slice))
+        break;
+    }
+
+    munmap(map, (size_t)fileinfo.st_size);
+
+    error = !brf_device_finish(&out, offset >= (size_t)fileinfo.st_size);
+
+    if (pages)
+      *pages = out.pages;
+
+    return (error ? -1 : (ssize_t)fileinfo.st_size);
+  }
+
+  // Start the writer thread, or copy synchronously if that is not possible...
+  pthread_mutex_init(&out.mutex, NULL);
+  pthread_cond_init(&out.cond, NULL);
+
+  if ((out.ring = malloc(BRF_DEVICE_RING)) == NULL || pthread_create(&writer, NULL, (void *(*)(void *))brf_device_writer, &out))
+  {
+    free(out.ring);
+    pthread_cond_destroy(&out.cond);
+    pthread_mutex_destroy(&out.mutex);
+
+    while ((bytes = read(fd, buffer, sizeof(buffer))) != 0)
+    {
+      if (bytes < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+        break;
+      }
+
+      if (!brf_device_data(&out, buffer, (size_t)bytes))
+      {
+        bytes = -1;
+        break;
+      }
+
+      total += bytes;
+    }
+
+    if (!brf_device_finish(&out, bytes >= 0))
+      bytes = -1;
+
+    if (pages)
+      *pages = out.pages;
+
+    return (bytes < 0 ? -1 : total);
+  }
+
+  // Fill the ring buffer, the writer only touches the buffered bytes...
+  for (;;)
+  {
+    pthread_mutex_lock(&out.mutex);
+    while (out.used == BRF_DEVICE_RING && !out.error)
+      pthread_cond_wait(&out.cond, &out.mutex);
+
+    error  = out.error;
+    offset = (out.start + out.used) % BRF_DEVICE_RING;
+    slice  = BRF_DEVICE_RING - out.used;
+    pthread_mutex_unlock(&out.mutex);
+
+    if (error)
+      break;
+
+    if (slice > BRF_DEVICE_RING - offset)
+      slice = BRF_DEVICE_RING - offset;
+    if (slice > BRF_DEVICE_READ)
+      slice = BRF_DEVICE_READ;
+
+    if ((bytes = read(fd, out.ring + offset, slice)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      break;
+    }
+    else if (bytes == 0)
+      break;
+
+    pthread_mutex_lock(&out.mutex);
+    out.used += (size_t)bytes;
+    total    += bytes;
+    pthread_cond_signal(&out.cond);
+    pthread_mutex_unlock(&out.mutex);
+  }
+
+  // Let the writer drain the buffer...
+  pthread_mutex_lock(&out.mutex);
+  out.eof = true;
+  if (bytes < 0)
+    out.error = true;
+  pthread_cond_signal(&out.cond);
+  pthread_mutex_unlock(&out.mutex);
+
+  pthread_join(writer, NULL);
+
+  error = !brf_device_finish(&out, !out.error);
+
+  if (pages)
+    *pages = out.pages;
+
+  pthread_cond_destroy(&out.cond);
+  pthread_mutex_destroy(&out.mutex);
+  free(out.ring);
+
+  return (error ? -1 : total);
+}
+
+
+//
+// 'brf_device_send()' - Send a buffer to the device.
+//
+// The buffer is written in large slices like a mapped file, with the same
+// status checks.  If "pages" is not `NULL`, it is set to the number of form
+// feeds the device has accepted, also when the copy fails.
+//
+
+ssize_t					// O - Bytes sent or -1 on error
+brf_device_send(
+    pappl_device_t *device,		// I - Output device
+    pappl_job_t    *job,		// I - Job or `NULL`
+    const char     *buffer,		// I - Data
+    size_t         bytes,		// I - Number of bytes
+    int            *pages)		// O - Pages sent or `NULL`
+{
+  brf_device_out_t out;			// Output state
+  size_t	offset,			// Offset in buffer
+		slice;			// Bytes in current slice
+  bool		error;			// Did the output fail?
+
+
+  memset(&out, 0, sizeof(out));
+  out.device = device;
+  out.job    = job;
+  out.encode = brf_encode_new(job, (brf_encode_cb_t)brf_device_write, &out);
+
+  for (offset = 0; offset < bytes; offset += slice)
+  {
+    if ((slice = bytes - offset) > BRF_DEVICE_SLICE)
+      slice = BRF_DEVICE_SLICE;
+
+    if (!brf_device_data(&out, buffer + offset, slice))
+      break;
+  }
+
+  error = !brf_device_finish(&out, offset >= bytes);
+
+  if (pages)
+    *pages = out.pages;
+
+  return (error ? -1 : (ssize_t)bytes);
+}
+
+
+//
+// 'brf_device_data()' - Write BRF data, encoded for the embosser.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_device_data(
+    brf_device_out_t *out,		// I - Output state
+    const char       *buffer,		// I - BRF data
+    size_t           bytes)		// I - Number of bytes
+{
+  if (bytes > 0)
+    out->partial = buffer[bytes - 1] != '\f';
+
+  if (out->encode)
+    return (brf_encode_write(out->encode, buffer, bytes));
+  else
+    return (brf_device_write(out, buffer, bytes));
+}
+
+
+//
+// 'brf_device_finish()' - Finish the output of a copy.
+//
+// The rest of the encoded document and the embosser's terminator are only
+// sent when the copy succeeded.  The last page counts as done when it does
+// not end with a form feed.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_device_finish(brf_device_out_t *out,// I - Output state
+                  bool             ok)	// I - Did the copy succeed so far?
+{
+  if (out->encode)
+  {
+    if (ok)
+      ok = brf_encode_finish(out->encode);
+
+    out->pages = brf_encode_pages(out->encode);
+
+    brf_encode_delete(out->encode);
+    out->encode = NULL;
+  }
+
+  brf_device_progress(out, ok);
+
+  return (ok);
+}
+
+
+//
+// 'brf_device_progress()' - Add the pages sent to the job's impressions.
+//
+// The total is only known up front for cached translations, otherwise it
+// is raised to the pages done so far.
+//
+
+static void
+brf_device_progress(
+    brf_device_out_t *out,		// I - Output state
+    bool             done)		// I - Is the output complete?
+{
+  int	pages,				// Pages done
+	completed;			// Impressions completed for the job
+
+
+  if (out->encode)
+    out->pages = brf_encode_pages(out->encode);
+
+  pages = out->pages + (done && out->partial ? 1 : 0);
+
+  if (!out->job || pages <= out->reported)
+    return;
+
+  papplJobSetImpressionsCompleted(out->job, pages - out->reported);
+  out->reported = pages;
+
+  if ((completed = papplJobGetImpressionsCompleted(out->job)) > papplJobGetImpressions(out->job))
+    papplJobSetImpressions(out->job, completed);
+}
+
+
+//
+// 'brf_device_ready()' - Wait until the device can take data.
+//
+// The device status is checked at most once per second.  While it reports
+// a condition the embosser cannot print through, wait 1 to 16 seconds at a
+// time until it clears or the job is canceled.  The reasons are shown on the
+// printer while waiting.
+//
+
+static bool				// O - `true` to write, `false` if canceled
+brf_device_ready(brf_device_out_t *out)	// I - Output state
+{
+  pappl_preason_t	reasons,	// Device status reasons
+			waiting = PAPPL_PREASON_NONE;
+					// Reasons we are waiting for
+  pappl_printer_t	*printer = out->job ? papplJobGetPrinter(out->job) : NULL;
+					// Printer
+  time_t		now = time(NULL);
+					// Current time
+  unsigned		delay = 1;	// Seconds to wait
+
+
+  if (now == out->checked)
+    return (true);
+
+  brf_device_progress(out, false);
+
+  if (out->job && papplJobIsCanceled(out->job))
+    return (false);
+
+  while ((reasons = papplDeviceGetStatus(out->device) & BRF_DEVICE_STOPPED) != PAPPL_PREASON_NONE)
+  {
+    if (reasons != waiting)
+    {
+      if (out->job)
+        papplLogJob(out->job, PAPPL_LOGLEVEL_WARN, "Printer is not ready (state reasons 0x%x), waiting.", (unsigned)reasons);
+      if (printer)
+        papplPrinterSetReasons(printer, reasons, waiting & ~reasons);
+
+      waiting = reasons;
+    }
+
+    if (out->job && papplJobIsCanceled(out->job))
+      break;
+
+    sleep(delay);
+
+    if (delay < 16)
+      delay *= 2;
+  }
+
+  if (waiting)
+  {
+    if (printer)
+      papplPrinterSetReasons(printer, PAPPL_PREASON_NONE, waiting);
+    if (out->job && !reasons)
+      papplLogJob(out->job, PAPPL_LOGLEVEL_INFO, "Printer is ready, resuming output.");
+  }
+
+  out->checked = time(NULL);
+
+  return (reasons == PAPPL_PREASON_NONE);
+}
+
+
+//
+// 'brf_device_write()' - Write a buffer to the device and the debug copy.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_device_write(
+    brf_device_out_t *out,		// I - Output state
+    const char       *buffer,		// I - Data
+    size_t           bytes)		// I - Number of bytes
+{
+  const char	*ptr,			// Pointer into buffer
+		*end = buffer + bytes;	// End of buffer
+
+
+  if (out->debug_fd && *out->debug_fd >= 0 && write(*out->debug_fd, buffer, bytes) != (ssize_t)bytes)
+  {
+    close(*out->debug_fd);
+    *out->debug_fd = -1;
+  }
+
+  BRF_TRACE_EVENT(BRF_TRACE_DEVICE_WRITE, out->job ? papplJobGetID(out->job) : 0, NULL, (long long)bytes);
+
+  if (!brf_device_ready(out) || papplDeviceWrite(out->device, buffer, bytes) < 0)
+    return (false);
+
+  // Encoded data is counted by the encoder...
+  if (out->encode)
+    return (true);
+
+  for (ptr = buffer; (ptr = memchr(ptr, '\f', (size_t)(end - ptr))) != NULL; ptr ++)
+    out->pages ++;
+
+  return (true);
+}
+
+
+//
+// 'brf_device_writer()' - Drain the ring buffer to the device.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_device_writer(brf_device_out_t *out)// I - Output state
+{
+  size_t	start,			// Offset of data to write
+		bytes;			// Bytes to write
+
+
+  for (;;)
+  {
+    pthread_mutex_lock(&out->mutex);
+    while (out->used == 0 && !out->eof && !out->error)
+      pthread_cond_wait(&out->cond, &out->mutex);
+
+    if (out->error || out->used == 0)
+    {
+      pthread_mutex_unlock(&out->mutex);
+      break;
+    }
+
+    start = out->start;
+    if ((bytes = out->used) > BRF_DEVICE_RING - start)
+      bytes = BRF_DEVICE_RING - start;
+    if (bytes > BRF_DEVICE_SLICE)
+      bytes = BRF_DEVICE_SLICE;
+    pthread_mutex_unlock(&out->mutex);
+
+    if (!brf_device_data(out, out->ring + start, bytes))
+    {
+      pthread_mutex_lock(&out->mutex);
+      out->error = true;
+      pthread_cond_signal(&out->cond);
+      pthread_mutex_unlock(&out->mutex);
+      break;
+    }
+
+    pthread_mutex_lock(&out->mutex);
+    out->start = (out->start + bytes) % BRF_DEVICE_RING;
+    out->used  -= bytes;
+    pthread_cond_signal(&out->cond);
+    pthread_mutex_unlock(&out->mutex);
+  }
+
+  return (NULL);
+}
@@ -0,0 +1,637 @@
+//
+// Embosser encoders for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The BRF of a job is encoded for the embosser on its way to the device,
+// as the "brftoembosser" and "textbrftoindexv3/v4" CUPS filter scripts do:
+//
+// - Generic embossers get lines ended with CR LF and non-breaking spaces as
+//   spaces.
+// - Index V3 and V4 embossers get their temporary parameters, then each line
+//   in 6-dot transparent mode (ESC \ LENGTH NUL, the Index codes, CR LF),
+//   then SUB.  They differ only in the parameters for the page layout.
+//   The parameters are for the job's media and let the embosser make the
+//   copies (MC).  Patterns with dots 7 or 8 cannot be embossed in 6-dot
+//   mode, they are sent without those dots and the job gets a warning.
+//
+// Generic embossers cannot make copies, brf_encode_copies() tells the
+// output to send the document again for each one.
+//
+// Each model family is one instance of the same inline encoder with a
+// constant description, so the compiler drops the code and tests another
+// family needs.  The family is chosen by driver name when the printer is
+// created.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <limits.h>
+#include <stdarg.h>
+
+
+//
+// Constants...
+//
+
+#define BRF_ENCODE_BUFFER	65536	// Output buffer size
+#define BRF_ENCODE_MAX_LINE	127	// Index transparent mode limit, the
+					// embossers mishandle lengths 128-255
+
+
+//
+// Types...
+//
+
+typedef struct brf_encode_model_s	// Compile-time description of a family
+{
+  const unsigned char *table;		// Index code of each BRF byte or `NULL`
+  int		max_line;		// Cells per line, 0 to copy lines as they are
+  const char	*terminator;		// Sent after the document
+} brf_encode_model_t;
+
+struct brf_encoder_s			// Embosser model family
+{
+  const char	*prefix;		// Driver name prefix
+  const char	*name;			// Family name for the log
+  bool		copies;			// Does the embosser make the copies?
+  void		(*prologue)(brf_encode_t *enc, const pappl_media_col_t *media, int copies);
+					// Add the job parameters
+  bool		(*write)(brf_encode_t *enc, const unsigned char *buffer, size_t bytes);
+					// Encode data
+  const brf_encode_model_t *model;	// Description
+};
+
+struct brf_encode_s			// Encoder state of a job
+{
+  const brf_encoder_t *encoder;		// Model family
+  pappl_job_t	*job;			// Job
+  brf_encode_cb_t cb;			// Output callback
+  void		*ctx;			// Output callback data
+  bool		error;			// Output or encoding failed?
+  unsigned	cp;			// Code point being decoded
+  int		need;			// UTF-8 continuation bytes still needed
+  unsigned char	seq[4];			// UTF-8 sequence being copied
+  int		seqlen;			// Bytes in sequence
+  bool		cr,			// Was the last character a CR?
+		leading,		// Still in leading form feeds of the line?
+		bad_control,		// Unsupported control characters seen?
+		bad_nonascii,		// Unsupported non-ASCII characters seen?
+		bad_8dot;		// Patterns with dots 7 or 8 seen?
+  int		ncells;			// Cells on the current line
+  int		pages,			// Form feeds sent
+		queued;			// Form feeds in output buffer
+  unsigned char	cells[BRF_ENCODE_MAX_LINE];
+					// Index codes of the line
+  size_t	used;			// Bytes in output buffer
+  unsigned char	buffer[BRF_ENCODE_BUFFER];
+					// Output buffer
+};
+
+
+//
+// Local functions...
+//
+
+static void	brf_encode_cell(brf_encode_t *enc, unsigned char code);
+static bool	brf_encode_flush(brf_encode_t *enc);
+static bool	brf_encode_generic(brf_encode_t *enc, const unsigned char *buffer, size_t bytes);
+static bool	brf_encode_index(brf_encode_t *enc, const unsigned char *buffer, size_t bytes);
+static bool	brf_encode_line(brf_encode_t *enc, bool newline);
+static void	brf_encode_params(brf_encode_t *enc, int copies);
+static void	brf_encode_printf(brf_encode_t *enc, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void	brf_encode_put(brf_encode_t *enc, const void *data, size_t len);
+static void	brf_encode_v3_prologue(brf_encode_t *enc, const pappl_media_col_t *media, int copies);
+static void	brf_encode_v4_prologue(brf_encode_t *enc, const pappl_media_col_t *media, int copies);
+
+
+//
+// Local globals...
+//
+
+static const unsigned char brf_encode_index6[256] =
+{					// Index 6-dot code of each BRF byte,
+					// `a-z{|}~ as @A-Z[\]_
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x56, 0x20, 0x74, 0x53, 0x51, 0x57, 0x04, 0x67, 0x76, 0x41, 0x54, 0x40, 0x44, 0x50, 0x14,
+  0x64, 0x02, 0x06, 0x22, 0x62, 0x42, 0x26, 0x66, 0x46, 0x24, 0x61, 0x60, 0x43, 0x77, 0x34, 0x71,
+  0x10, 0x01, 0x03, 0x11, 0x31, 0x21, 0x13, 0x33, 0x23, 0x12, 0x32, 0x05, 0x07, 0x15, 0x35, 0x25,
+  0x17, 0x37, 0x27, 0x16, 0x36, 0x45, 0x47, 0x72, 0x55, 0x75, 0x65, 0x52, 0x63, 0x73, 0x30, 0x70,
+  0x10, 0x01, 0x03, 0x11, 0x31, 0x21, 0x13, 0x33, 0x23, 0x12, 0x32, 0x05, 0x07, 0x15, 0x35, 0x25,
+  0x17, 0x37, 0x27, 0x16, 0x36, 0x45, 0x47, 0x72, 0x55, 0x75, 0x65, 0x52, 0x63, 0x73, 0x70, 0x00
+};
+
+static const brf_encode_model_t brf_encode_generic_model =
+{					// Generic embosser
+  NULL, 0, ""
+};
+
+static const brf_encode_model_t brf_encode_index_model =
+{					// Index V3 and V4 embossers
+  brf_encode_index6, BRF_ENCODE_MAX_LINE, "\032"
+};
+
+static const brf_encoder_t brf_encoders[] =
+{					// Model families by driver name prefix
+  { "gen_",      "generic",  false, NULL,                   brf_encode_generic, &brf_encode_generic_model },
+  { "index_v3_", "Index V3", true,  brf_encode_v3_prologue, brf_encode_index,   &brf_encode_index_model },
+  { "index_v4_", "Index V4", true,  brf_encode_v4_prologue, brf_encode_index,   &brf_encode_index_model }
+};
+
+
+//
+// 'brf_encode_copies()' - Get the number of times to send a job's document.
+//
+// Returns 1 when the embosser makes the copies itself.
+//
+
+int					// O - Number of times to send the document
+brf_encode_copies(pappl_job_t *job)	// I - Job
+{
+  pappl_pr_driver_data_t driver_data;	// Printer driver data
+  const brf_driver_t *driver;		// Driver extension
+  int		copies;			// Copies of the job
+
+
+  if (!job || (copies = papplJobGetCopies(job)) < 2)
+    return (1);
+
+  if (papplPrinterGetDriverData(papplJobGetPrinter(job), &driver_data) && (driver = (const brf_driver_t *)driver_data.extension) != NULL && driver->encoder && driver->encoder->copies)
+    return (1);
+
+  return (copies);
+}
+
+
+//
+// 'brf_encode_delete()' - Free the encoder state of a job.
+//
+
+void
+brf_encode_delete(brf_encode_t *enc)	// I - Encoder state or `NULL`
+{
+  free(enc);
+}
+
+
+//
+// 'brf_encode_find()' - Find the model family of a driver.
+//
+
+const brf_encoder_t *			// O - Model family or `NULL` to send BRF as is
+brf_encode_find(const char *driver_name)// I - Driver name
+{
+  size_t	i;			// Looping var
+
+
+  for (i = 0; i < sizeof(brf_encoders) / sizeof(brf_encoders[0]); i ++)
+  {
+    if (!strncmp(driver_name, brf_encoders[i].prefix, strlen(brf_encoders[i].prefix)))
+      return (brf_encoders + i);
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'brf_encode_finish()' - Send the rest of the document and the terminator.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_encode_finish(brf_encode_t *enc)	// I - Encoder state
+{
+  const brf_encode_model_t *model = enc->encoder->model;
+					// Description
+
+
+  if (enc->need > 0 && !model->max_line)
+  {
+    // Truncated UTF-8 sequence at the end...
+    brf_encode_put(enc, enc->seq, (size_t)enc->seqlen);
+  }
+  else if (enc->need > 0)
+  {
+    enc->bad_nonascii = true;
+    brf_encode_cell(enc, model->table[' ']);
+  }
+
+  if (model->max_line && enc->ncells > 0 && !brf_encode_line(enc, false))
+    enc->error = true;
+
+  if (enc->bad_control)
+    papplLogJob(enc->job, PAPPL_LOGLEVEL_WARN, "Sent unsupported control characters in the BRF as blank cells.");
+  if (enc->bad_nonascii)
+    papplLogJob(enc->job, PAPPL_LOGLEVEL_WARN, "Sent unsupported non-ASCII characters in the BRF as blank cells.");
+  if (enc->bad_8dot)
+    papplLogJob(enc->job, PAPPL_LOGLEVEL_WARN, "Sent braille patterns with dots 7 or 8 without those dots, %s embossers only emboss 6 dots.", enc->encoder->name);
+
+  brf_encode_put(enc, model->terminator, strlen(model->terminator));
+
+  return (brf_encode_flush(enc) && !enc->error);
+}
+
+
+//
+// 'brf_encode_new()' - Start encoding a job for its printer's embosser.
+//
+// Returns `NULL` when the printer's driver has no model family, the BRF is
+// then sent as it is.
+//
+
+brf_encode_t *				// O - Encoder state or `NULL`
+brf_encode_new(pappl_job_t     *job,	// I - Job
+               brf_encode_cb_t cb,	// I - Output callback
+               void            *ctx)	// I - Output callback data
+{
+  pappl_pr_driver_data_t driver_data;	// Printer driver data
+  const brf_driver_t *driver;		// Driver extension
+  brf_encode_t	*enc;			// Encoder state
+  pappl_pr_options_t *options;		// Job options
+
+
+  if (!job || !papplPrinterGetDriverData(papplJobGetPrinter(job), &driver_data) || (driver = (const brf_driver_t *)driver_data.extension) == NULL || !driver->encoder)
+    return (NULL);
+
+  if ((enc = (brf_encode_t *)calloc(1, sizeof(brf_encode_t))) == NULL)
+    return (NULL);
+
+  enc->encoder = driver->encoder;
+  enc->job     = job;
+  enc->cb      = cb;
+  enc->ctx     = ctx;
+  enc->leading = true;
+
+  if (enc->encoder->prologue)
+  {
+    options = papplJobCreatePrintOptions(job, INT_MAX, false);
+    (enc->encoder->prologue)(enc, &options->media, options->copies);
+    papplJobDeletePrintOptions(options);
+  }
+
+  return (enc);
+}
+
+
+//
+// 'brf_encode_pages()' - Get the number of form feeds the output accepted.
+//
+// The encoded data cannot be scanned for form feeds, Index line headers
+// have the cell count as a byte.
+//
+
+int					// O - Form feeds sent
+brf_encode_pages(brf_encode_t *enc)	// I - Encoder state
+{
+  return (enc->pages);
+}
+
+
+//
+// 'brf_encode_write()' - Encode data for the embosser.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_encode_write(brf_encode_t *enc,	// I - Encoder state
+                 const char   *buffer,	// I - BRF data
+                 size_t       bytes)	// I - Number of bytes
+{
+  return ((enc->encoder->write)(enc, (const unsigned char *)buffer, bytes) && !enc->error);
+}
+
+
+//
+// 'brf_encode_bytes()' - Encode data for a model family.
+//
+// Always inlined into the family's write function with a constant model, so
+// each family only gets its own branches.
+//
+
+static inline __attribute__((always_inline)) bool
+					// O - `true` on success, `false` on error
+brf_encode_bytes(
+    brf_encode_t             *enc,	// I - Encoder state
+    const unsigned char      *buffer,	// I - BRF data
+    size_t                   bytes,	// I - Number of bytes
+    const brf_encode_model_t *model)	// I - Description
+{
+  const unsigned char *end = buffer + bytes;
+					// End of data
+  unsigned char	c;			// Current byte
+
+
+  for (; buffer < end && !enc->error; buffer ++)
+  {
+    c = *buffer;
+
+    if (enc->need > 0)
+    {
+      if ((c & 0xc0) == 0x80)
+      {
+        enc->cp = (enc->cp << 6) | (c & 0x3f);
+        enc->seq[enc->seqlen ++] = c;
+
+        if (-- enc->need > 0)
+          continue;
+
+        if (!model->max_line)
+        {
+          // Copy anything but non-breaking spaces...
+          if (enc->cp == 0xa0)
+            brf_encode_put(enc, " ", 1);
+          else
+            brf_encode_put(enc, enc->seq, (size_t)enc->seqlen);
+
+          enc->cr = false;
+        }
+        else if (enc->cp == 0xa0)
+          brf_encode_cell(enc, model->table[' ']);
+        else if (enc->cp >= 0x2800 && enc->cp <= 0x28ff)
+        {
+          // Unicode braille, dots 7 and 8 are dropped...
+          if (enc->cp >= 0x2840)
+            enc->bad_8dot = true;
+
+          brf_encode_cell(enc, (unsigned char)(((enc->cp - 0x2800) & 0x07) | (((enc->cp - 0x2800) & 0x38) << 1)));
+        }
+        else
+        {
+          enc->bad_nonascii = true;
+          brf_encode_cell(enc, model->table[' ']);
+        }
+        continue;
+      }
+
+      // Truncated sequence...
+      enc->need = 0;
+
+      if (!model->max_line)
+        brf_encode_put(enc, enc->seq, (size_t)enc->seqlen);
+      else
+      {
+        enc->bad_nonascii = true;
+        brf_encode_cell(enc, model->table[' ']);
+      }
+    }
+
+    if (c >= 0xc2 && c <= 0xf4)
+    {
+      enc->cp      = c & (c < 0xe0 ? 0x1f : c < 0xf0 ? 0x0f : 0x07);
+      enc->need    = c < 0xe0 ? 1 : c < 0xf0 ? 2 : 3;
+      enc->seq[0]  = c;
+      enc->seqlen  = 1;
+    }
+    else if (!model->max_line)
+    {
+      // Lines end with CR LF...
+      if (c == '\n' && !enc->cr)
+        brf_encode_put(enc, "\r\n", 2);
+      else if (c == 0xa0)
+        brf_encode_put(enc, " ", 1);
+      else
+        brf_encode_put(enc, buffer, 1);
+
+      if (c == '\f')
+        enc->queued ++;
+
+      enc->cr = c == '\r';
+    }
+    else if (c == '\n')
+    {
+      if (!brf_encode_line(enc, true))
+        return (false);
+    }
+    else if (c == '\r' || c == '\032')
+      continue;				// Strip CRs, ignore SUBs
+    else if (c == '\f' && enc->leading)
+    {
+      brf_encode_put(enc, "\f", 1);	// Form feeds before the line
+      enc->queued ++;
+    }
+    else if (c < ' ' || c == 0x7f)
+    {
+      enc->bad_control = true;
+      brf_encode_cell(enc, model->table[' ']);
+    }
+    else if (c < 0x80 || c == 0xa0)
+      brf_encode_cell(enc, model->table[c < 0x80 ? c : ' ']);
+    else
+    {
+      enc->bad_nonascii = true;
+      brf_encode_cell(enc, model->table[' ']);
+    }
+  }
+
+  return (!enc->error);
+}
+
+
+//
+// 'brf_encode_cell()' - Add a cell to the current Index line.
+//
+
+static void
+brf_encode_cell(brf_encode_t  *enc,	// I - Encoder state
+                unsigned char code)	// I - Index code
+{
+  if (enc->ncells < BRF_ENCODE_MAX_LINE)
+    enc->cells[enc->ncells] = code;
+
+  if (enc->ncells <= BRF_ENCODE_MAX_LINE)
+    enc->ncells ++;
+
+  enc->leading = false;
+}
+
+
+//
+// 'brf_encode_flush()' - Send the output buffer.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_encode_flush(brf_encode_t *enc)	// I - Encoder state
+{
+  if (enc->used > 0 && !enc->error && !(enc->cb)(enc->ctx, (const char *)enc->buffer, enc->used))
+    enc->error = true;
+
+  if (!enc->error)
+    enc->pages += enc->queued;
+
+  enc->used   = 0;
+  enc->queued = 0;
+
+  return (!enc->error);
+}
+
+
+//
+// 'brf_encode_generic()' - Encode data for a generic embosser.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_encode_generic(
+    brf_encode_t        *enc,		// I - Encoder state
+    const unsigned char *buffer,	// I - BRF data
+    size_t              bytes)		// I - Number of bytes
+{
+  return (brf_encode_bytes(enc, buffer, bytes, &brf_encode_generic_model));
+}
+
+
+//
+// 'brf_encode_index()' - Encode data for an Index embosser.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_encode_index(
+    brf_encode_t        *enc,		// I - Encoder state
+    const unsigned char *buffer,	// I - BRF data
+    size_t              bytes)		// I - Number of bytes
+{
+  return (brf_encode_bytes(enc, buffer, bytes, &brf_encode_index_model));
+}
+
+
+//
+// 'brf_encode_line()' - Send the current Index line in transparent mode.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_encode_line(brf_encode_t *enc,	// I - Encoder state
+                bool         newline)	// I - End the line with CR LF?
+{
+  unsigned char	header[4] = { '\033', '\\', 0, '\0' };
+					// Transparent mode for N cells
+
+
+  if (enc->ncells > BRF_ENCODE_MAX_LINE)
+  {
+    papplLogJob(enc->job, PAPPL_LOGLEVEL_ERROR, "Line too long for %s embosser, more than %d cells.", enc->encoder->name, BRF_ENCODE_MAX_LINE);
+    enc->error = true;
+    return (false);
+  }
+
+  if (enc->ncells > 0)
+  {
+    header[2] = (unsigned char)enc->ncells;
+    brf_encode_put(enc, header, sizeof(header));
+    brf_encode_put(enc, enc->cells, (size_t)enc->ncells);
+  }
+
+  if (newline)
+    brf_encode_put(enc, "\r\n", 2);
+
+  enc->ncells  = 0;
+  enc->leading = true;
+
+  return (!enc->error);
+}
+
+
+//
+// 'brf_encode_params()' - End the temporary parameters of an Index embosser.
+//
+// More than one copy is made by the embosser, as "textbrftoindexv3" does.
+//
+
+static void
+brf_encode_params(brf_encode_t *enc,	// I - Encoder state
+                  int          copies)	// I - Number of copies
+{
+  if (copies > 1)
+    brf_encode_printf(enc, ",MC%d", copies);
+
+  brf_encode_put(enc, ";", 1);
+}
+
+
+//
+// 'brf_encode_printf()' - Add formatted text to the output buffer.
+//
+
+static void
+brf_encode_printf(brf_encode_t *enc,	// I - Encoder state
+                  const char   *format,	// I - printf-style format string
+                  ...)			// I - Additional arguments
+{
+  char		buffer[256];		// Formatted text
+  int		len;			// Length of text
+  va_list	ap;			// Argument pointer
+
+
+  va_start(ap, format);
+  len = vsnprintf(buffer, sizeof(buffer), format, ap);
+  va_end(ap);
+
+  if (len > 0)
+    brf_encode_put(enc, buffer, (size_t)len < sizeof(buffer) ? (size_t)len : sizeof(buffer) - 1);
+}
+
+
+//
+// 'brf_encode_put()' - Add bytes to the output buffer.
+//
+
+static void
+brf_encode_put(brf_encode_t *enc,	// I - Encoder state
+               const void   *data,	// I - Bytes
+               size_t       len)	// I - Number of bytes
+{
+  if (enc->used + len > sizeof(enc->buffer) && !brf_encode_flush(enc))
+    return;
+
+  memcpy(enc->buffer + enc->used, data, len);
+  enc->used += len;
+}
+
+
+//
+// 'brf_encode_v3_prologue()' - Add the temporary parameters of an Index V3
+//                              embosser.
+//
+// Margins and page numbers are done in software, pages are one-sided with
+// 2.5mm text dots, 2.0mm graphic dots and 5.0mm line spacing, and the paper
+// size is given in millimeters.
+//
+
+static void
+brf_encode_v3_prologue(
+    brf_encode_t            *enc,	// I - Encoder state
+    const pappl_media_col_t *media,	// I - Job media
+    int                     copies)	// I - Number of copies
+{
+  brf_encode_printf(enc, "\033DTM0,BI0,FO0,MI1,DP1,TD0,GD0,PN0,PW%d,PL%d,LS4,BT0", media->size_width / 100, media->size_length / 100);
+  brf_encode_params(enc, copies);
+}
+
+
+//
+// 'brf_encode_v4_prologue()' - Add the temporary parameters of an Index V4
+//                              embosser.
+//
+// As for V3, but the page is given in cells and lines of the printable area.
+//
+
+static void
+brf_encode_v4_prologue(
+    brf_encode_t            *enc,	// I - Encoder state
+    const pappl_media_col_t *media,	// I - Job media
+    int                     copies)	// I - Number of copies
+{
+  int		width,			// Printable width
+		height;			// Printable height
+
+
+  width  = media->size_width - media->left_margin - media->right_margin;
+  height = media->size_length - media->top_margin - media->bottom_margin;
+
+  brf_encode_printf(enc, "\033DTM0,BI0,FO0,MI1,DP1,TD0,GD0,PN0,CH%d,LP%d,LS50,BT0", (width + BRF_CELL_SPACING) / BRF_CELL_WIDTH, (height + BRF_LINE_SPACING) / BRF_CELL_HEIGHT);
+  brf_encode_params(enc, copies);
+}
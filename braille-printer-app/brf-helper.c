@@ -0,0 +1,737 @@
+//
+// Filter helper pool for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Without in-process liblouis tables every job runs the texttobrf filter
+// script, and cfFilterExternal() forks the whole multi-threaded server for
+// it.  With the "filter-helpers" option a supervisor process, a fresh exec
+// of this program, is started before any threads and pre-forks that many
+// small helper processes.  Jobs are handed to them over a SOCK_SEQPACKET
+// socketpair: one message carries the command line and environment, and the
+// input, output, stderr and reply file descriptors as SCM_RIGHTS.  Whichever
+// idle helper reads the message spawns the filter, reports its PID and then
+// its exit status on the reply socket.  Helpers exit after
+// "filter-helper-jobs" jobs and the supervisor forks a clean replacement.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+
+//
+// Constants...
+//
+
+#define BRF_HELPER_ENV		"BRF_FILTER_HELPER"
+					// Environment variable for the supervisor
+#define BRF_HELPER_MAX_MESSAGE	65536	// Maximum request size
+#define BRF_HELPER_MAX_HELPERS	64	// Maximum number of helpers
+
+
+//
+// Local types...
+//
+
+typedef struct brf_helper_request_s	// Request header
+{
+  int		argc,			// Number of arguments
+		envc;			// Number of environment variables
+} brf_helper_request_t;
+
+typedef struct brf_helper_reply_s	// Reply message
+{
+  pid_t		pid;			// Filter process ID, 0 if not started
+  int		status;			// Exit status, or errno if not started
+} brf_helper_reply_t;
+
+
+//
+// Local globals...
+//
+
+static int		brf_helper_queue = -1;
+					// Request socket
+static int		brf_helper_death = -1;
+					// Pipe the supervisor waits on
+extern char		**environ;	// Environment
+
+
+//
+// Local functions...
+//
+
+static bool	brf_helper_add(char *buffer, size_t *used, const char *s);
+static void	brf_helper_log(cf_filter_data_t *data, char *line);
+static void	brf_helper_run(int queue, int max_jobs);
+static void	brf_helper_serve(int queue);
+static pid_t	brf_helper_spawn_one(int queue, int max_jobs);
+
+
+//
+// 'brf_helper_filter_function()' - Run an external filter in a helper.
+//
+// The "parameters" are cf_filter_external_t parameters as for
+// cfFilterExternal(), which is used instead when there is no helper pool.
+//
+
+int					// O - Error status
+brf_helper_filter_function(
+    int              inputfd,		// I - File descriptor input stream
+    int              outputfd,		// I - File descriptor output stream
+    int              inputseekable,	// I - Is input stream seekable?
+    cf_filter_data_t *data,		// I - Job and printer data
+    void             *parameters)	// I - Filter parameters
+{
+  cf_filter_external_t	*params = (cf_filter_external_t *)parameters;
+					// Filter parameters
+  cf_logfunc_t		log = data->logfunc;
+					// Log function
+  void			*ld = data->logdata;
+					// Log function data
+  char			*buffer,	// Request message
+			temp[1024],	// Temporary string
+			options[4096],	// Options argument
+			*optr,		// Pointer into options
+			line[1024];	// Line from the filter's stderr
+  size_t		used,		// Bytes in message
+			linelen = 0;	// Bytes in line
+  brf_helper_request_t	request;	// Request header
+  brf_helper_reply_t	reply;		// Reply from the helper
+  int			i,		// Looping var
+			errfds[2],	// Filter's stderr
+			replyfds[2],	// Reply socket
+			fds[4],		// Descriptors to pass
+			status = -1;	// Exit status
+  char			**envp;		// Pointer into environment
+  cups_option_t		*option;	// Current option
+  struct iovec		iov;		// Message data
+  struct msghdr		msg;		// Message
+  union
+  {
+    struct cmsghdr	hdr;		// Control header
+    char		buf[CMSG_SPACE(sizeof(fds))];
+					// Control data
+  }			control;	// File descriptors
+  struct pollfd		pfds[2];	// Poll data
+  ssize_t		bytes;		// Bytes read
+  pid_t			pid = 0;	// Filter process ID
+  bool			canceled = false;
+					// Was the job canceled?
+
+
+  if (brf_helper_queue < 0)
+    return (cfFilterExternal(inputfd, outputfd, inputseekable, data, parameters));
+
+  // Options argument, "name=value" separated by spaces...
+  options[0] = '\0';
+  for (i = data->num_options, option = data->options, optr = options; i > 0; i --, option ++)
+  {
+    snprintf(optr, sizeof(options) - (size_t)(optr - options), strchr(option->value, ' ') ? "%s%s='%s'" : "%s%s=%s", optr > options ? " " : "", option->name, option->value);
+    optr += strlen(optr);
+  }
+  for (i = params->num_options, option = params->options; i > 0; i --, option ++)
+  {
+    snprintf(optr, sizeof(options) - (size_t)(optr - options), strchr(option->value, ' ') ? "%s%s='%s'" : "%s%s=%s", optr > options ? " " : "", option->name, option->value);
+    optr += strlen(optr);
+  }
+
+  // Build the request: filter path, arguments, then the environment...
+  if ((buffer = malloc(BRF_HELPER_MAX_MESSAGE)) == NULL)
+    return (cfFilterExternal(inputfd, outputfd, inputseekable, data, parameters));
+
+  used         = sizeof(request);
+  request.argc = 6;
+  request.envc = 0;
+
+  snprintf(temp, sizeof(temp), "%d", data->job_id);
+  brf_helper_add(buffer, &used, params->filter);
+  brf_helper_add(buffer, &used, data->printer ? data->printer : params->filter);
+  brf_helper_add(buffer, &used, temp);
+  brf_helper_add(buffer, &used, data->job_user ? data->job_user : "");
+  brf_helper_add(buffer, &used, data->job_title ? data->job_title : "");
+  snprintf(temp, sizeof(temp), "%d", data->copies > 0 ? data->copies : 1);
+  brf_helper_add(buffer, &used, temp);
+  brf_helper_add(buffer, &used, options);
+
+  if (data->content_type)
+  {
+    snprintf(temp, sizeof(temp), "CONTENT_TYPE=%s", data->content_type);
+    request.envc += brf_helper_add(buffer, &used, temp);
+  }
+  if (data->final_content_type)
+  {
+    snprintf(temp, sizeof(temp), "FINAL_CONTENT_TYPE=%s", data->final_content_type);
+    request.envc += brf_helper_add(buffer, &used, temp);
+  }
+  if (data->printer)
+  {
+    snprintf(temp, sizeof(temp), "PRINTER=%s", data->printer);
+    request.envc += brf_helper_add(buffer, &used, temp);
+  }
+  for (envp = params->envp; envp && *envp; envp ++)
+    request.envc += brf_helper_add(buffer, &used, *envp);
+
+  memcpy(buffer, &request, sizeof(request));
+
+  if (pipe(errfds))
+  {
+    free(buffer);
+    return (cfFilterExternal(inputfd, outputfd, inputseekable, data, parameters));
+  }
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, replyfds))
+  {
+    close(errfds[0]);
+    close(errfds[1]);
+    free(buffer);
+    return (cfFilterExternal(inputfd, outputfd, inputseekable, data, parameters));
+  }
+
+  // Hand the job to the first idle helper...
+  fds[0] = inputfd;
+  fds[1] = outputfd;
+  fds[2] = errfds[1];
+  fds[3] = replyfds[1];
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base           = buffer;
+  iov.iov_len            = used;
+  msg.msg_iov            = &iov;
+  msg.msg_iovlen         = 1;
+  msg.msg_control        = control.buf;
+  msg.msg_controllen     = sizeof(control.buf);
+  control.hdr.cmsg_level = SOL_SOCKET;
+  control.hdr.cmsg_type  = SCM_RIGHTS;
+  control.hdr.cmsg_len   = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(&control.hdr), fds, sizeof(fds));
+
+  bytes = sendmsg(brf_helper_queue, &msg, MSG_NOSIGNAL);
+
+  free(buffer);
+  close(errfds[1]);
+  close(replyfds[1]);
+
+  if (bytes < 0)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_WARN, "%s: Unable to pass job to filter helper: %s", params->filter, strerror(errno));
+
+    close(errfds[0]);
+    close(replyfds[0]);
+    return (cfFilterExternal(inputfd, outputfd, inputseekable, data, parameters));
+  }
+
+  // The helper has its own copies now...
+  close(inputfd);
+  close(outputfd);
+
+  // Relay the filter's messages until it exits...
+  pfds[0].fd     = errfds[0];
+  pfds[0].events = POLLIN;
+  pfds[1].fd     = replyfds[0];
+  pfds[1].events = POLLIN;
+
+  while (pfds[0].fd >= 0 || pfds[1].fd >= 0)
+  {
+    if (poll(pfds, 2, 1000) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (!canceled && pid > 0 && data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_DEBUG, "%s: Job canceled, stopping filter (PID %d).", params->filter, (int)pid);
+
+      kill(pid, SIGTERM);
+      canceled = true;
+    }
+
+    if (pfds[0].revents)
+    {
+      if ((bytes = read(errfds[0], line + linelen, sizeof(line) - linelen - 1)) > 0)
+      {
+        char	*start,			// Start of line
+		*end;			// End of line
+
+        linelen += (size_t)bytes;
+        line[linelen] = '\0';
+
+        for (start = line; (end = strchr(start, '\n')) != NULL; start = end + 1)
+        {
+          *end = '\0';
+          brf_helper_log(data, start);
+        }
+
+        if (start == line && linelen == sizeof(line) - 1)
+        {
+          // Overlong line, log it in pieces...
+          brf_helper_log(data, line);
+          linelen = 0;
+        }
+        else
+        {
+          linelen -= (size_t)(start - line);
+          memmove(line, start, linelen);
+        }
+      }
+      else if (bytes == 0 || errno != EINTR)
+      {
+        if (linelen > 0)
+        {
+          line[linelen] = '\0';
+          brf_helper_log(data, line);
+        }
+
+        close(errfds[0]);
+        pfds[0].fd = -1;
+      }
+    }
+
+    if (pfds[1].revents)
+    {
+      if ((bytes = recv(replyfds[0], &reply, sizeof(reply), 0)) == sizeof(reply))
+      {
+        if (reply.pid == 0)
+        {
+          if (log)
+            log(ld, CF_LOGLEVEL_ERROR, "%s: Unable to start filter: %s", params->filter, strerror(reply.status));
+        }
+        else if (pid == 0)
+        {
+          pid = reply.pid;
+          continue;
+        }
+        else
+          status = reply.status;
+      }
+      else if (bytes < 0 && errno == EINTR)
+        continue;
+      else if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "%s: Filter helper exited unexpectedly.", params->filter);
+
+      close(replyfds[0]);
+      pfds[1].fd = -1;
+    }
+  }
+
+  if (status < 0)
+    return (1);
+
+  if (WIFEXITED(status))
+  {
+    if (WEXITSTATUS(status) && log)
+      log(ld, CF_LOGLEVEL_ERROR, "%s (PID %d) stopped with status %d.", params->filter, (int)pid, WEXITSTATUS(status));
+
+    return (WEXITSTATUS(status));
+  }
+
+  if (log && !canceled)
+    log(ld, CF_LOGLEVEL_ERROR, "%s (PID %d) crashed on signal %d.", params->filter, (int)pid, WTERMSIG(status));
+
+  return (canceled ? 0 : 1);
+}
+
+
+//
+// 'brf_helper_main()' - Run the helper supervisor if this is one.
+//
+// Called first thing in main(), returns -1 for a normal start or otherwise
+// the exit status of the supervisor.
+//
+
+int					// O - Exit status or -1
+brf_helper_main(void)
+{
+  const char	*val;			// Environment variable
+  int		queue,			// Request socket
+		death,			// App's end of pipe
+		num_helpers,		// Number of helpers
+		max_jobs,		// Jobs per helper
+		i,			// Looping var
+		status;			// Exit status of helper
+  pid_t		pids[BRF_HELPER_MAX_HELPERS],
+					// Helper process IDs
+		pid;			// Exited process
+  struct pollfd	pfd;			// Poll data
+
+
+  if ((val = getenv(BRF_HELPER_ENV)) == NULL)
+    return (-1);
+
+  if (sscanf(val, "%d,%d,%d,%d", &queue, &death, &num_helpers, &max_jobs) != 4 || num_helpers < 1 || num_helpers > BRF_HELPER_MAX_HELPERS)
+    return (1);
+
+  // Filters must not see the supervisor's descriptors or variable...
+  unsetenv(BRF_HELPER_ENV);
+  fcntl(queue, F_SETFD, FD_CLOEXEC);
+  fcntl(death, F_SETFD, FD_CLOEXEC);
+  signal(SIGPIPE, SIG_IGN);
+
+  for (i = 0; i < num_helpers; i ++)
+    pids[i] = brf_helper_spawn_one(queue, max_jobs);
+
+  // Replace helpers as they finish until the server goes away...
+  pfd.fd     = death;
+  pfd.events = POLLIN;
+
+  for (;;)
+  {
+    if (poll(&pfd, 1, 1000) > 0 && pfd.revents)
+      break;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+      for (i = 0; i < num_helpers; i ++)
+      {
+        if (pids[i] == pid)
+        {
+          pids[i] = brf_helper_spawn_one(queue, max_jobs);
+          break;
+        }
+      }
+    }
+
+    for (i = 0; i < num_helpers; i ++)
+    {
+      if (pids[i] < 0)
+        pids[i] = brf_helper_spawn_one(queue, max_jobs);
+    }
+  }
+
+  for (i = 0; i < num_helpers; i ++)
+  {
+    if (pids[i] > 0)
+      kill(pids[i], SIGTERM);
+  }
+
+  while (wait(NULL) > 0);
+
+  return (0);
+}
+
+
+//
+// 'brf_helper_start()' - Start the filter helper pool.
+//
+// Must be called before any threads are started.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_helper_start(
+    pappl_system_t *system,		// I - System
+    int            num_helpers,		// I - Number of helpers
+    int            max_jobs)		// I - Jobs per helper before it is replaced
+{
+  int		queue[2],		// Request socket
+		death[2],		// Supervisor lifetime pipe
+		error;			// Spawn error
+  char		value[256],		// Environment variable
+		**envp;			// Supervisor environment
+  size_t	i,			// Looping var
+		count;			// Number of variables
+  pid_t		pid;			// Supervisor process ID
+  char		*argv[] = { "brf-printer-app", NULL };
+					// Supervisor command-line
+
+
+  if (num_helpers > BRF_HELPER_MAX_HELPERS)
+    num_helpers = BRF_HELPER_MAX_HELPERS;
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, queue))
+    return (false);
+
+  if (pipe(death))
+  {
+    close(queue[0]);
+    close(queue[1]);
+    return (false);
+  }
+
+  // Our ends stay out of filters and other children...
+  fcntl(queue[0], F_SETFD, FD_CLOEXEC);
+  fcntl(death[1], F_SETFD, FD_CLOEXEC);
+
+  for (count = 0; environ[count]; count ++);
+
+  if ((envp = calloc(count + 2, sizeof(char *))) == NULL)
+  {
+    close(queue[0]);
+    close(queue[1]);
+    close(death[0]);
+    close(death[1]);
+    return (false);
+  }
+
+  snprintf(value, sizeof(value), BRF_HELPER_ENV "=%d,%d,%d,%d", queue[1], death[0], num_helpers, max_jobs);
+  envp[0] = value;
+  for (i = 0; i < count; i ++)
+    envp[i + 1] = environ[i];
+
+  error = posix_spawn(&pid, "/proc/self/exe", NULL, NULL, argv, envp);
+
+  free(envp);
+  close(queue[1]);
+  close(death[0]);
+
+  if (error)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to start filter helpers: %s", strerror(error));
+    close(queue[0]);
+    close(death[1]);
+    return (false);
+  }
+
+  brf_helper_queue = queue[0];
+  brf_helper_death = death[1];
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Started %d filter helpers (PID %d), replaced after %d jobs.", num_helpers, (int)pid, max_jobs);
+
+  return (true);
+}
+
+
+//
+// 'brf_helper_add()' - Add a string to a request.
+//
+
+static bool				// O - `true` on success, `false` if full
+brf_helper_add(char       *buffer,	// I - Request message
+               size_t     *used,	// IO - Bytes used
+               const char *s)		// I - String
+{
+  size_t	len = strlen(s) + 1;	// Length with nul
+
+
+  if (*used + len > BRF_HELPER_MAX_MESSAGE)
+    return (false);
+
+  memcpy(buffer + *used, s, len);
+  *used += len;
+
+  return (true);
+}
+
+
+//
+// 'brf_helper_log()' - Log a line from a filter's stderr.
+//
+
+static void
+brf_helper_log(cf_filter_data_t *data,	// I - Job and printer data
+               char             *line)	// I - Line
+{
+  cf_loglevel_t	level = CF_LOGLEVEL_ERROR;
+					// Log level
+  size_t	len = strlen(line);	// Length of line
+
+
+  if (!data->logfunc || !*line)
+    return;
+
+  if (len > 0 && line[len - 1] == '\r')
+    line[len - 1] = '\0';
+
+  if (!strncmp(line, "DEBUG: ", 7) || !strncmp(line, "DEBUG2: ", 8))
+  {
+    level = CF_LOGLEVEL_DEBUG;
+    line  = strchr(line, ' ') + 1;
+  }
+  else if (!strncmp(line, "INFO: ", 6))
+  {
+    level = CF_LOGLEVEL_INFO;
+    line  += 6;
+  }
+  else if (!strncmp(line, "WARNING: ", 9))
+  {
+    level = CF_LOGLEVEL_WARN;
+    line  += 9;
+  }
+  else if (!strncmp(line, "ERROR: ", 7))
+    line += 7;
+  else if (!strncmp(line, "ATTR: ", 6) || !strncmp(line, "PAGE: ", 6) || !strncmp(line, "STATE: ", 7))
+    level = CF_LOGLEVEL_DEBUG;
+
+  (data->logfunc)(data->logdata, level, "%s", line);
+}
+
+
+//
+// 'brf_helper_run()' - Serve jobs in a helper process, then exit.
+//
+
+static void
+brf_helper_run(int queue,		// I - Request socket
+               int max_jobs)		// I - Jobs to serve
+{
+  int	jobs;				// Jobs served
+
+
+  signal(SIGTERM, SIG_DFL);
+
+  for (jobs = 0; max_jobs <= 0 || jobs < max_jobs; jobs ++)
+    brf_helper_serve(queue);
+
+  _exit(0);
+}
+
+
+//
+// 'brf_helper_serve()' - Receive one job and run its filter.
+//
+
+static void
+brf_helper_serve(int queue)		// I - Request socket
+{
+  char			*buffer,	// Request message
+			*ptr,		// Pointer into message
+			*end,		// End of message
+			*filter,	// Filter path
+			**argv,		// Filter arguments
+			**envp;		// Filter environment
+  brf_helper_request_t	request;	// Request header
+  brf_helper_reply_t	reply;		// Reply to the server
+  int			fds[4] = { -1, -1, -1, -1 },
+					// Passed descriptors
+			i,		// Looping var
+			count;		// Number of environment variables
+  size_t		nfds;		// Number of passed descriptors
+  ssize_t		bytes;		// Bytes received
+  struct iovec		iov;		// Message data
+  struct msghdr		msg;		// Message
+  struct cmsghdr	*cmsg;		// Control header
+  union
+  {
+    struct cmsghdr	hdr;		// Control header
+    char		buf[CMSG_SPACE(sizeof(fds))];
+					// Control data
+  }			control;	// File descriptors
+  posix_spawn_file_actions_t actions;	// Child file descriptors
+
+
+  if ((buffer = malloc(BRF_HELPER_MAX_MESSAGE + 1)) == NULL)
+    _exit(1);
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base       = buffer;
+  iov.iov_len        = BRF_HELPER_MAX_MESSAGE;
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  while ((bytes = recvmsg(queue, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+
+  if (bytes <= 0)
+    _exit(bytes < 0);			// Server went away
+
+  if ((cmsg = CMSG_FIRSTHDR(&msg)) != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+  {
+    nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), (nfds > 4 ? 4 : nfds) * sizeof(int));
+  }
+  else
+    nfds = 0;
+
+  if (nfds != 4 || (size_t)bytes < sizeof(request))
+  {
+    // Malformed request, nothing to reply to...
+    for (i = 0; i < 4; i ++)
+    {
+      if (fds[i] >= 0)
+        close(fds[i]);
+    }
+
+    free(buffer);
+    return;
+  }
+
+  // Unpack the filter path, arguments and environment...
+  memcpy(&request, buffer, sizeof(request));
+  buffer[bytes] = '\0';
+  end           = buffer + bytes;
+
+  for (count = 0; environ[count]; count ++);
+
+  argv = calloc((size_t)request.argc + 1, sizeof(char *));
+  envp = calloc((size_t)(request.envc + count) + 1, sizeof(char *));
+
+  ptr    = buffer + sizeof(request);
+  filter = ptr;
+  ptr    += strlen(ptr) + 1;
+
+  memset(&reply, 0, sizeof(reply));
+
+  if (!argv || !envp || request.argc < 1 || request.envc < 0)
+  {
+    reply.status = ENOMEM;
+  }
+  else
+  {
+    for (i = 0; i < request.argc && ptr < end; i ++, ptr += strlen(ptr) + 1)
+      argv[i] = ptr;
+    for (i = 0; i < request.envc && ptr < end; i ++, ptr += strlen(ptr) + 1)
+      envp[i] = ptr;
+    memcpy(envp + i, environ, (size_t)count * sizeof(char *));
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], 0);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
+    posix_spawn_file_actions_adddup2(&actions, fds[2], 2);
+
+    if ((reply.status = posix_spawn(&reply.pid, filter, &actions, NULL, argv, envp)) != 0)
+      reply.pid = 0;
+
+    posix_spawn_file_actions_destroy(&actions);
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+  close(fds[2]);
+
+  send(fds[3], &reply, sizeof(reply), MSG_NOSIGNAL);
+
+  if (reply.pid > 0)
+  {
+    while (waitpid(reply.pid, &reply.status, 0) < 0 && errno == EINTR);
+    send(fds[3], &reply, sizeof(reply), MSG_NOSIGNAL);
+  }
+
+  close(fds[3]);
+  free(argv);
+  free(envp);
+  free(buffer);
+}
+
+
+//
+// 'brf_helper_spawn_one()' - Fork a helper process from the supervisor.
+//
+
+static pid_t				// O - Process ID or -1 on error
+brf_helper_spawn_one(int queue,		// I - Request socket
+                     int max_jobs)	// I - Jobs to serve
+{
+  pid_t	pid;				// Process ID
+
+
+  if ((pid = fork()) == 0)
+    brf_helper_run(queue, max_jobs);
+
+  return (pid);
+}
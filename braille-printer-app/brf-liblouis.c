@@ -0,0 +1,1249 @@
+//
+// In-process liblouis translation for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// When the "liblouis-tables" option is set, the tables are compiled once
+// when a printer is created and the texttobrf stage of the pre-filter chain
+// translates in the Printer Application process instead of starting
+// texttobrf, file2brl and a fresh table compile for each job.  Paragraphs
+// are translated with lou_translateString(), then wrapped to the cells per
+// line and lines per page of the job's media.  Without tables the stage
+// runs the texttobrf CUPS filter as before.
+//
+// liblouis keeps global state, so threads of the server would only take
+// turns on the lock.  When a job asks for more than one
+// "braille-translation-threads" and the document is longer than a chunk of
+// paragraphs, the chunks are translated by that many worker processes
+// instead, fresh execs of this program that compile the tables once and
+// read chunks from a pipe.  Each worker has one chunk at a time, and the
+// cells that come back are laid out in document order by the same code as
+// a serial translation, so lines and page breaks do not change.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <liblouis/liblouis.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+
+//
+// Constants...
+//
+
+#define BRF_LOUIS_MAX_PARA	16384	// Characters translated at once
+#define BRF_LOUIS_CHUNK		65536	// Characters sent to a worker at once
+#define BRF_LOUIS_CHUNK_PARAS	4096	// Paragraphs sent to a worker at once
+#define BRF_LOUIS_WORKER_ENV	"BRF_LOUIS_WORKER"
+					// Environment variable for workers
+
+#define BRF_LOUIS_TEXT		0x01	// Paragraph has text
+#define BRF_LOUIS_INDENT	0x02	// Indent the paragraph
+#define BRF_LOUIS_NEWPAGE	0x04	// Start a new page after the paragraph
+
+
+//
+// Local types...
+//
+
+typedef struct brf_louis_chunk_s	// Paragraphs translated together
+{
+  int		num_paras,		// Number of paragraphs
+		used;			// Characters used
+  int		lens[BRF_LOUIS_CHUNK_PARAS];
+					// Characters, then cells of paragraphs
+  unsigned char	flags[BRF_LOUIS_CHUNK_PARAS];
+					// BRF_LOUIS_TEXT, _INDENT and _NEWPAGE
+  widechar	text[BRF_LOUIS_CHUNK];	// Text of paragraphs
+} brf_louis_chunk_t;
+
+typedef struct brf_louis_worker_s	// Translation process
+{
+  pid_t		pid;			// Process ID
+  int		tofd,			// Pipe for chunks
+		fromfd;			// Pipe for translations
+  bool		busy;			// Translating a chunk?
+  brf_louis_chunk_t *chunk;		// Chunk sent to the worker
+} brf_louis_worker_t;
+
+typedef struct brf_louis_out_s		// Output state
+{
+  const brf_louis_t *louis;		// Tables and page layout
+  int		outputfd;		// Output file descriptor
+  int		col,			// Cells on the current line
+		line,			// Lines on the current page
+		pages;			// Pages written
+  bool		error;			// Write error?
+  size_t	used,			// Bytes in buffer
+		written;		// Bytes written
+  char		buffer[65536];		// Output buffer
+  brf_louis_chunk_t *chunk;		// Chunk being filled, `NULL` if serial
+  int		num_workers,		// Number of workers
+		next_worker;		// Worker to send the next chunk to
+  bool		started;		// Tried to start the workers?
+  brf_louis_worker_t workers[BRF_LOUIS_MAX_WORKERS];
+					// Workers
+  widechar	*cells;			// Cells of a translated chunk
+  size_t	num_cells;		// Size of cells buffer
+} brf_louis_out_t;
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t	brf_louis_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// liblouis is not thread-safe
+static char		brf_louis_tables[1024] = "";
+					// Configured tables
+extern char		**environ;	// Environment
+
+
+//
+// Local functions...
+//
+
+static bool	brf_louis_finish(brf_louis_out_t *out, cf_logfunc_t log, void *ld);
+static void	brf_louis_flush(brf_louis_out_t *out);
+static void	brf_louis_layout(brf_louis_out_t *out, const widechar *braille, int outlen, bool indent);
+static void	brf_louis_newline(brf_louis_out_t *out);
+static void	brf_louis_newpage(brf_louis_out_t *out);
+static bool	brf_louis_paragraph(brf_louis_out_t *out, const widechar *para, int len, bool indent, bool newpage, cf_logfunc_t log, void *ld);
+static pid_t	brf_louis_pdftotext(int inputfd, int *textfd, cf_logfunc_t log, void *ld);
+static void	brf_louis_put(brf_louis_out_t *out, const char *s, size_t len);
+static bool	brf_louis_read(int fd, void *buffer, size_t bytes);
+static bool	brf_louis_receive(brf_louis_out_t *out, brf_louis_worker_t *worker, cf_logfunc_t log, void *ld);
+static bool	brf_louis_send(brf_louis_out_t *out, bool last, cf_logfunc_t log, void *ld);
+static void	brf_louis_start(brf_louis_out_t *out, cf_logfunc_t log, void *ld);
+static void	brf_louis_stop(brf_louis_out_t *out, bool force);
+static widechar	*brf_louis_string(const char *tables, const widechar *para, int len, int *outlen);
+static bool	brf_louis_translate(brf_louis_out_t *out, const widechar *para, int len, bool indent, cf_logfunc_t log, void *ld);
+static bool	brf_louis_write(int fd, const void *buffer, size_t bytes);
+
+
+//
+// 'brf_louis_create()' - Compile the configured tables for a printer.
+//
+// The tables and page layout are kept in the driver extension; without
+// configured tables, or if they do not compile, the printer keeps using the
+// texttobrf filter.
+//
+
+brf_louis_t *				// O - Tables and page layout or `NULL`
+brf_louis_create(
+    pappl_system_t               *system,	// I - System
+    const pappl_pr_driver_data_t *driver_data)	// I - Driver data
+{
+  brf_louis_t	*louis;			// Tables and page layout
+  const void	*table;			// Compiled table
+
+
+  if (!brf_louis_tables[0])
+    return (NULL);
+
+  if ((louis = (brf_louis_t *)calloc(1, sizeof(brf_louis_t))) == NULL)
+    return (NULL);
+
+  if (snprintf(louis->tables, sizeof(louis->tables), "en-us-brf.dis,%s,braille-patterns.cti", brf_louis_tables) >= (int)sizeof(louis->tables))
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "liblouis table list '%s' is too long.", brf_louis_tables);
+    free(louis);
+    return (NULL);
+  }
+
+  louis->workers = 1;
+
+  pthread_mutex_lock(&brf_louis_mutex);
+  table = lou_getTable(louis->tables);
+  pthread_mutex_unlock(&brf_louis_mutex);
+
+  if (!table || !brf_louis_media(louis, &driver_data->media_default))
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to compile liblouis tables '%s', using the texttobrf filter.", louis->tables);
+    free(louis);
+    return (NULL);
+  }
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Compiled liblouis tables '%s' for %dx%d cell pages.", louis->tables, louis->width, louis->height);
+
+  return (louis);
+}
+
+
+//
+// 'brf_louis_filter_function()' - Translate text or PDF to BRF.
+//
+// The "parameters" are the cf_filter_external_t parameters of the texttobrf
+// filter, which is run instead, in a filter helper if there are any, when the
+// job has no BRF_LOUIS_EXT extension or is in another format.
+//
+
+int					// O - Error status
+brf_louis_filter_function(
+    int              inputfd,		// I - File descriptor input stream
+    int              outputfd,		// I - File descriptor output stream
+    int              inputseekable,	// I - Is input stream seekable?
+    cf_filter_data_t *data,		// I - Job and printer data
+    void             *parameters)	// I - texttobrf filter parameters
+{
+  const brf_louis_t *louis;		// Tables and page layout
+  brf_louis_out_t *out;			// Output state
+  cf_logfunc_t	log = data->logfunc;	// Log function
+  void		*ld = data->logdata;	// Log function data
+  int		textfd = inputfd,	// Text input
+		status = 0,		// pdftotext exit status
+		len = 0,		// Characters in paragraph
+		need = 0,		// UTF-8 continuation bytes still needed
+		ret = 0;		// Return value
+  pid_t		pid = 0;		// pdftotext process
+  bool		newline = true,		// At the start of an input line?
+		indent = true;		// Indent the paragraph?
+  unsigned	cp = 0;			// Code point being decoded
+  ssize_t	bytes,			// Bytes read
+		i;			// Looping var
+  size_t	total = 0;		// Total bytes read
+  double	start,			// Start of read
+		waited = 0.0;		// Time spent waiting for input
+  unsigned char	inbuf[65536],		// Input buffer
+		c;			// Current byte
+  widechar	*para;			// Paragraph
+
+
+  if ((louis = (const brf_louis_t *)cfFilterDataGetExt(data, BRF_LOUIS_EXT)) == NULL || !data->content_type || (strcmp(data->content_type, "text/plain") && strcmp(data->content_type, "application/pdf") && strcmp(data->content_type, "application/vnd.cups-pdf-banner")))
+    return (brf_helper_filter_function(inputfd, outputfd, inputseekable, data, parameters));
+
+  if (strcmp(data->content_type, "text/plain") && (pid = brf_louis_pdftotext(inputfd, &textfd, log, ld)) < 0)
+  {
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
+
+  out  = (brf_louis_out_t *)calloc(1, sizeof(brf_louis_out_t));
+  para = (widechar *)malloc(BRF_LOUIS_MAX_PARA * sizeof(widechar));
+
+  if (!out || !para)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "texttobrf: Unable to allocate memory.");
+    ret = 1;
+    goto done;
+  }
+
+  out->louis    = louis;
+  out->outputfd = outputfd;
+
+  if (louis->workers > 1 && (out->chunk = (brf_louis_chunk_t *)malloc(sizeof(brf_louis_chunk_t))) != NULL)
+    out->chunk->num_paras = out->chunk->used = 0;
+
+  for (start = brf_stats_now(); !out->error && (bytes = read(textfd, inbuf, sizeof(inbuf))) != 0; start = brf_stats_now())
+  {
+    waited += brf_stats_now() - start;
+
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "texttobrf: Unable to read input: %s", strerror(errno));
+      ret = 1;
+      break;
+    }
+
+    total += (size_t)bytes;
+
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    {
+      ret = 1;
+      break;
+    }
+
+    for (i = 0; i < bytes; i ++)
+    {
+      c = inbuf[i];
+
+      if (need > 0 && (c & 0xc0) == 0x80)
+      {
+        cp = (cp << 6) | (c & 0x3f);
+        if (-- need > 0)
+          continue;
+
+        c = 0x80;			// Decoded, non-ASCII
+      }
+      else if (c >= 0x80)
+      {
+        // Start of an UTF-8 sequence, anything invalid becomes '?'...
+        need = 0;
+
+        if (c >= 0xc2 && c <= 0xdf)
+        {
+          cp   = c & 0x1f;
+          need = 1;
+        }
+        else if (c >= 0xe0 && c <= 0xef)
+        {
+          cp   = c & 0x0f;
+          need = 2;
+        }
+        else if (c >= 0xf0 && c <= 0xf4)
+        {
+          cp   = c & 0x07;
+          need = 3;
+        }
+        else
+        {
+          cp = '?';
+          c  = 0x80;
+        }
+
+        if (need > 0)
+          continue;
+      }
+      else
+      {
+        need = 0;
+        cp   = c;
+      }
+
+      if (c == '\n' || c == '\f')
+      {
+        // A blank line ends the paragraph, a form feed also the page...
+        if (c == '\f' || newline)
+        {
+          if ((len > 0 || c == '\f') && !brf_louis_paragraph(out, para, len, indent, c == '\f', log, ld))
+            ret = 1;
+
+          len    = 0;
+          indent = true;
+        }
+        else if (len > 0 && para[len - 1] != ' ')
+          para[len ++] = ' ';
+
+        newline = true;
+      }
+      else if (c == '\r' || (c < ' ' && c != '\t'))
+        continue;
+      else
+      {
+        if (cp == '\t' || cp == 0xa0)
+          cp = ' ';
+        else if (cp > 0xffff && sizeof(widechar) < 4)
+          cp = '?';
+
+        if (cp == ' ' && (len == 0 || para[len - 1] == ' '))
+          continue;
+
+        para[len ++] = (widechar)cp;
+        newline      = false;
+      }
+
+      if (len >= BRF_LOUIS_MAX_PARA - 1)
+      {
+        // Very long paragraph, translate what we have...
+        if (!brf_louis_paragraph(out, para, len, indent, false, log, ld))
+          ret = 1;
+
+        len    = 0;
+        indent = false;
+      }
+    }
+  }
+
+  if (len > 0 && !ret && !brf_louis_paragraph(out, para, len, indent, false, log, ld))
+    ret = 1;
+
+  if (!ret && !brf_louis_finish(out, log, ld))
+    ret = 1;
+
+  brf_louis_newpage(out);
+  brf_louis_flush(out);
+
+  if (out->error)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "texttobrf: Unable to write output: %s", strerror(errno));
+    ret = 1;
+  }
+  else if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "texttobrf: Translated %d page(s) of %dx%d cells with '%s'.", out->pages, louis->width, louis->height, louis->tables);
+
+  brf_stats_bytes(total, out->written);
+
+  done:
+
+  if (out)
+  {
+    brf_louis_stop(out, ret != 0);
+    free(out->chunk);
+    free(out->cells);
+  }
+
+  free(para);
+  free(out);
+
+  if (pid > 0)
+  {
+    close(textfd);
+
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+    if (status)
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "texttobrf: pdftotext failed with status %d.", status);
+      ret = 1;
+    }
+
+    // pdftotext runs alongside, count the time spent waiting for its text...
+    brf_stats_stage("pdftotext", waited, 0, total);
+  }
+
+  close(inputfd);
+  close(outputfd);
+
+  return (ret);
+}
+
+
+//
+// 'brf_louis_main()' - Run a translation process if this is one.
+//
+// Called first thing in main(), returns -1 for a normal start or otherwise
+// the exit status of the worker.  Chunks are read from stdin as the number
+// of paragraphs, their lengths and their text; the cells per paragraph, -1
+// if it could not be translated, and all cells are written to stdout.
+//
+
+int					// O - Exit status or -1
+brf_louis_main(void)
+{
+  const char	*val;			// Environment variable
+  char		tables[1024];		// Table list
+  brf_louis_chunk_t *chunk;		// Chunk
+  widechar	*cells = NULL,		// Cells of the chunk
+		*braille,		// Cells of current paragraph
+		*temp;			// New cells buffer
+  size_t	num_cells = 0,		// Size of cells buffer
+		total;			// Cells used
+  const widechar *text;			// Text of current paragraph
+  int		i,			// Looping var
+		used,			// Characters in chunk
+		outlen;			// Cells in paragraph
+
+
+  if ((val = getenv(BRF_LOUIS_WORKER_ENV)) == NULL)
+    return (-1);
+
+  papplCopyString(tables, val, sizeof(tables));
+  unsetenv(BRF_LOUIS_WORKER_ENV);
+
+  if (!lou_getTable(tables) || (chunk = (brf_louis_chunk_t *)malloc(sizeof(brf_louis_chunk_t))) == NULL)
+    return (1);
+
+  while (brf_louis_read(0, &chunk->num_paras, sizeof(int)))
+  {
+    if (chunk->num_paras < 0 || chunk->num_paras > BRF_LOUIS_CHUNK_PARAS || !brf_louis_read(0, chunk->lens, (size_t)chunk->num_paras * sizeof(int)))
+      return (1);
+
+    for (i = 0, used = 0; i < chunk->num_paras; i ++)
+    {
+      if (chunk->lens[i] < 0 || chunk->lens[i] > BRF_LOUIS_MAX_PARA || (used += chunk->lens[i]) > BRF_LOUIS_CHUNK)
+        return (1);
+    }
+
+    if (!brf_louis_read(0, chunk->text, (size_t)used * sizeof(widechar)))
+      return (1);
+
+    // Translate each paragraph, reusing the lengths for the cell counts...
+    for (i = 0, text = chunk->text, total = 0; i < chunk->num_paras; text += used, i ++)
+    {
+      if ((used = chunk->lens[i]) == 0)
+        continue;
+
+      if ((braille = brf_louis_string(tables, text, used, &outlen)) == NULL)
+      {
+        chunk->lens[i] = -1;
+        continue;
+      }
+
+      if (total + (size_t)outlen > num_cells)
+      {
+        if ((temp = (widechar *)realloc(cells, (total + (size_t)outlen + BRF_LOUIS_CHUNK) * sizeof(widechar))) == NULL)
+          return (1);
+
+        cells     = temp;
+        num_cells = total + (size_t)outlen + BRF_LOUIS_CHUNK;
+      }
+
+      memcpy(cells + total, braille, (size_t)outlen * sizeof(widechar));
+      total += (size_t)outlen;
+
+      chunk->lens[i] = outlen;
+
+      free(braille);
+    }
+
+    if (!brf_louis_write(1, chunk->lens, (size_t)chunk->num_paras * sizeof(int)) || !brf_louis_write(1, cells, total * sizeof(widechar)))
+      return (1);
+  }
+
+  return (0);
+}
+
+
+//
+// 'brf_louis_media()' - Set the page layout for the printable area of media.
+//
+// The layout is not changed when the media has no room for a cell.
+//
+
+bool					// O - `true` on success, `false` if too small
+brf_louis_media(
+    brf_louis_t             *louis,	// I - Tables and page layout
+    const pappl_media_col_t *media)	// I - Media
+{
+  int		width,			// Printable width
+		height;			// Printable height
+
+
+  width  = (media->size_width - media->left_margin - media->right_margin + BRF_CELL_SPACING) / BRF_CELL_WIDTH;
+  height = (media->size_length - media->top_margin - media->bottom_margin + BRF_LINE_SPACING) / BRF_CELL_HEIGHT;
+
+  if (width < 1 || height < 1)
+    return (false);
+
+  louis->width  = width;
+  louis->height = height;
+
+  return (true);
+}
+
+
+//
+// 'brf_louis_set_tables()' - Set the liblouis tables to compile for new
+//                            printers.
+//
+
+void
+brf_louis_set_tables(const char *tables)// I - Comma-delimited table list or `NULL`
+{
+  papplCopyString(brf_louis_tables, tables ? tables : "", sizeof(brf_louis_tables));
+}
+
+
+//
+// 'brf_louis_finish()' - Translate the rest of the document in parallel mode.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_louis_finish(brf_louis_out_t *out,	// I - Output state
+                 cf_logfunc_t    log,	// I - Log function
+                 void            *ld)	// I - Log function data
+{
+  brf_louis_worker_t *worker;		// Current worker
+  int		i;			// Looping var
+  bool		ret = true;		// Return value
+
+
+  if (!out->chunk)
+    return (true);
+
+  if (!brf_louis_send(out, true, log, ld))
+    ret = false;
+
+  // Receive the chunks still out, oldest first...
+  for (i = 0; i < out->num_workers; i ++)
+  {
+    worker = out->workers + (out->next_worker + i) % out->num_workers;
+
+    if (worker->busy && !brf_louis_receive(out, worker, log, ld))
+      ret = false;
+  }
+
+  return (ret);
+}
+
+
+//
+// 'brf_louis_flush()' - Write the output buffer.
+//
+
+static void
+brf_louis_flush(brf_louis_out_t *out)	// I - Output state
+{
+  size_t	done;			// Bytes written
+  ssize_t	bytes;			// Bytes in this write
+
+
+  for (done = 0; !out->error && done < out->used; done += (size_t)bytes)
+  {
+    if ((bytes = write(out->outputfd, out->buffer + done, out->used - done)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        bytes = 0;
+      else
+        out->error = true;
+    }
+  }
+
+  out->written += done;
+
+  out->used = 0;
+}
+
+
+//
+// 'brf_louis_layout()' - Lay out a translated paragraph.
+//
+// Words are wrapped at the line width, words longer than a line are split.
+// Paragraphs start with two blank cells.
+//
+
+static void
+brf_louis_layout(
+    brf_louis_out_t *out,		// I - Output state
+    const widechar  *braille,		// I - Cells of paragraph
+    int             outlen,		// I - Number of cells
+    bool            indent)		// I - Indent the first line?
+{
+  const widechar *word,			// Start of current word
+		*end;			// End of translation
+  int		wlen,			// Cells in word
+		i;			// Looping var
+  char		utf8[4];		// Encoded cell
+  size_t	ulen;			// Length of encoded cell
+
+
+  if (indent)
+  {
+    if (out->col > 0)
+      brf_louis_newline(out);
+
+    if (out->louis->width > 2)
+    {
+      brf_louis_put(out, "  ", 2);
+      out->col = 2;
+    }
+  }
+
+  for (word = braille, end = braille + outlen; word < end;)
+  {
+    if (*word == ' ')
+    {
+      word ++;
+      continue;
+    }
+
+    for (wlen = 0; word + wlen < end && word[wlen] != ' '; wlen ++);
+
+    if (out->col > 0 && out->col + 1 + wlen > out->louis->width)
+      brf_louis_newline(out);
+    else if (out->col > 0 && !(indent && out->col == 2 && word == braille))
+    {
+      brf_louis_put(out, " ", 1);
+      out->col ++;
+    }
+
+    for (i = 0; i < wlen; i ++)
+    {
+      if (out->col >= out->louis->width)
+        brf_louis_newline(out);
+
+      if (word[i] < 0x80)
+      {
+        utf8[0] = (char)word[i];
+        ulen    = 1;
+      }
+      else if (word[i] < 0x800)
+      {
+        utf8[0] = (char)(0xc0 | (word[i] >> 6));
+        utf8[1] = (char)(0x80 | (word[i] & 0x3f));
+        ulen    = 2;
+      }
+      else
+      {
+        utf8[0] = (char)(0xe0 | ((word[i] >> 12) & 0x0f));
+        utf8[1] = (char)(0x80 | ((word[i] >> 6) & 0x3f));
+        utf8[2] = (char)(0x80 | (word[i] & 0x3f));
+        ulen    = 3;
+      }
+
+      brf_louis_put(out, utf8, ulen);
+      out->col ++;
+    }
+
+    word += wlen;
+  }
+}
+
+
+//
+// 'brf_louis_newline()' - End the current line.
+//
+
+static void
+brf_louis_newline(brf_louis_out_t *out)	// I - Output state
+{
+  brf_louis_put(out, "\r\n", 2);
+
+  out->col = 0;
+
+  if (++ out->line >= out->louis->height)
+    brf_louis_newpage(out);
+}
+
+
+//
+// 'brf_louis_newpage()' - End the current page, if anything is on it.
+//
+
+static void
+brf_louis_newpage(brf_louis_out_t *out)	// I - Output state
+{
+  if (out->col > 0)
+    brf_louis_put(out, "\r\n", 2);
+
+  if (out->col > 0 || out->line > 0)
+  {
+    brf_louis_put(out, "\f", 1);
+    out->pages ++;
+  }
+
+  out->col  = 0;
+  out->line = 0;
+}
+
+
+//
+// 'brf_louis_paragraph()' - Translate a paragraph, or add it to the chunk.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_louis_paragraph(
+    brf_louis_out_t *out,		// I - Output state
+    const widechar  *para,		// I - Paragraph
+    int             len,		// I - Number of characters
+    bool            indent,		// I - Indent the first line?
+    bool            newpage,		// I - Start a new page after it?
+    cf_logfunc_t    log,		// I - Log function
+    void            *ld)		// I - Log function data
+{
+  brf_louis_chunk_t *chunk = out->chunk;
+					// Chunk being filled
+  bool		ret = true;		// Return value
+
+
+  if (!chunk)
+  {
+    if (len > 0 && !brf_louis_translate(out, para, len, indent, log, ld))
+      ret = false;
+
+    if (newpage)
+      brf_louis_newpage(out);
+
+    return (ret);
+  }
+
+  chunk->lens[chunk->num_paras]  = len;
+  chunk->flags[chunk->num_paras] = (len > 0 ? BRF_LOUIS_TEXT : 0) | (indent ? BRF_LOUIS_INDENT : 0) | (newpage ? BRF_LOUIS_NEWPAGE : 0);
+  chunk->num_paras ++;
+
+  memcpy(chunk->text + chunk->used, para, (size_t)len * sizeof(widechar));
+  chunk->used += len;
+
+  // Send it when the next paragraph might not fit...
+  if (chunk->num_paras >= BRF_LOUIS_CHUNK_PARAS || chunk->used > BRF_LOUIS_CHUNK - BRF_LOUIS_MAX_PARA)
+    ret = brf_louis_send(out, false, log, ld);
+
+  return (ret);
+}
+
+
+//
+// 'brf_louis_pdftotext()' - Start pdftotext to extract the text of a PDF.
+//
+
+static pid_t				// O - Process ID or -1 on error
+brf_louis_pdftotext(int          inputfd,	// I - PDF input
+                    int          *textfd,	// O - Text output
+                    cf_logfunc_t log,		// I - Log function
+                    void         *ld)		// I - Log function data
+{
+  int		fds[2];			// Pipe
+  pid_t		pid;			// Process ID
+  int		error;			// posix_spawnp() error
+  posix_spawn_file_actions_t actions;	// Child file descriptors
+  static char	*argv[] = { "pdftotext", "-raw", "-", "-", NULL };
+					// Command-line
+  extern char	**environ;		// Environment
+
+
+  if (pipe(fds))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "texttobrf: Unable to create pipe: %s", strerror(errno));
+    return (-1);
+  }
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, inputfd, 0);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
+  posix_spawn_file_actions_addclose(&actions, fds[0]);
+  posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+  error = posix_spawnp(&pid, "pdftotext", &actions, NULL, argv, environ);
+
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+
+  if (error)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "texttobrf: Unable to run pdftotext: %s", strerror(error));
+    close(fds[0]);
+    return (-1);
+  }
+
+  *textfd = fds[0];
+
+  return (pid);
+}
+
+
+//
+// 'brf_louis_put()' - Add bytes to the output buffer.
+//
+
+static void
+brf_louis_put(brf_louis_out_t *out,	// I - Output state
+              const char      *s,	// I - Bytes
+              size_t          len)	// I - Number of bytes
+{
+  if (out->used + len > sizeof(out->buffer))
+    brf_louis_flush(out);
+
+  memcpy(out->buffer + out->used, s, len);
+  out->used += len;
+}
+
+
+//
+// 'brf_louis_read()' - Read a whole buffer from a pipe.
+//
+
+static bool				// O - `true` on success, `false` on error or end of file
+brf_louis_read(int    fd,		// I - File descriptor
+               void   *buffer,		// I - Buffer
+               size_t bytes)		// I - Number of bytes
+{
+  char		*ptr = (char *)buffer;	// Pointer into buffer
+  ssize_t	count;			// Bytes read
+
+
+  while (bytes > 0)
+  {
+    if ((count = read(fd, ptr, bytes)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      return (false);
+    }
+    else if (count == 0)
+      return (false);
+
+    ptr   += count;
+    bytes -= (size_t)count;
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_louis_receive()' - Get and lay out the translation of a worker's
+//                         chunk.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_louis_receive(
+    brf_louis_out_t    *out,		// I - Output state
+    brf_louis_worker_t *worker,		// I - Worker
+    cf_logfunc_t       log,		// I - Log function
+    void               *ld)		// I - Log function data
+{
+  brf_louis_chunk_t *chunk = worker->chunk;
+					// Chunk
+  size_t	total = 0;		// Cells in the translation
+  int		i;			// Looping var
+  const widechar *cells;		// Cells of current paragraph
+  widechar	*temp;			// New cells buffer
+  bool		ret = true;		// Return value
+
+
+  worker->busy = false;
+
+  // The cells of each paragraph, or -1 if it could not be translated, then
+  // all of the cells...
+  if (!brf_louis_read(worker->fromfd, chunk->lens, (size_t)chunk->num_paras * sizeof(int)))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "texttobrf: Translation process %d failed.", (int)worker->pid);
+    return (false);
+  }
+
+  for (i = 0; i < chunk->num_paras; i ++)
+  {
+    if (chunk->lens[i] > 0)
+      total += (size_t)chunk->lens[i];
+  }
+
+  if (total > out->num_cells)
+  {
+    if ((temp = (widechar *)realloc(out->cells, total * sizeof(widechar))) == NULL)
+      return (false);
+
+    out->cells     = temp;
+    out->num_cells = total;
+  }
+
+  if (!brf_louis_read(worker->fromfd, out->cells, total * sizeof(widechar)))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "texttobrf: Translation process %d failed.", (int)worker->pid);
+    return (false);
+  }
+
+  for (i = 0, cells = out->cells; i < chunk->num_paras; i ++)
+  {
+    if (chunk->lens[i] < 0)
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "texttobrf: liblouis could not translate with '%s'.", out->louis->tables);
+      ret = false;
+      continue;
+    }
+
+    if (chunk->flags[i] & BRF_LOUIS_TEXT)
+      brf_louis_layout(out, cells, chunk->lens[i], (chunk->flags[i] & BRF_LOUIS_INDENT) != 0);
+
+    if (chunk->flags[i] & BRF_LOUIS_NEWPAGE)
+      brf_louis_newpage(out);
+
+    cells += chunk->lens[i];
+  }
+
+  return (ret && !out->error);
+}
+
+
+//
+// 'brf_louis_send()' - Send the filled chunk to the next worker.
+//
+// The worker's previous chunk is received and laid out first.  Workers are
+// started with the second chunk, so short documents never start them, and
+// chunks are translated in this process when they cannot be started.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_louis_send(brf_louis_out_t *out,	// I - Output state
+               bool            last,	// I - Last chunk of the document?
+               cf_logfunc_t    log,	// I - Log function
+               void            *ld)	// I - Log function data
+{
+  brf_louis_chunk_t *chunk = out->chunk;
+					// Chunk
+  brf_louis_worker_t *worker;		// Worker
+  const widechar *text;			// Text of current paragraph
+  int		i;			// Looping var
+  bool		ret = true;		// Return value
+
+
+  if (chunk->num_paras == 0)
+    return (true);
+
+  if (!out->started && !last)
+    brf_louis_start(out, log, ld);
+
+  if (out->num_workers == 0)
+  {
+    // Translate here...
+    for (i = 0, text = chunk->text; i < chunk->num_paras; text += chunk->lens[i], i ++)
+    {
+      if ((chunk->flags[i] & BRF_LOUIS_TEXT) && !brf_louis_translate(out, text, chunk->lens[i], (chunk->flags[i] & BRF_LOUIS_INDENT) != 0, log, ld))
+        ret = false;
+
+      if (chunk->flags[i] & BRF_LOUIS_NEWPAGE)
+        brf_louis_newpage(out);
+    }
+
+    chunk->num_paras = chunk->used = 0;
+
+    return (ret);
+  }
+
+  worker = out->workers + out->next_worker;
+
+  if (worker->busy && !brf_louis_receive(out, worker, log, ld))
+    ret = false;
+
+  // Swap the chunks and send...
+  out->chunk    = worker->chunk;
+  worker->chunk = chunk;
+
+  out->chunk->num_paras = out->chunk->used = 0;
+
+  if (!brf_louis_write(worker->tofd, &chunk->num_paras, sizeof(int)) || !brf_louis_write(worker->tofd, chunk->lens, (size_t)chunk->num_paras * sizeof(int)) || !brf_louis_write(worker->tofd, chunk->text, (size_t)chunk->used * sizeof(widechar)))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "texttobrf: Unable to send text to translation process %d: %s", (int)worker->pid, strerror(errno));
+    return (false);
+  }
+
+  worker->busy      = true;
+  out->next_worker = (out->next_worker + 1) % out->num_workers;
+
+  return (ret);
+}
+
+
+//
+// 'brf_louis_start()' - Start the translation processes of a job.
+//
+
+static void
+brf_louis_start(brf_louis_out_t *out,	// I - Output state
+                cf_logfunc_t    log,	// I - Log function
+                void            *ld)	// I - Log function data
+{
+  brf_louis_worker_t *worker;		// Current worker
+  int		tofds[2],		// Pipe for chunks
+		fromfds[2],		// Pipe for translations
+		error;			// posix_spawn() error
+  char		value[1100],		// Environment variable
+		**envp;			// Worker environment
+  size_t	i,			// Looping var
+		count;			// Number of variables
+  posix_spawn_file_actions_t actions;	// Child file descriptors
+  char		*argv[] = { "brf-printer-app", NULL };
+					// Worker command-line
+
+
+  out->started = true;
+
+  for (count = 0; environ[count]; count ++);
+
+  if ((envp = calloc(count + 2, sizeof(char *))) == NULL)
+    return;
+
+  snprintf(value, sizeof(value), BRF_LOUIS_WORKER_ENV "=%s", out->louis->tables);
+  envp[0] = value;
+  for (i = 0; i < count; i ++)
+    envp[i + 1] = environ[i];
+
+  while (out->num_workers < out->louis->workers && out->num_workers < BRF_LOUIS_MAX_WORKERS)
+  {
+    worker = out->workers + out->num_workers;
+
+    if ((worker->chunk = (brf_louis_chunk_t *)malloc(sizeof(brf_louis_chunk_t))) == NULL)
+      break;
+
+    // Our ends stay out of other workers and filters...
+    if (pipe2(tofds, O_CLOEXEC))
+    {
+      free(worker->chunk);
+      break;
+    }
+
+    if (pipe2(fromfds, O_CLOEXEC))
+    {
+      close(tofds[0]);
+      close(tofds[1]);
+      free(worker->chunk);
+      break;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, tofds[0], 0);
+    posix_spawn_file_actions_adddup2(&actions, fromfds[1], 1);
+
+    error = posix_spawn(&worker->pid, "/proc/self/exe", &actions, NULL, argv, envp);
+
+    posix_spawn_file_actions_destroy(&actions);
+    close(tofds[0]);
+    close(fromfds[1]);
+
+    if (error)
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_WARN, "texttobrf: Unable to start translation process: %s", strerror(error));
+      close(tofds[1]);
+      close(fromfds[0]);
+      free(worker->chunk);
+      break;
+    }
+
+    worker->tofd   = tofds[1];
+    worker->fromfd = fromfds[0];
+    worker->busy   = false;
+
+    out->num_workers ++;
+  }
+
+  free(envp);
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "texttobrf: Started %d of %d translation processes.", out->num_workers, out->louis->workers);
+}
+
+
+//
+// 'brf_louis_stop()' - Stop the translation processes of a job.
+//
+
+static void
+brf_louis_stop(brf_louis_out_t *out,	// I - Output state
+               bool            force)	// I - Stop busy workers too?
+{
+  brf_louis_worker_t *worker;		// Current worker
+  int		i,			// Looping var
+		status;			// Exit status
+
+
+  // Workers exit at the end of their input...
+  for (i = 0, worker = out->workers; i < out->num_workers; i ++, worker ++)
+  {
+    close(worker->tofd);
+    close(worker->fromfd);
+
+    if (force && worker->busy)
+      kill(worker->pid, SIGTERM);
+
+    while (waitpid(worker->pid, &status, 0) < 0 && errno == EINTR);
+
+    free(worker->chunk);
+  }
+
+  out->num_workers = 0;
+}
+
+
+//
+// 'brf_louis_string()' - Translate a paragraph to braille cells.
+//
+
+static widechar *			// O - Cells or `NULL` on error
+brf_louis_string(const char     *tables,// I - Table list
+                 const widechar *para,	// I - Paragraph
+                 int            len,	// I - Number of characters
+                 int            *outlen)// O - Number of cells
+{
+  widechar	*braille = NULL;	// Translated paragraph
+  int		inlen,			// Characters translated
+		maxlen = 2 * len + 64;	// Size of braille buffer
+  bool		ok;			// Translation succeeded?
+
+
+  // Translate, growing the buffer when liblouis did not get through the
+  // whole paragraph...
+  do
+  {
+    free(braille);
+
+    if ((braille = (widechar *)malloc((size_t)maxlen * sizeof(widechar))) == NULL)
+      return (NULL);
+
+    inlen   = len;
+    *outlen = maxlen;
+
+    pthread_mutex_lock(&brf_louis_mutex);
+    ok = lou_translateString(tables, para, &inlen, braille, outlen, NULL, NULL, 0) != 0;
+    pthread_mutex_unlock(&brf_louis_mutex);
+
+    maxlen *= 2;
+  }
+  while (ok && inlen < len && *outlen >= maxlen / 2);
+
+  if (!ok)
+  {
+    free(braille);
+    return (NULL);
+  }
+
+  return (braille);
+}
+
+
+//
+// 'brf_louis_translate()' - Translate a paragraph and lay it out.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_louis_translate(
+    brf_louis_out_t *out,		// I - Output state
+    const widechar  *para,		// I - Paragraph
+    int             len,		// I - Number of characters
+    bool            indent,		// I - Indent the first line?
+    cf_logfunc_t    log,		// I - Log function
+    void            *ld)		// I - Log function data
+{
+  widechar	*braille;		// Translated paragraph
+  int		outlen;			// Cells produced
+
+
+  if ((braille = brf_louis_string(out->louis->tables, para, len, &outlen)) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "texttobrf: liblouis could not translate with '%s'.", out->louis->tables);
+    return (false);
+  }
+
+  brf_louis_layout(out, braille, outlen, indent);
+
+  free(braille);
+
+  return (!out->error);
+}
+
+
+//
+// 'brf_louis_write()' - Write a whole buffer to a pipe.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_louis_write(int        fd,		// I - File descriptor
+                const void *buffer,	// I - Buffer
+                size_t     bytes)	// I - Number of bytes
+{
+  const char	*ptr = (const char *)buffer;
+					// Pointer into buffer
+  ssize_t	count;			// Bytes written
+
+
+  while (bytes > 0)
+  {
+    if ((count = write(fd, ptr, bytes)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      return (false);
+    }
+
+    ptr   += count;
+    bytes -= (size_t)count;
+  }
+
+  return (true);
+}
@@ -0,0 +1,295 @@
+//
+// Input format detection for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Documents sent without a format are typed from their first bytes: file
+// signatures first, then a single pass over the header that decodes UTF-8
+// and measures the lines.  Ready BRF is sent to the embosser as it is,
+// Unicode braille (UBRL) is mapped to BRF in-process and other text goes
+// through translation.
+//
+// Any printable ASCII is a valid BRF character, so telling BRF from text
+// is a heuristic: BRF is single-case, has no tabs or non-ASCII characters,
+// and its lines fit on an embosser line.  Since upper case text fits that
+// too, BRF also needs positive evidence: form feeds between pages, or
+// enough of the signs plain text seldom has, such as capital signs (","
+// before a letter), contractions with digits right after a letter and
+// punctuation like "@[\]^_<>".  Everything else is text.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+
+
+//
+// Constants...
+//
+
+#define BRF_MIME_MAX_LINE	64	// Longest line of BRF, in cells
+#define BRF_MIME_MIN_SIGNS	32	// At least one BRF sign per this many
+					// characters
+
+
+//
+// 'brf_mime_type()' - Determine the format of a document.
+//
+
+const char *				// O - MIME media type or `NULL` if unknown
+brf_mime_type(
+    const unsigned char *header,	// I - Header data
+    size_t              headersize)	// I - Size of header data
+{
+  const unsigned char *ptr,		// Pointer into header
+		*end = header + headersize;
+					// End of header
+  size_t	braille = 0,		// Unicode braille characters
+		other = 0,		// Other non-ASCII characters
+		line = 0,		// Length of current line
+		max_line = 0,		// Length of longest line
+		chars = 0,		// Printable ASCII characters
+		signs = 0;		// BRF signs seen
+  bool		upper = false,		// Upper case letters seen?
+		lower = false,		// Lower case letters seen?
+		tab = false,		// Tabs seen?
+		paged = false;		// Form feed after a page seen?
+  int		len;			// Length of UTF-8 sequence
+  unsigned char	c,			// Current byte
+		prev = 0;		// Previous byte
+
+
+  if (headersize >= 4 && !memcmp(header, "%PDF", 4))
+    return ("application/pdf");
+  else if (headersize >= 8 && !memcmp(header, "\211PNG\r\n\032\n", 8))
+    return ("image/png");
+  else if (headersize >= 3 && !memcmp(header, "\377\330\377", 3))
+    return ("image/jpeg");
+  else if (headersize >= 4 && !memcmp(header, "RaS2", 4))
+    return ("image/pwg-raster");
+  else if (headersize >= 8 && !memcmp(header, "UNIRAST", 8))
+    return ("image/urf");
+  else if (headersize == 0)
+    return (NULL);
+
+  // Skip a UTF-8 byte order mark...
+  if (headersize >= 3 && !memcmp(header, "\357\273\277", 3))
+    header += 3;
+
+  for (ptr = header; ptr < end; ptr ++)
+  {
+    if ((c = *ptr) == '\n' || c == '\r' || c == '\f')
+    {
+      if (c == '\f' && chars > 0)
+        paged = true;
+
+      if (line > max_line)
+        max_line = line;
+
+      line = 0;
+      prev = c;
+      continue;
+    }
+    else if (c == '\t')
+    {
+      tab = true;
+    }
+    else if (c < ' ' || c == 0x7f)
+    {
+      return (NULL);			// Binary data
+    }
+    else if (c < 0x80)
+    {
+      if (c >= 'A' && c <= 'Z')
+        upper = true;
+      else if (c >= 'a' && c <= 'z')
+        lower = true;
+
+      if (c != ' ')
+        chars ++;
+
+      if (strchr("@[\\]^_<>", c))
+        signs ++;			// Rare in text
+      else if (prev == ',' && ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')))
+        signs ++;			// Capital sign
+      else if (c >= '0' && c <= '9' && ((prev >= 'A' && prev <= 'Z') || (prev >= 'a' && prev <= 'z')))
+        signs ++;			// Contraction or punctuation
+    }
+    else
+    {
+      // Multi-byte UTF-8, U+2800 to U+28FF is braille...
+      if ((c & 0xe0) == 0xc0)
+        len = 2;
+      else if ((c & 0xf0) == 0xe0)
+        len = 3;
+      else if ((c & 0xf8) == 0xf0)
+        len = 4;
+      else
+        return (NULL);
+
+      if (ptr + len > end)
+        break;				// Cut off by the end of the header
+
+      if ((ptr[1] & 0xc0) != 0x80 || (len > 2 && (ptr[2] & 0xc0) != 0x80) || (len > 3 && (ptr[3] & 0xc0) != 0x80))
+        return (NULL);
+
+      if (c == 0xe2 && ptr[1] >= 0xa0 && ptr[1] <= 0xa3)
+        braille ++;
+      else
+        other ++;
+
+      ptr += len - 1;
+    }
+
+    line ++;
+    prev = c;
+  }
+
+  if (line > max_line)
+    max_line = line;
+
+  if (braille > 0 && braille >= other)
+    return ("application/vnd.cups-ubrl");
+  else if (!other && !tab && !(upper && lower) && max_line <= BRF_MIME_MAX_LINE && (paged || (signs > 0 && signs * BRF_MIME_MIN_SIGNS >= chars)))
+    return ("application/vnd.cups-paged-brf");
+  else
+    return ("text/plain");
+}
+
+
+//
+// 'brf_mime_ubrl_filter_function()' - Convert Unicode braille to BRF.
+//
+// Braille characters become the BRF character for their dots 1 to 6,
+// printable ASCII, line and page breaks are copied and anything else is
+// dropped.
+//
+
+int					// O - Error status
+brf_mime_ubrl_filter_function(
+    int              inputfd,		// I - File descriptor input stream
+    int              outputfd,		// I - File descriptor output stream
+    int              inputseekable,	// I - Is input stream seekable?
+    cf_filter_data_t *data,		// I - Job and printer data
+    void             *parameters)	// I - Filter parameters (unused)
+{
+  cf_logfunc_t	log = data->logfunc;	// Log function
+  void		*ld = data->logdata;	// Log function data
+  unsigned char	inbuf[65536],		// Input buffer
+		c;			// Current byte
+  char		outbuf[65536];		// Output buffer
+  size_t	outlen = 0,		// Bytes in output buffer
+		total = 0,		// Total bytes read
+		written = 0;		// Total bytes written
+  ssize_t	bytes,			// Bytes read
+		i;			// Looping var
+  unsigned	cp = 0;			// Code point being decoded
+  int		need = 0,		// UTF-8 continuation bytes still needed
+		dropped = 0,		// Cells with dots 7 or 8
+		ret = 0;		// Return value
+
+
+  (void)inputseekable;
+  (void)parameters;
+
+  while ((bytes = read(inputfd, inbuf, sizeof(inbuf))) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "UBRL: Unable to read input: %s", strerror(errno));
+      ret = 1;
+      break;
+    }
+
+    total += (size_t)bytes;
+
+    for (i = 0; i < bytes; i ++)
+    {
+      c = inbuf[i];
+
+      if (need > 0 && (c & 0xc0) == 0x80)
+      {
+        cp = (cp << 6) | (c & 0x3f);
+
+        if (-- need > 0)
+          continue;
+
+        if (cp >= 0x2800 && cp <= 0x28ff)
+        {
+          if (cp & 0xc0)
+            dropped ++;
+
+          outbuf[outlen ++] = brf_gen_ascii[cp & 0x3f];
+        }
+      }
+      else if (c < 0x80)
+      {
+        need = 0;
+
+        if ((c >= ' ' && c < 0x7f) || c == '\n' || c == '\r' || c == '\f')
+          outbuf[outlen ++] = (char)c;
+      }
+      else if ((c & 0xe0) == 0xc0)
+      {
+        cp   = c & 0x1f;
+        need = 1;
+      }
+      else if ((c & 0xf0) == 0xe0)
+      {
+        cp   = c & 0x0f;
+        need = 2;
+      }
+      else if ((c & 0xf8) == 0xf0)
+      {
+        cp   = c & 0x07;
+        need = 3;
+      }
+      else
+        need = 0;
+
+      if (outlen == sizeof(outbuf))
+      {
+        if (write(outputfd, outbuf, outlen) != (ssize_t)outlen)
+        {
+          ret = 1;
+          break;
+        }
+
+        written += outlen;
+        outlen  = 0;
+      }
+    }
+
+    if (ret)
+      break;
+  }
+
+  if (!ret && outlen > 0)
+  {
+    if (write(outputfd, outbuf, outlen) != (ssize_t)outlen)
+      ret = 1;
+    else
+      written += outlen;
+  }
+
+  if (ret && bytes >= 0 && log)
+    log(ld, CF_LOGLEVEL_ERROR, "UBRL: Unable to write output: %s", strerror(errno));
+  else if (dropped && log)
+    log(ld, CF_LOGLEVEL_WARN, "UBRL: Printed %d 8-dot cell(s) without dots 7 and 8.", dropped);
+
+  brf_stats_bytes(total, written);
+
+  close(inputfd);
+  close(outputfd);
+
+  return (ret);
+}
@@ -0,0 +1,816 @@
+//
+// Page range selection for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// BRF pages are separated by form feeds, so selecting pages only needs a
+// memchr() scan for FF characters; the selected spans are then written to
+// the output as they are, straight from the input buffer or mapping.
+//
+// Cached translations get a page index next to them, an array of the byte
+// offsets where pages start.  With an index the selected spans of a mapped
+// file are written without looking at the pages in between, so printing
+// the last pages of a book costs the same as printing the first ones.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+
+//
+// Constants...
+//
+
+#define BRF_PAGES_FF		0x0c	// Form feed, ends a BRF page
+#define BRF_PAGES_MAGIC		"BRFI"	// Page index file magic
+
+
+//
+// Local types...
+//
+
+typedef struct brf_pages_index_s	// Page index file header
+{
+  char		magic[4];		// BRF_PAGES_MAGIC
+  uint32_t	reserved;		// Padding, 0
+  uint64_t	size,			// Size of the indexed BRF file
+		num_pages;		// Number of page offsets that follow
+} brf_pages_index_t;
+
+typedef struct brf_pages_scan_s		// Page scanning state
+{
+  const brf_pages_t *pages;		// Selected pages
+  int		outputfd;		// Output file descriptor
+  size_t	bytes_in,		// Bytes scanned
+		bytes_out;		// Bytes written
+  int		page,			// Current page number
+		cursor;			// Current range in pages
+  bool		selected,		// Is the current page selected?
+		done;			// No more pages will be selected
+} brf_pages_scan_t;
+
+
+//
+// Local functions...
+//
+
+static bool	brf_pages_add(brf_pages_t *pages, int first, int last);
+static int	brf_pages_compare(const void *a, const void *b);
+static int	brf_pages_indexed(brf_pages_scan_t *scan, const char *buffer, size_t bytes);
+static void	brf_pages_normalize(brf_pages_t *pages);
+static bool	brf_pages_scan(brf_pages_scan_t *scan, const char *buffer, size_t bytes);
+static bool	brf_pages_write(int fd, const char *buffer, size_t bytes);
+
+
+//
+// 'brf_pages_build_index()' - Write the page index of a BRF file.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_pages_build_index(
+    int        fd,			// I - BRF file descriptor
+    const char *filename)		// I - Index file to create
+{
+  struct stat	fileinfo;		// BRF file information
+  const char	*map,			// Mapped BRF file
+		*ptr,			// Pointer into file
+		*end;			// End of file
+  brf_pages_index_t index;		// Index header
+  uint64_t	offsets[4096];		// Block of page offsets
+  size_t	count = 0;		// Offsets in block
+  char		tempfile[1024];		// Index being written
+  int		indexfd;		// Index file descriptor
+  bool		ret = true;		// Return value
+
+
+  if (fstat(fd, &fileinfo) || !S_ISREG(fileinfo.st_mode) || fileinfo.st_size == 0)
+    return (false);
+
+  if ((map = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    return (false);
+
+  madvise((void *)map, (size_t)fileinfo.st_size, MADV_SEQUENTIAL);
+
+  snprintf(tempfile, sizeof(tempfile), "%s.tmp-%d", filename, (int)getpid());
+
+  if ((indexfd = open(tempfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+  {
+    munmap((void *)map, (size_t)fileinfo.st_size);
+    return (false);
+  }
+
+  // The header is written last, once the page count is known...
+  memset(&index, 0, sizeof(index));
+  memcpy(index.magic, BRF_PAGES_MAGIC, sizeof(index.magic));
+  index.size = (uint64_t)fileinfo.st_size;
+
+  if (lseek(indexfd, (off_t)sizeof(index), SEEK_SET) < 0)
+    ret = false;
+
+  for (ptr = map, end = map + fileinfo.st_size; ret && ptr < end; index.num_pages ++)
+  {
+    offsets[count ++] = (uint64_t)(ptr - map);
+
+    if (count == sizeof(offsets) / sizeof(offsets[0]))
+    {
+      ret   = brf_pages_write(indexfd, (const char *)offsets, sizeof(offsets));
+      count = 0;
+    }
+
+    if ((ptr = memchr(ptr, BRF_PAGES_FF, (size_t)(end - ptr))) == NULL)
+      ptr = end;
+    else
+      ptr ++;
+  }
+
+  munmap((void *)map, (size_t)fileinfo.st_size);
+
+  if (ret && count > 0)
+    ret = brf_pages_write(indexfd, (const char *)offsets, count * sizeof(offsets[0]));
+
+  if (ret && lseek(indexfd, 0, SEEK_SET) == 0)
+    ret = brf_pages_write(indexfd, (const char *)&index, sizeof(index));
+  else
+    ret = false;
+
+  if (close(indexfd))
+    ret = false;
+
+  if (!ret || rename(tempfile, filename))
+  {
+    unlink(tempfile);
+    return (false);
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_pages_contains()' - Determine whether a page is selected.
+//
+// Pages must be queried in increasing order; "cursor" keeps the position in
+// the range list between calls and must be initialized to 0.  An empty list
+// selects all pages.
+//
+
+bool					// O - `true` if selected, `false` otherwise
+brf_pages_contains(
+    const brf_pages_t *pages,		// I  - Selected pages
+    int               page,		// I  - Page number
+    int               *cursor)		// IO - Current range
+{
+  if (pages->num_ranges == 0)
+    return (true);
+
+  while (*cursor < pages->num_ranges && pages->ranges[*cursor].last < page)
+    (*cursor) ++;
+
+  return (*cursor < pages->num_ranges && pages->ranges[*cursor].first <= page);
+}
+
+
+//
+// 'brf_pages_count()' - Get the number of selected pages from a page index.
+//
+
+int					// O - Number of pages or 0 if unknown
+brf_pages_count(
+    const brf_pages_t *pages,		// I - Selected pages or `NULL` for all
+    const char        *index)		// I - Page index file
+{
+  int		fd,			// Index file descriptor
+		i,			// Looping var
+		num_pages,		// Pages in document
+		last,			// Last page in range
+		count = 0;		// Selected pages
+  brf_pages_index_t header;		// Index header
+
+
+  if ((fd = open(index, O_RDONLY | O_CLOEXEC)) < 0)
+    return (0);
+
+  if (read(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) || memcmp(header.magic, BRF_PAGES_MAGIC, sizeof(header.magic)) || header.num_pages >= INT_MAX)
+  {
+    close(fd);
+    return (0);
+  }
+
+  close(fd);
+
+  num_pages = (int)header.num_pages;
+
+  if (!pages || pages->num_ranges == 0)
+    return (num_pages);
+
+  for (i = 0; i < pages->num_ranges && pages->ranges[i].first <= num_pages; i ++)
+  {
+    last  = pages->ranges[i].last < num_pages ? pages->ranges[i].last : num_pages;
+    count += last - pages->ranges[i].first + 1;
+  }
+
+  return (count);
+}
+
+
+//
+// 'brf_pages_filter_function()' - Copy the selected pages of a BRF document.
+//
+// "parameters" points to the brf_pages_t list of pages to keep.  Seekable
+// regular files are mapped into memory and use the page index if the list
+// names one, anything else is read in large blocks.
+//
+
+int					// O - Error status
+brf_pages_filter_function(
+    int              inputfd,		// I - File descriptor input stream
+    int              outputfd,		// I - File descriptor output stream
+    int              inputseekable,	// I - Is input stream seekable?
+    cf_filter_data_t *data,		// I - Job and printer data
+    void             *parameters)	// I - Selected pages
+{
+  brf_pages_scan_t scan;		// Scanning state
+  cf_logfunc_t	log = data->logfunc;	// Log function
+  void		*ld = data->logdata;	// Log function data
+  struct stat	fileinfo;		// Input file information
+  void		*map = MAP_FAILED;	// Mapped input file
+  ssize_t	bytes;			// Bytes read
+  char		buffer[262144];		// Read buffer
+  int		ret = 0,		// Return value
+		status = 0;		// Status of indexed copy
+
+
+  scan.pages    = (const brf_pages_t *)parameters;
+  scan.outputfd  = outputfd;
+  scan.bytes_in  = 0;
+  scan.bytes_out = 0;
+  scan.page     = 1;
+  scan.cursor   = 0;
+  scan.selected = brf_pages_contains(scan.pages, 1, &scan.cursor);
+  scan.done     = !scan.selected && scan.cursor >= scan.pages->num_ranges;
+
+  if (inputseekable && !fstat(inputfd, &fileinfo) && S_ISREG(fileinfo.st_mode) && fileinfo.st_size > 0)
+    map = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, inputfd, 0);
+
+  if (map != MAP_FAILED && scan.pages->index && (status = brf_pages_indexed(&scan, (const char *)map, (size_t)fileinfo.st_size)) != 0)
+  {
+    ret = status < 0;
+
+    munmap(map, (size_t)fileinfo.st_size);
+  }
+  else if (map != MAP_FAILED)
+  {
+    madvise(map, (size_t)fileinfo.st_size, MADV_SEQUENTIAL);
+
+    scan.bytes_in = (size_t)fileinfo.st_size;
+
+    if (!brf_pages_scan(&scan, (const char *)map, (size_t)fileinfo.st_size))
+      ret = 1;
+
+    munmap(map, (size_t)fileinfo.st_size);
+  }
+  else
+  {
+    while ((bytes = read(inputfd, buffer, sizeof(buffer))) != 0)
+    {
+      if (bytes < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "Page ranges: Unable to read input: %s", strerror(errno));
+        ret = 1;
+        break;
+      }
+
+      scan.bytes_in += (size_t)bytes;
+
+      // Keep draining the input once the last selected page has been written,
+      // so that upstream filters do not fail on a closed pipe...
+      if (!scan.done && !brf_pages_scan(&scan, buffer, (size_t)bytes))
+      {
+        ret = 1;
+        break;
+      }
+    }
+  }
+
+  if (ret && log)
+    log(ld, CF_LOGLEVEL_ERROR, "Page ranges: Unable to write output: %s", strerror(errno));
+  else if (log && status > 0)
+    log(ld, CF_LOGLEVEL_DEBUG, "Page ranges: Copied the selected pages with the index of %d page(s).", scan.page);
+  else if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "Page ranges: Scanned %d page(s).", scan.page);
+
+  brf_stats_bytes(scan.bytes_in, scan.bytes_out);
+
+  close(inputfd);
+  close(outputfd);
+
+  return (ret);
+}
+
+
+//
+// 'brf_pages_free()' - Free a list of selected pages.
+//
+
+void
+brf_pages_free(brf_pages_t *pages)	// I - Selected pages
+{
+  free(pages->ranges);
+
+  pages->num_ranges = 0;
+  pages->ranges     = NULL;
+}
+
+
+//
+// 'brf_pages_from_ipp()' - Get the selected pages from a "page-ranges"
+//                          attribute.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_pages_from_ipp(
+    brf_pages_t     *pages,		// O - Selected pages
+    ipp_attribute_t *attr)		// I - "page-ranges" attribute
+{
+  int	i,				// Looping var
+	count,				// Number of values
+	first,				// First page
+	last;				// Last page
+
+
+  pages->num_ranges = 0;
+  pages->ranges     = NULL;
+
+  for (i = 0, count = ippGetCount(attr); i < count; i ++)
+  {
+    first = ippGetRange(attr, i, &last);
+
+    if (first < 1 || last < first || !brf_pages_add(pages, first, last))
+    {
+      brf_pages_free(pages);
+      return (false);
+    }
+  }
+
+  brf_pages_normalize(pages);
+
+  return (true);
+}
+
+
+//
+// 'brf_pages_offsets()' - Get the byte offsets of the pages of a BRF file.
+//
+// The array has an extra entry with the size of the file, so page N (from
+// 0) is the span from offsets[N] to offsets[N + 1].  The page index is used
+// when it matches the file, otherwise the file is scanned.
+//
+
+int					// O - Number of pages or -1 on error
+brf_pages_offsets(
+    const char *buffer,			// I - Mapped BRF file
+    size_t     bytes,			// I - Size of file
+    const char *index,			// I - Page index file or `NULL`
+    size_t     **offsets)		// O - Page offsets, free() when done
+{
+  int		fd,			// Index file descriptor
+		num_pages = 0,		// Number of pages
+		alloc_pages = 0;	// Allocated offsets
+  struct stat	fileinfo;		// Index file information
+  void		*map;			// Mapped index
+  const brf_pages_index_t *header;	// Index header
+  const uint64_t *starts;		// Page start offsets of index
+  size_t	*temp;			// New offsets
+  const char	*ptr,			// Pointer into file
+		*end = buffer + bytes;	// End of file
+
+
+  *offsets = NULL;
+
+  // Map the whole index rather than reading it an offset at a time...
+  if (index && (fd = open(index, O_RDONLY | O_CLOEXEC)) >= 0)
+  {
+    if (!fstat(fd, &fileinfo) && (size_t)fileinfo.st_size >= sizeof(brf_pages_index_t) && (map = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+    {
+      header = (const brf_pages_index_t *)map;
+      starts = (const uint64_t *)(header + 1);
+
+      if (!memcmp(header->magic, BRF_PAGES_MAGIC, sizeof(header->magic)) && header->size == bytes && header->num_pages < INT_MAX && header->num_pages == ((size_t)fileinfo.st_size - sizeof(brf_pages_index_t)) / sizeof(uint64_t) && (*offsets = calloc((size_t)header->num_pages + 1, sizeof(size_t))) != NULL)
+      {
+        for (num_pages = 0; (uint64_t)num_pages < header->num_pages; num_pages ++)
+        {
+          if (starts[num_pages] > bytes || (num_pages > 0 && starts[num_pages] < starts[num_pages - 1]))
+            break;
+
+          (*offsets)[num_pages] = (size_t)starts[num_pages];
+        }
+
+        if ((uint64_t)num_pages == header->num_pages)
+        {
+          munmap(map, (size_t)fileinfo.st_size);
+          close(fd);
+          (*offsets)[num_pages] = bytes;
+          return (num_pages);
+        }
+
+        // Bad index, scan instead...
+        free(*offsets);
+        *offsets  = NULL;
+        num_pages = 0;
+      }
+
+      munmap(map, (size_t)fileinfo.st_size);
+    }
+
+    close(fd);
+  }
+
+  for (ptr = buffer; ptr < end; num_pages ++)
+  {
+    if (num_pages + 1 >= alloc_pages)
+    {
+      alloc_pages += 1024;
+
+      if ((temp = realloc(*offsets, (size_t)alloc_pages * sizeof(size_t))) == NULL)
+      {
+        free(*offsets);
+        *offsets = NULL;
+        return (-1);
+      }
+
+      *offsets = temp;
+    }
+
+    (*offsets)[num_pages] = (size_t)(ptr - buffer);
+
+    if ((ptr = memchr(ptr, BRF_PAGES_FF, (size_t)(end - ptr))) == NULL)
+      ptr = end;
+    else
+      ptr ++;
+  }
+
+  if (!*offsets && (*offsets = calloc(1, sizeof(size_t))) == NULL)
+    return (-1);
+
+  (*offsets)[num_pages] = bytes;
+
+  return (num_pages);
+}
+
+
+//
+// 'brf_pages_parse()' - Parse a CUPS-style "page-ranges" option value.
+//
+// Accepts comma-delimited "N", "N-M", "N-" and "-M" ranges.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_pages_parse(brf_pages_t *pages,	// O - Selected pages
+                const char  *value)	// I - Option value
+{
+  const char	*ptr;			// Pointer into value
+  char		*end;			// End of number
+  long		first,			// First page
+		last;			// Last page
+
+
+  pages->num_ranges = 0;
+  pages->ranges     = NULL;
+
+  for (ptr = value; ptr && *ptr;)
+  {
+    while (isspace(*ptr & 255))
+      ptr ++;
+
+    if (isdigit(*ptr & 255))
+    {
+      first = strtol(ptr, &end, 10);
+      ptr   = end;
+    }
+    else if (*ptr == '-')
+      first = 1;
+    else
+      goto error;
+
+    while (isspace(*ptr & 255))
+      ptr ++;
+
+    if (*ptr == '-')
+    {
+      ptr ++;
+      while (isspace(*ptr & 255))
+        ptr ++;
+
+      if (isdigit(*ptr & 255))
+      {
+        last = strtol(ptr, &end, 10);
+        ptr  = end;
+      }
+      else
+        last = INT_MAX;
+    }
+    else
+      last = first;
+
+    if (first < 1 || first > INT_MAX || last < first)
+      goto error;
+
+    if (last > INT_MAX)
+      last = INT_MAX;
+
+    if (!brf_pages_add(pages, (int)first, (int)last))
+      goto error;
+
+    while (isspace(*ptr & 255))
+      ptr ++;
+
+    if (*ptr == ',')
+      ptr ++;
+    else if (*ptr)
+      goto error;
+  }
+
+  brf_pages_normalize(pages);
+
+  return (true);
+
+  error:
+
+  brf_pages_free(pages);
+
+  return (false);
+}
+
+
+//
+// 'brf_pages_add()' - Add a range to a list of selected pages.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_pages_add(brf_pages_t *pages,	// I - Selected pages
+	      int         first,	// I - First page
+	      int         last)		// I - Last page
+{
+  brf_page_range_t *ranges;		// New range array
+
+
+  if ((pages->num_ranges & 15) == 0)
+  {
+    if ((ranges = (brf_page_range_t *)realloc(pages->ranges, (size_t)(pages->num_ranges + 16) * sizeof(brf_page_range_t))) == NULL)
+      return (false);
+
+    pages->ranges = ranges;
+  }
+
+  pages->ranges[pages->num_ranges].first = first;
+  pages->ranges[pages->num_ranges].last  = last;
+  pages->num_ranges ++;
+
+  return (true);
+}
+
+
+//
+// 'brf_pages_compare()' - Compare two ranges by first page.
+//
+
+static int				// O - Result of comparison
+brf_pages_compare(const void *a,	// I - First range
+		  const void *b)	// I - Second range
+{
+  const brf_page_range_t *ra = (const brf_page_range_t *)a,
+			*rb = (const brf_page_range_t *)b;
+
+
+  return (ra->first < rb->first ? -1 : ra->first > rb->first);
+}
+
+
+//
+// 'brf_pages_indexed()' - Write the selected pages using the page index.
+//
+// Returns 0 when the index is missing or does not match the mapped file, so
+// that the caller scans the file instead.
+//
+
+static int				// O - 1 on success, 0 if no index, -1 on error
+brf_pages_indexed(
+    brf_pages_scan_t *scan,		// I - Scanning state
+    const char       *buffer,		// I - Mapped BRF file
+    size_t           bytes)		// I - Size of file
+{
+  int		fd,			// Index file descriptor
+		i,			// Looping var
+		status = 1;		// Return value
+  struct stat	fileinfo;		// Index file information
+  void		*map;			// Mapped index
+  const brf_pages_index_t *index;	// Index header
+  const uint64_t *offsets;		// Page start offsets
+  uint64_t	num_pages,		// Number of pages
+		first,			// First page of range, from 0
+		last,			// Page after range, from 0
+		start,			// Start of span
+		stop;			// End of span
+
+
+  if ((fd = open(scan->pages->index, O_RDONLY | O_CLOEXEC)) < 0)
+    return (0);
+
+  if (fstat(fd, &fileinfo) || (size_t)fileinfo.st_size < sizeof(brf_pages_index_t) || (map = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+  {
+    close(fd);
+    return (0);
+  }
+
+  close(fd);
+
+  index     = (const brf_pages_index_t *)map;
+  offsets   = (const uint64_t *)(index + 1);
+  num_pages = index->num_pages;
+
+  if (memcmp(index->magic, BRF_PAGES_MAGIC, sizeof(index->magic)) || index->size != bytes || num_pages > ((size_t)fileinfo.st_size - sizeof(brf_pages_index_t)) / sizeof(uint64_t))
+  {
+    munmap(map, (size_t)fileinfo.st_size);
+    return (0);
+  }
+
+  for (i = 0; i < scan->pages->num_ranges || (i == 0 && scan->pages->num_ranges == 0); i ++)
+  {
+    if (scan->pages->num_ranges == 0)
+    {
+      first = 0;
+      last  = num_pages;
+    }
+    else
+    {
+      first = (uint64_t)scan->pages->ranges[i].first - 1;
+      last  = (uint64_t)scan->pages->ranges[i].last;
+    }
+
+    if (first >= num_pages)
+      break;
+
+    if (last > num_pages)
+      last = num_pages;
+
+    start = offsets[first];
+    stop  = last < num_pages ? offsets[last] : bytes;
+
+    if (start > stop || stop > bytes)
+    {
+      status = -1;
+      errno  = EINVAL;
+      break;
+    }
+
+    if (!brf_pages_write(scan->outputfd, buffer + start, (size_t)(stop - start)))
+    {
+      status = -1;
+      break;
+    }
+
+    scan->bytes_in  += (size_t)(stop - start);
+    scan->bytes_out += (size_t)(stop - start);
+  }
+
+  scan->page = (int)(num_pages < INT_MAX ? num_pages : INT_MAX);
+
+  munmap(map, (size_t)fileinfo.st_size);
+
+  return (status);
+}
+
+
+//
+// 'brf_pages_normalize()' - Sort and merge overlapping or adjacent ranges.
+//
+
+static void
+brf_pages_normalize(brf_pages_t *pages)	// I - Selected pages
+{
+  int			i,		// Looping var
+			count;		// Number of merged ranges
+  brf_page_range_t	*current;	// Current merged range
+
+
+  if (pages->num_ranges < 2)
+    return;
+
+  qsort(pages->ranges, (size_t)pages->num_ranges, sizeof(brf_page_range_t), brf_pages_compare);
+
+  for (i = 1, count = 1, current = pages->ranges; i < pages->num_ranges; i ++)
+  {
+    if (current->last == INT_MAX || pages->ranges[i].first <= current->last + 1)
+    {
+      if (pages->ranges[i].last > current->last)
+        current->last = pages->ranges[i].last;
+    }
+    else
+    {
+      current ++;
+      *current = pages->ranges[i];
+      count ++;
+    }
+  }
+
+  pages->num_ranges = count;
+}
+
+
+//
+// 'brf_pages_scan()' - Scan a block of BRF data and write selected spans.
+//
+// Consecutive selected pages are written with a single write() call.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_pages_scan(brf_pages_scan_t *scan,	// I - Scanning state
+	       const char       *buffer,// I - Data
+	       size_t           bytes)	// I - Number of bytes
+{
+  const char	*ptr = buffer,		// Pointer into buffer
+		*end = buffer + bytes,	// End of buffer
+		*span = scan->selected ? buffer : NULL,
+					// Start of selected span
+		*ff;			// Next form feed
+  bool		selected;		// Is the next page selected?
+
+
+  while (!scan->done && (ff = memchr(ptr, BRF_PAGES_FF, (size_t)(end - ptr))) != NULL)
+  {
+    ptr = ff + 1;
+    scan->page ++;
+
+    selected = brf_pages_contains(scan->pages, scan->page, &scan->cursor);
+
+    if (scan->selected && !selected)
+    {
+      // End of a selected span, including its form feed...
+      if (!brf_pages_write(scan->outputfd, span, (size_t)(ptr - span)))
+        return (false);
+
+      scan->bytes_out += (size_t)(ptr - span);
+
+      span       = NULL;
+      scan->done = scan->cursor >= scan->pages->num_ranges;
+    }
+    else if (!scan->selected && selected)
+    {
+      span = ptr;
+    }
+
+    scan->selected = selected;
+  }
+
+  if (span && span < end)
+  {
+    scan->bytes_out += (size_t)(end - span);
+
+    return (brf_pages_write(scan->outputfd, span, (size_t)(end - span)));
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_pages_write()' - Write a buffer, retrying on short writes.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_pages_write(int        fd,		// I - File descriptor
+		const char *buffer,	// I - Data
+		size_t     bytes)	// I - Number of bytes
+{
+  ssize_t	written;		// Bytes written
+
+
+  while (bytes > 0)
+  {
+    if ((written = write(fd, buffer, bytes)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      return (false);
+    }
+
+    buffer += written;
+    bytes  -= (size_t)written;
+  }
+
+  return (true);
+}
@@ -0,0 +1,868 @@
+//
+// Embosser pools for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Several identical embossers can be one printer with a "pool" device URI
+// that lists the member devices:
+//
+//     pool:///Index%20Everest?usb%3A%2F%2FIndex%2F...&usb%3A%2F%2FIndex%2F...
+//
+// The URI is all the state there is, so pools are saved and restored with
+// the printer.  PAPPL prints the jobs of a printer one at a time, so the
+// pool speeds up a queue by splitting each large BRF document into runs of
+// pages, one run per idle member, sized by the pages per minute measured
+// for each member.  Small jobs and jobs coming from a pipe go to a single
+// member, the least busy and fastest one.
+//
+// Copies that the embosser cannot make itself are sent one after the
+// other; input from a pipe is spooled to a temporary file for that first.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+
+
+//
+// Constants...
+//
+
+#define BRF_POOL_MAX		16	// Maximum number of members
+#define BRF_POOL_MIN_PAGES	4	// Minimum pages per member when splitting
+#define BRF_POOL_PPM		60	// Pages per minute before measuring
+
+
+//
+// Local types...
+//
+
+typedef struct brf_pool_member_s	// Member embosser
+{
+  char		*uri;			// Device URI
+  int		busy;			// Jobs or runs printing on it
+  double	ppm;			// Measured pages per minute, 0 if unknown
+} brf_pool_member_t;
+
+typedef struct brf_pool_dev_s		// Open pool device
+{
+  char		*name;			// Device name
+  int		num_members;		// Number of members
+  brf_pool_member_t *members[BRF_POOL_MAX];
+					// Members
+  brf_pool_member_t *member;		// Member used for whole jobs or `NULL`
+  pappl_device_t *device;		// Open member device or `NULL`
+} brf_pool_dev_t;
+
+typedef struct brf_pool_run_s		// Run of pages on a member
+{
+  brf_pool_member_t *member;		// Member
+  const char	*name;			// Device name
+  pappl_job_t	*job;			// Job
+  const char	*buffer;		// First byte of the run
+  size_t	bytes;			// Bytes in run
+  int		first,			// First page, from 1
+		num_pages,		// Pages in run
+		pages;			// Pages accepted by the device
+  ssize_t	ret;			// Bytes sent or -1 on error
+} brf_pool_run_t;
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t	brf_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for member state
+static cups_array_t	*brf_pool_members = NULL;
+					// Members of all pools, by URI
+static pappl_system_t	*brf_pool_system = NULL;
+					// System for logging
+
+
+//
+// Local functions...
+//
+
+static void	brf_pool_close_cb(pappl_device_t *device);
+static int	brf_pool_compare(brf_pool_member_t *a, brf_pool_member_t *b, void *data);
+static void	brf_pool_error_cb(const char *message, void *err_data);
+static ssize_t	brf_pool_document(pappl_device_t *device, pappl_job_t *job, const char *device_uri, int fd, const char *index, int *debug_fd, int *pages);
+static char	*brf_pool_id_cb(pappl_device_t *device, char *buffer, size_t bufsize);
+static brf_pool_member_t *brf_pool_member(const char *uri);
+static bool	brf_pool_open(brf_pool_dev_t *dev);
+static bool	brf_pool_open_cb(pappl_device_t *device, const char *device_uri, const char *name);
+static int	brf_pool_parse(const char *device_uri, brf_pool_member_t **members);
+static ssize_t	brf_pool_read_cb(pappl_device_t *device, void *buffer, size_t bytes);
+static void	*brf_pool_run(brf_pool_run_t *run);
+static pappl_preason_t brf_pool_status_cb(pappl_device_t *device);
+static void	brf_pool_update(brf_pool_member_t *member, int pages, double seconds);
+static ssize_t	brf_pool_write_cb(pappl_device_t *device, const void *buffer, size_t bytes);
+
+
+//
+// 'brf_pool_copy()' - Copy a file or pipe to a device, splitting it over the
+//                     members of a pool.
+//
+// Devices that are not pools get brf_device_copy().  "index" is the page
+// index of the file or `NULL`.  If "pages" is not `NULL`, it is set to the
+// number of pages from the start of the document that were embossed, also
+// when the copy fails.  When the document is sent once per copy, "pages"
+// is only set for a failure in the first one and the debug copy only gets
+// the first one.
+//
+
+ssize_t					// O  - Bytes copied per copy or -1 on error
+brf_pool_copy(
+    pappl_device_t *device,		// I  - Output device
+    pappl_job_t    *job,		// I  - Job
+    const char     *device_uri,		// I  - Device URI of the printer
+    int            fd,			// I  - Input file descriptor
+    const char     *index,		// I  - Page index or `NULL`
+    int            *debug_fd,		// IO - Debug copy file descriptor or `NULL`
+    int            *pages)		// O  - Pages sent or `NULL`
+{
+  int		copies,			// Number of times to send the document
+		copy,			// Current copy
+		tempfd = -1;		// Spool file
+  char		tempname[1024],		// Spool filename
+		buffer[65536];		// Copy buffer
+  struct stat	fileinfo;		// Input file information
+  ssize_t	bytes,			// Bytes read
+		ret = 0;		// Return value
+
+
+  if ((copies = brf_encode_copies(job)) < 2)
+    return (brf_pool_document(device, job, device_uri, fd, index, debug_fd, pages));
+
+  if (pages)
+    *pages = 0;
+
+  if (fstat(fd, &fileinfo) || !S_ISREG(fileinfo.st_mode) || lseek(fd, 0, SEEK_CUR) != 0)
+  {
+    // Spool the document so that it can be read again...
+    if ((tempfd = cupsTempFd(tempname, sizeof(tempname))) < 0)
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to create spool file for copies: %s", strerror(errno));
+      return (-1);
+    }
+
+    unlink(tempname);
+
+    while ((bytes = read(fd, buffer, sizeof(buffer))) != 0)
+    {
+      if (bytes < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+        ret = -1;
+        break;
+      }
+
+      if (write(tempfd, buffer, (size_t)bytes) != bytes)
+      {
+        ret = -1;
+        break;
+      }
+    }
+
+    if (ret < 0)
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to spool document for copies: %s", strerror(errno));
+      close(tempfd);
+      return (-1);
+    }
+
+    fd = tempfd;
+  }
+
+  papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Sending the document %d times for %d copies.", copies, copies);
+
+  for (copy = 0; copy < copies && ret >= 0 && !papplJobIsCanceled(job); copy ++)
+  {
+    if (lseek(fd, 0, SEEK_SET) != 0)
+      ret = -1;
+    else
+      ret = brf_pool_document(device, job, device_uri, fd, index, copy ? NULL : debug_fd, copy ? NULL : pages);
+  }
+
+  if (tempfd >= 0)
+    close(tempfd);
+
+  return (ret);
+}
+
+
+//
+// 'brf_pool_ppm()' - Get the pages per minute of a device.
+//
+// Pools have the sum of their members, other devices their own measured
+// speed.  Devices that have not printed yet count with 60 pages per minute.
+//
+
+int					// O - Pages per minute
+brf_pool_ppm(const char *device_uri)	// I - Device URI
+{
+  brf_pool_member_t *members[BRF_POOL_MAX];
+					// Members of pool
+  brf_pool_member_t *member;		// Device itself
+  int		i,			// Looping var
+		num_members;		// Number of members
+  double	ppm = 0.0;		// Pages per minute
+
+
+  if (!device_uri)
+    return (BRF_POOL_PPM);
+
+  if (!strncmp(device_uri, "pool:", 5))
+  {
+    num_members = brf_pool_parse(device_uri, members);
+  }
+  else if ((member = brf_pool_member(device_uri)) != NULL)
+  {
+    members[0]  = member;
+    num_members = 1;
+  }
+  else
+    num_members = 0;
+
+  pthread_mutex_lock(&brf_pool_mutex);
+  for (i = 0; i < num_members; i ++)
+    ppm += members[i]->ppm > 0.0 ? members[i]->ppm : BRF_POOL_PPM;
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  return (ppm >= 1.0 ? (int)(ppm + 0.5) : BRF_POOL_PPM);
+}
+
+
+//
+// 'brf_pool_start()' - Add the "pool" device scheme.
+//
+
+void
+brf_pool_start(pappl_system_t *system)	// I - System
+{
+  brf_pool_system = system;
+
+  papplDeviceAddScheme("pool", PAPPL_DEVTYPE_CUSTOM_LOCAL, NULL, brf_pool_open_cb, brf_pool_close_cb, brf_pool_read_cb, brf_pool_write_cb, brf_pool_status_cb, brf_pool_id_cb);
+}
+
+
+//
+// 'brf_pool_uri()' - Make the device URI of a pool.
+//
+
+char *					// O - Device URI or `NULL` if too long
+brf_pool_uri(
+    const char *name,			// I - Pool name
+    int        num_members,		// I - Number of members
+    const char **members,		// I - Member device URIs
+    char       *uri,			// I - URI buffer
+    size_t     urisize)			// I - Size of URI buffer
+{
+  char		*ptr = uri,		// Pointer into URI
+		*end = uri + urisize - 4;
+					// End of URI, room for an escape
+  const char	*src;			// Pointer into string
+  int		i;			// Looping var
+
+
+  if (urisize < 16 || num_members < 1 || num_members > BRF_POOL_MAX)
+    return (NULL);
+
+  papplCopyString(uri, "pool:///", urisize);
+  ptr += strlen(uri);
+
+  for (i = -1; i < num_members && ptr < end; i ++)
+  {
+    if (i >= 0)
+      *ptr++ = i ? '&' : '?';
+
+    for (src = i < 0 ? name : members[i]; *src && ptr < end; src ++)
+    {
+      if (isalnum(*src & 255) || strchr("-._~", *src))
+      {
+        *ptr++ = *src;
+      }
+      else
+      {
+        snprintf(ptr, 4, "%%%02X", *src & 255);
+        ptr += 3;
+      }
+    }
+  }
+
+  if (ptr >= end)
+    return (NULL);
+
+  *ptr = '\0';
+
+  return (uri);
+}
+
+
+//
+// 'brf_pool_close_cb()' - Close a pool device.
+//
+
+static void
+brf_pool_close_cb(
+    pappl_device_t *device)		// I - Device
+{
+  brf_pool_dev_t *dev = (brf_pool_dev_t *)papplDeviceGetData(device);
+					// Pool device
+
+
+  if (!dev)
+    return;
+
+  if (dev->device)
+  {
+    papplDeviceClose(dev->device);
+
+    pthread_mutex_lock(&brf_pool_mutex);
+    dev->member->busy --;
+    pthread_mutex_unlock(&brf_pool_mutex);
+  }
+
+  free(dev->name);
+  free(dev);
+
+  papplDeviceSetData(device, NULL);
+}
+
+
+//
+// 'brf_pool_compare()' - Compare two members by URI.
+//
+
+static int				// O - Result of comparison
+brf_pool_compare(brf_pool_member_t *a,	// I - First member
+                 brf_pool_member_t *b,	// I - Second member
+                 void              *data)// I - Callback data (unused)
+{
+  (void)data;
+
+  return (strcmp(a->uri, b->uri));
+}
+
+
+//
+// 'brf_pool_document()' - Copy a document to a device once.
+//
+
+static ssize_t				// O  - Bytes copied or -1 on error
+brf_pool_document(
+    pappl_device_t *device,		// I  - Output device
+    pappl_job_t    *job,		// I  - Job
+    const char     *device_uri,		// I  - Device URI of the printer
+    int            fd,			// I  - Input file descriptor
+    const char     *index,		// I  - Page index or `NULL`
+    int            *debug_fd,		// IO - Debug copy file descriptor or `NULL`
+    int            *pages)		// O  - Pages sent or `NULL`
+{
+  brf_pool_dev_t *dev;			// Pool device
+  brf_pool_run_t runs[BRF_POOL_MAX];	// Runs of pages
+  pthread_t	threads[BRF_POOL_MAX];	// Run threads
+  brf_pool_member_t *idle[BRF_POOL_MAX];// Idle members
+  double	speeds[BRF_POOL_MAX];	// Pages per minute of idle members
+  struct stat	fileinfo;		// Input file information
+  char		*map = MAP_FAILED;	// Mapped input file
+  size_t	*offsets = NULL;	// Page offsets
+  int		i,			// Looping var
+		num_idle = 0,		// Number of idle members
+		num_runs = 0,		// Number of runs
+		num_pages = 0,		// Pages in document
+		first = 0,		// First page of next run, from 0
+		count,			// Pages in run
+		done = 0;		// Pages embossed from the start
+  double	ppm,			// Pages per minute of a member
+		total_ppm = 0.0,	// Pages per minute of idle members
+		default_ppm = 0.0;	// Pages per minute of unmeasured members
+  int		num_measured = 0;	// Number of measured members
+  ssize_t	ret;			// Return value
+  double	start;			// Start time of single-member copy
+
+
+  if (strncmp(device_uri, "pool:", 5) || (dev = (brf_pool_dev_t *)papplDeviceGetData(device)) == NULL)
+    return (brf_device_copy(device, job, fd, debug_fd, pages));
+
+  // Find the idle members, only a big regular file is worth splitting.
+  // Members are identical, so those that have not been measured yet count
+  // with the average of the others...
+  pthread_mutex_lock(&brf_pool_mutex);
+
+  for (i = 0; i < dev->num_members; i ++)
+  {
+    if (dev->members[i]->ppm > 0.0)
+    {
+      default_ppm += dev->members[i]->ppm;
+      num_measured ++;
+    }
+  }
+
+  default_ppm = num_measured ? default_ppm / num_measured : BRF_POOL_PPM;
+
+  for (i = 0; i < dev->num_members; i ++)
+  {
+    if (dev->members[i]->busy == 0)
+    {
+      ppm = dev->members[i]->ppm > 0.0 ? dev->members[i]->ppm : default_ppm;
+
+      speeds[num_idle]  = ppm;
+      idle[num_idle ++] = dev->members[i];
+      total_ppm += ppm;
+    }
+  }
+
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  if (num_idle > 1 && !dev->device && !fstat(fd, &fileinfo) && S_ISREG(fileinfo.st_mode) && fileinfo.st_size > 0 && lseek(fd, 0, SEEK_CUR) == 0 && (map = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+    num_pages = brf_pages_offsets(map, (size_t)fileinfo.st_size, index, &offsets);
+
+  if (num_pages < 2 * BRF_POOL_MIN_PAGES)
+  {
+    // Print on a single member...
+    if (map != MAP_FAILED)
+      munmap(map, (size_t)fileinfo.st_size);
+    free(offsets);
+
+    if (!brf_pool_open(dev))
+    {
+      if (pages)
+        *pages = 0;
+      return (-1);
+    }
+
+    start = brf_stats_now();
+    ret   = brf_device_copy(device, job, fd, debug_fd, &done);
+
+    if (ret >= 0)
+      brf_pool_update(dev->member, done, brf_stats_now() - start);
+
+    if (pages)
+      *pages = done;
+
+    return (ret);
+  }
+
+  if (debug_fd && *debug_fd >= 0 && write(*debug_fd, map, (size_t)fileinfo.st_size) != (ssize_t)fileinfo.st_size)
+  {
+    close(*debug_fd);
+    *debug_fd = -1;
+  }
+
+  // Give every idle member a run of pages in proportion to its speed...
+  memset(runs, 0, sizeof(runs));
+
+  for (i = 0; i < num_idle && first < num_pages; i ++)
+  {
+    count = i == num_idle - 1 ? num_pages - first : (int)(num_pages * speeds[i] / total_ppm + 0.5);
+
+    if (count < BRF_POOL_MIN_PAGES)
+      count = BRF_POOL_MIN_PAGES;
+    if (count > num_pages - first)
+      count = num_pages - first;
+
+    runs[num_runs].member    = idle[i];
+    runs[num_runs].name      = dev->name;
+    runs[num_runs].job       = job;
+    runs[num_runs].buffer    = map + offsets[first];
+    runs[num_runs].bytes     = offsets[first + count] - offsets[first];
+    runs[num_runs].first     = first + 1;
+    runs[num_runs].num_pages = count;
+
+    pthread_mutex_lock(&brf_pool_mutex);
+    idle[i]->busy ++;
+    pthread_mutex_unlock(&brf_pool_mutex);
+
+    if (pthread_create(threads + num_runs, NULL, (void *(*)(void *))brf_pool_run, runs + num_runs))
+    {
+      pthread_mutex_lock(&brf_pool_mutex);
+      idle[i]->busy --;
+      pthread_mutex_unlock(&brf_pool_mutex);
+      break;
+    }
+
+    first += count;
+    num_runs ++;
+  }
+
+  papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Embossing %d pages on %d embossers of the pool.", num_pages, num_runs);
+
+  // Pages not given to a run (no more threads) are printed here...
+  if (first < num_pages || num_runs == 0)
+  {
+    runs[num_runs].member    = NULL;
+    runs[num_runs].ret       = brf_pool_open(dev) ? brf_device_send(device, job, map + offsets[first], offsets[num_pages] - offsets[first], &runs[num_runs].pages) : -1;
+    runs[num_runs].first     = first + 1;
+    runs[num_runs].num_pages = num_pages - first;
+  }
+
+  for (i = 0; i < num_runs; i ++)
+    pthread_join(threads[i], NULL);
+
+  if (first < num_pages || num_runs == 0)
+    num_runs ++;
+
+  // Pages count from the start of the document up to the first failed run...
+  for (i = 0, ret = 0; i < num_runs; i ++)
+  {
+    if (ret >= 0)
+      done += runs[i].pages;
+
+    if (runs[i].ret < 0)
+    {
+      if (ret >= 0)
+        papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Pages %d to %d did not finish embossing.", runs[i].first, runs[i].first + runs[i].num_pages - 1);
+      ret = -1;
+    }
+  }
+
+  if (ret == 0)
+    ret = (ssize_t)fileinfo.st_size;
+
+  munmap(map, (size_t)fileinfo.st_size);
+  free(offsets);
+
+  if (pages)
+    *pages = done;
+
+  return (ret);
+}
+
+
+//
+// 'brf_pool_error_cb()' - Log a member device error.
+//
+
+static void
+brf_pool_error_cb(
+    const char *message,		// I - Error message
+    void       *err_data)		// I - Member
+{
+  papplLog(brf_pool_system, PAPPL_LOGLEVEL_ERROR, "Pool member '%s': %s", ((brf_pool_member_t *)err_data)->uri, message);
+}
+
+
+//
+// 'brf_pool_id_cb()' - Get the IEEE-1284 device ID of a pool device.
+//
+// Members are identical, so the ID is the one of the member that is open.
+//
+
+static char *				// O - Device ID or `NULL` if none
+brf_pool_id_cb(pappl_device_t *device,	// I - Device
+               char           *buffer,	// I - Buffer
+               size_t         bufsize)	// I - Size of buffer
+{
+  brf_pool_dev_t *dev = (brf_pool_dev_t *)papplDeviceGetData(device);
+					// Pool device
+
+
+  return (dev && dev->device ? papplDeviceGetID(dev->device, buffer, bufsize) : NULL);
+}
+
+
+//
+// 'brf_pool_member()' - Find or add a member.
+//
+
+static brf_pool_member_t *		// O - Member or `NULL` on error
+brf_pool_member(const char *uri)	// I - Device URI
+{
+  brf_pool_member_t	key,		// Search key
+			*member;	// Member
+
+
+  key.uri = (char *)uri;
+
+  pthread_mutex_lock(&brf_pool_mutex);
+
+  if (!brf_pool_members)
+    brf_pool_members = cupsArrayNew((cups_array_func_t)brf_pool_compare, NULL);
+
+  if ((member = (brf_pool_member_t *)cupsArrayFind(brf_pool_members, &key)) == NULL && (member = calloc(1, sizeof(brf_pool_member_t))) != NULL)
+  {
+    if ((member->uri = strdup(uri)) != NULL)
+    {
+      cupsArrayAdd(brf_pool_members, member);
+    }
+    else
+    {
+      free(member);
+      member = NULL;
+    }
+  }
+
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  return (member);
+}
+
+
+//
+// 'brf_pool_open()' - Open the best member for a whole job.
+//
+// The least busy member wins, then the fastest one.  Members that cannot be
+// opened are skipped.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_pool_open(brf_pool_dev_t *dev)	// I - Pool device
+{
+  bool		tried[BRF_POOL_MAX];	// Members tried
+  brf_pool_member_t *best;		// Best member
+  int		i,			// Looping var
+		best_i;			// Index of best member
+
+
+  if (dev->device)
+    return (true);
+
+  memset(tried, 0, sizeof(tried));
+
+  for (;;)
+  {
+    pthread_mutex_lock(&brf_pool_mutex);
+
+    for (i = 0, best = NULL, best_i = -1; i < dev->num_members; i ++)
+    {
+      if (tried[i])
+        continue;
+
+      if (!best || dev->members[i]->busy < best->busy || (dev->members[i]->busy == best->busy && dev->members[i]->ppm > best->ppm))
+      {
+        best   = dev->members[i];
+        best_i = i;
+      }
+    }
+
+    if (best)
+      best->busy ++;
+
+    pthread_mutex_unlock(&brf_pool_mutex);
+
+    if (!best)
+      return (false);
+
+    tried[best_i] = true;
+
+    if ((dev->device = papplDeviceOpen(best->uri, dev->name, brf_pool_error_cb, best)) != NULL)
+    {
+      dev->member = best;
+      return (true);
+    }
+
+    pthread_mutex_lock(&brf_pool_mutex);
+    best->busy --;
+    pthread_mutex_unlock(&brf_pool_mutex);
+  }
+}
+
+
+//
+// 'brf_pool_open_cb()' - Open a pool device.
+//
+// Members are opened when there is something to print.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_pool_open_cb(
+    pappl_device_t *device,		// I - Device
+    const char     *device_uri,		// I - Device URI
+    const char     *name)		// I - Job name
+{
+  brf_pool_dev_t *dev;			// Pool device
+
+
+  if ((dev = calloc(1, sizeof(brf_pool_dev_t))) == NULL)
+  {
+    papplDeviceError(device, "Unable to allocate memory for pool device: %s", strerror(errno));
+    return (false);
+  }
+
+  if ((dev->num_members = brf_pool_parse(device_uri, dev->members)) == 0)
+  {
+    papplDeviceError(device, "No embossers in pool '%s'.", device_uri);
+    free(dev);
+    return (false);
+  }
+
+  dev->name = strdup(name ? name : "pool");
+
+  papplDeviceSetData(device, dev);
+
+  return (true);
+}
+
+
+//
+// 'brf_pool_parse()' - Get the members of a pool device URI.
+//
+
+static int				// O - Number of members
+brf_pool_parse(
+    const char        *device_uri,	// I - Device URI
+    brf_pool_member_t **members)	// O - Members
+{
+  const char	*src;			// Pointer into URI
+  char		uri[1024],		// Member URI
+		*ptr,			// Pointer into member URI
+		*end = uri + sizeof(uri) - 1;
+					// End of member URI
+  int		num_members = 0;	// Number of members
+
+
+  if ((src = strchr(device_uri, '?')) == NULL)
+    return (0);
+
+  while (*src && num_members < BRF_POOL_MAX)
+  {
+    for (src ++, ptr = uri; *src && *src != '&' && ptr < end; src ++)
+    {
+      if (*src == '%' && isxdigit(src[1] & 255) && isxdigit(src[2] & 255))
+      {
+        *ptr++ = (char)((isdigit(src[1] & 255) ? src[1] - '0' : (tolower(src[1]) - 'a' + 10)) << 4 | (isdigit(src[2] & 255) ? src[2] - '0' : (tolower(src[2]) - 'a' + 10)));
+        src += 2;
+      }
+      else
+        *ptr++ = *src;
+    }
+
+    *ptr = '\0';
+
+    while (*src && *src != '&')
+      src ++;
+
+    if (uri[0] && (members[num_members] = brf_pool_member(uri)) != NULL)
+      num_members ++;
+  }
+
+  return (num_members);
+}
+
+
+//
+// 'brf_pool_read_cb()' - Read from the open member.
+//
+
+static ssize_t				// O - Bytes read or -1 on error
+brf_pool_read_cb(pappl_device_t *device,// I - Device
+                 void           *buffer,// I - Buffer
+                 size_t         bytes)	// I - Size of buffer
+{
+  brf_pool_dev_t *dev = (brf_pool_dev_t *)papplDeviceGetData(device);
+					// Pool device
+
+
+  return (dev && dev->device ? papplDeviceRead(dev->device, buffer, bytes) : -1);
+}
+
+
+//
+// 'brf_pool_run()' - Emboss a run of pages on a member.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_pool_run(brf_pool_run_t *run)	// I - Run of pages
+{
+  pappl_device_t *device;		// Member device
+  double	start = brf_stats_now();// Start time
+
+
+  if ((device = papplDeviceOpen(run->member->uri, run->name, brf_pool_error_cb, run->member)) == NULL)
+  {
+    run->ret = -1;
+  }
+  else
+  {
+    papplLogJob(run->job, PAPPL_LOGLEVEL_DEBUG, "Embossing pages %d to %d on '%s'.", run->first, run->first + run->num_pages - 1, run->member->uri);
+
+    if ((run->ret = brf_device_send(device, run->job, run->buffer, run->bytes, &run->pages)) >= 0)
+      papplDeviceFlush(device);
+
+    papplDeviceClose(device);
+
+    if (run->ret >= 0)
+      brf_pool_update(run->member, run->pages, brf_stats_now() - start);
+  }
+
+  pthread_mutex_lock(&brf_pool_mutex);
+  run->member->busy --;
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  return (NULL);
+}
+
+
+//
+// 'brf_pool_status_cb()' - Get the status of the open member.
+//
+
+static pappl_preason_t			// O - Status reasons
+brf_pool_status_cb(
+    pappl_device_t *device)		// I - Device
+{
+  brf_pool_dev_t *dev = (brf_pool_dev_t *)papplDeviceGetData(device);
+					// Pool device
+
+
+  return (dev && dev->device ? papplDeviceGetStatus(dev->device) : PAPPL_PREASON_NONE);
+}
+
+
+//
+// 'brf_pool_update()' - Update the measured speed of a member.
+//
+// Short prints mostly measure the device buffers, so only prints of a few
+// pages and seconds count.
+//
+
+static void
+brf_pool_update(
+    brf_pool_member_t *member,		// I - Member
+    int               pages,		// I - Pages embossed
+    double            seconds)		// I - Time taken
+{
+  double	ppm;			// Pages per minute of this print
+
+
+  if (pages < BRF_POOL_MIN_PAGES || seconds < 1.0)
+    return;
+
+  ppm = pages * 60.0 / seconds;
+
+  pthread_mutex_lock(&brf_pool_mutex);
+  member->ppm = member->ppm > 0.0 ? 0.7 * member->ppm + 0.3 * ppm : ppm;
+  pthread_mutex_unlock(&brf_pool_mutex);
+}
+
+
+//
+// 'brf_pool_write_cb()' - Write to the best member.
+//
+
+static ssize_t				// O - Bytes written or -1 on error
+brf_pool_write_cb(
+    pappl_device_t *device,		// I - Device
+    const void     *buffer,		// I - Data
+    size_t         bytes)		// I - Number of bytes
+{
+  brf_pool_dev_t *dev = (brf_pool_dev_t *)papplDeviceGetData(device);
+					// Pool device
+
+
+  if (!dev || !brf_pool_open(dev))
+    return (-1);
+
+  return (papplDeviceWrite(dev->device, buffer, bytes));
+}
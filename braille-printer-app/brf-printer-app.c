@@ -2,12 +2,12 @@
 
 //
 // Include necessary headers...
+#include "brf-printer-app.h"
 #include <strings.h>
-#include <cupsfilters/log.h>
-#include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
 #include <limits.h>
-#include <pappl/pappl.h>
+#include <stdarg.h>
+#include <pthread.h>
 
 
 
@@ -16,18 +16,112 @@
 #  define brf_TESTPAGE_MIMETYPE	"application/vnd.cups-paged-brf"
 
 
-extern bool	brf_gen(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
 extern char* strdup(const char*);
+
+// Items to configure the properties of this Printer Application
+// These items do not change while the Printer Application is running
+typedef struct brf_printer_app_config_s
+{
+  // Identification of the Printer Application
+  const char        *system_name;        // Name of the system
+  const char        *system_package_name;// Name of Printer Application
+                                         // package/executable
+  const char        *version;            // Program version number string
+  unsigned short    numeric_version[4];  // Numeric program version
+  const char        *web_if_footer;      // HTML Footer for web interface
+  
+  pappl_pr_autoadd_cb_t autoadd_cb;
+
+  
+  pappl_pr_identify_cb_t identify_cb;
+
+
+  pappl_pr_testpage_cb_t testpage_cb;
+
+
+  cups_array_t      *spooling_conversions;
+
+  
+  cups_array_t      *stream_formats;
+  const char        *backends_ignore;
+
+  const char        *backends_only;
+
+  void              *testpage_data;
+
+} pr_printer_app_config_t;
+
+typedef struct brf_printer_app_global_data_s
+{
+  pr_printer_app_config_t *config;
+  pappl_system_t          *system;
+  int                     num_drivers;     // Number of drivers (from the PPDs)
+  pappl_pr_driver_t       *drivers;        // Driver index (for menu and
+                                           // auto-add)
+   char              spool_dir[1024];     // Spool directory, customizable via
+                                         // SPOOL_DIR environment variable                                         
+
+} brf_printer_app_global_data_t;
+
+typedef struct brf_autoadd_s		// Devices found for auto-adding
+{
+  pappl_system_t	*system;	// System
+  bool			pools;		// Pool identical embossers?
+  int			num_devices;	// Number of devices
+  struct
+  {
+    char		name[128],	// Printer name
+			driver_name[64],// Driver name
+			device_id[1024],// IEEE-1284 device ID
+			device_uri[1024];
+					// Device URI
+    bool		added;		// Printer created?
+  }			devices[64];	// Devices
+} brf_autoadd_t;
+
+typedef struct brf_model_s		// Known embosser model
+{
+  const char		*driver_name;	// Driver name
+  const char		*device_id;	// IEEE-1284 device ID match string
+} brf_model_t;
+
+typedef struct brf_match_s		// Device ID match keys of a driver
+{
+  const char		*driver_name;	// Driver name
+  int			num_keys;	// Number of key/value pairs
+  cups_option_t		*keys;		// Key/value pairs
+} brf_match_t;
+
+typedef struct brf_prefilter_s		// Filters before the backend of a job
+{
+  int			inputfd,	// Job data
+			outputfd;	// Pipe to the backend
+  cf_filter_data_t	*data;		// Job and printer data
+  cups_array_t		*chain;		// Filters
+  int			status;		// Exit status of the chain
+} brf_prefilter_t;
+
+
 //
 // Local functions...
 //
 static bool BRFTestFilterCB(pappl_job_t *job,  pappl_device_t *device,void *cbdata) ; 
 static int brf_print_filter_function(int inputfd,int outputfd, int inputseekable,cf_filter_data_t *data, void *parameters); 
+static int	brf_job_is_canceled(void *data);
+static void	brf_job_log(void *data, cf_loglevel_t level, const char *message, ...);
+static void	*brf_job_prefilter(brf_prefilter_t *prefilter);
+static void	add_printer(pappl_system_t *system, const char *name, const char *driver_name, const char *device_id, const char *device_uri);
+static void	add_printers(brf_autoadd_t *autoadd);
 static const char *autoadd_cb(const char *device_info, const char *device_uri, const char *device_id, void *cbdata);
+static void	*autoadd_run(brf_autoadd_t *autoadd);
 static bool	driver_cb(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
-static int	match_id(int num_did, cups_option_t *did, const char *match_id);
+static bool	load_devices(brf_autoadd_t *autoadd, const char *filename);
+static int	match_id(int num_did, cups_option_t *did, brf_match_t *match);
+static void	match_init(void);
 static const char *mime_cb(const unsigned char *header, size_t headersize, void *data);
-static bool	printer_cb(const char *device_info, const char *device_uri, const char *device_id, pappl_system_t *system);
+static int	pool_uri_cb(const char *base_name, int num_options, cups_option_t *options, int num_files, char **files, void *data);
+static bool	printer_cb(const char *device_info, const char *device_uri, const char *device_id, brf_autoadd_t *autoadd);
+static void	save_devices(brf_autoadd_t *autoadd, const char *filename);
 static pappl_system_t *system_cb(int num_options, cups_option_t *options, void *data);
 
 
@@ -38,11 +132,42 @@ static pappl_system_t *system_cb(int num_options, cups_option_t *options, void *
 static pappl_pr_driver_t	brf_drivers[] =
 {					// Driver list
 { "gen_brf",  "Generic",
-  NULL, NULL },
+  "CMD:BRF;", NULL },
+{ "index_v3_brf", "Index Braille V3",
+  "MFG:Index Braille;MDL:Everest-D V3;", NULL },
+{ "index_v4_brf", "Index Braille V4",
+  "MFG:Index Braille;MDL:Everest-D V4;", NULL },
 
 };
+static const brf_model_t	brf_models[] =
+{					// Other models, matched before the drivers
+  { "index_v3_brf", "MFG:Index Braille;MDL:Basic-D V3;" },
+  { "index_v3_brf", "MFG:Index Braille;MDL:Basic-S V3;" },
+  { "index_v3_brf", "MFG:Index Braille;MDL:4-Waves PRO;" },
+  { "index_v3_brf", "MFG:Index Braille;MDL:4x4 PRO V3;" },
+  { "index_v4_brf", "MFG:Index Braille;MDL:Basic-D V4;" },
+  { "index_v4_brf", "MFG:Index Braille;MDL:Basic-S V4;" },
+  { "index_v4_brf", "MFG:Index Braille;MDL:Braille Box V4;" },
+  { "index_v4_brf", "MFG:Index Braille;MDL:Basic-D V5;" },
+  { "index_v4_brf", "MFG:Index Braille;MDL:Everest-D V5;" },
+  { "index_v4_brf", "MFG:Index Braille;MDL:Braille Box V5;" },
+  { "index_v4_brf", "MFG:Index Braille;" }
+					// Newer Index models have V4 firmware
+};
+static brf_match_t		brf_matches[sizeof(brf_models) / sizeof(brf_models[0]) + sizeof(brf_drivers) / sizeof(brf_drivers[0])];
+					// Parsed device IDs
+static int			brf_num_matches = 0;
+					// Number of parsed device IDs
+static pthread_once_t		brf_matches_once = PTHREAD_ONCE_INIT;
+					// Parse driver device IDs once
 static char			brf_statefile[1024];
 					// State file
+static brf_printer_app_global_data_t brf_global_data;
+					// Global data
+static cf_filter_external_t brf_texttobrf_params =
+{					// Parameters for the texttobrf filter
+  .filter = CUPS_SERVERBIN "/filter/texttobrf"
+};
 
 
 //
@@ -53,18 +178,124 @@ int					// O - Exit status
 main(int  argc,				// I - Number of command-line arguments
      char *argv[])			// I - Command-line arguments
 {
+  int	status;				// Exit status of helper or worker
+
+
+  // Filter helper supervisor started by brf_helper_start()?
+  if ((status = brf_helper_main()) >= 0)
+    return (status);
+
+  // Translation process started by a liblouis job?
+  if ((status = brf_louis_main()) >= 0)
+    return (status);
+
   return (papplMainloop(argc, argv,
                         "1.0",
                         NULL,
                         (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])),
                         brf_drivers, autoadd_cb, driver_cb,
-                        /*subcmd_name*/NULL, /*subcmd_cb*/NULL,
+                        "pool-uri", pool_uri_cb,
                         system_cb,
                         /*usage_cb*/NULL,
                         /*data*/NULL));
 }
 
 
+//
+// 'add_printer()' - Add a printer, numbering the name if it is taken.
+//
+
+static void
+add_printer(pappl_system_t *system,	// I - System
+            const char     *name,	// I - Printer name
+            const char     *driver_name,// I - Driver name
+            const char     *device_id,	// I - IEEE-1284 device ID
+            const char     *device_uri)	// I - Device URI
+{
+  if (!papplPrinterCreate(system, 0, name, driver_name, device_id, device_uri))
+  {
+    // Printer already exists with this name, so try adding a number to the
+    // name...
+    int		i;			// Looping var
+    char	newname[128],		// New name
+		number[4];		// Number string
+    size_t	namelen = strlen(name),	// Length of original name string
+		numberlen;		// Length of number string
+
+    for (i = 2; i < 100; i ++)
+    {
+      // Append " NNN" to the name, truncating the existing name as needed to
+      // include the number at the end...
+      snprintf(number, sizeof(number), " %d", i);
+      numberlen = strlen(number);
+
+      papplCopyString(newname, name, sizeof(newname));
+      if ((namelen + numberlen) < sizeof(newname))
+        memcpy(newname + namelen, number, numberlen + 1);
+      else
+        memcpy(newname + sizeof(newname) - numberlen - 1, number, numberlen + 1);
+
+      // Try creating with this name...
+      if (papplPrinterCreate(system, 0, newname, driver_name, device_id, device_uri))
+        break;
+    }
+  }
+}
+
+
+//
+// 'add_printers()' - Auto-add the devices that were found.
+//
+// Identical embossers, with the same name and driver, become one printer
+// with a pool of devices unless pooling is off.
+//
+
+static void
+add_printers(brf_autoadd_t *autoadd)	// I - Devices found
+{
+  int		i, j,			// Looping vars
+		num_members,		// Number of pool members
+		member_devs[16];	// Devices of pool members
+  const char	*members[16];		// Pool member device URIs
+  char		pool_uri[1024];		// Pool device URI
+
+
+  for (i = 0; i < autoadd->num_devices; i ++)
+  {
+    if (autoadd->devices[i].added)
+      continue;
+
+    members[0]     = autoadd->devices[i].device_uri;
+    member_devs[0] = i;
+    num_members    = 1;
+
+    for (j = i + 1; autoadd->pools && j < autoadd->num_devices && num_members < (int)(sizeof(members) / sizeof(members[0])); j ++)
+    {
+      if (!autoadd->devices[j].added && !strcmp(autoadd->devices[i].name, autoadd->devices[j].name) && !strcmp(autoadd->devices[i].driver_name, autoadd->devices[j].driver_name))
+      {
+        members[num_members]       = autoadd->devices[j].device_uri;
+        member_devs[num_members ++] = j;
+        autoadd->devices[j].added  = true;
+      }
+    }
+
+    autoadd->devices[i].added = true;
+
+    if (num_members > 1 && brf_pool_uri(autoadd->devices[i].name, num_members, members, pool_uri, sizeof(pool_uri)))
+    {
+      papplLog(autoadd->system, PAPPL_LOGLEVEL_INFO, "Adding %d '%s' embossers as one printer.", num_members, autoadd->devices[i].name);
+      add_printer(autoadd->system, autoadd->devices[i].name, autoadd->devices[i].driver_name, autoadd->devices[i].device_id, pool_uri);
+    }
+    else
+    {
+      // No pool, or the URIs are too long for one...
+      for (j = 0; j < num_members; j ++)
+        add_printer(autoadd->system, autoadd->devices[i].name, autoadd->devices[i].driver_name, autoadd->devices[member_devs[j]].device_id, members[j]);
+    }
+  }
+}
+
+
 //
 // 'autoadd_cb()' - Determine the proper driver for a given printer.
 //
@@ -80,37 +311,38 @@ autoadd_cb(const char *device_info,	// I - Device information/name (not used)
 	    	best_score = 0,		// Best score
 		num_did;		// Number of device ID key/value pairs
   cups_option_t	*did;			// Device ID key/value pairs
-  const char	*make,			// Manufacturer name
+  const char	*value,			// Device ID value
 		*best_name = NULL;	// Best driver
- 
 
 
   (void)device_info;
+  (void)device_uri;
+  (void)cbdata;
 
-  // First parse the device ID and get any potential driver name to match...
-  num_did = papplDeviceParseID(device_id, &did);
+  // The driver device IDs only need to be parsed once...
+  pthread_once(&brf_matches_once, match_init);
 
-  if ((make = cupsGetOption("MANUFACTURER", num_did, did)) == NULL)
-    if ((make = cupsGetOption("MANU", num_did, did)) == NULL)
-      make = cupsGetOption("MFG", num_did, did);
+  // First parse the device ID, the match strings use the short keys...
+  if ((num_did = papplDeviceParseID(device_id, &did)) == 0)
+    return (NULL);
 
-  
-  // // Then loop through the driver list to find the best match...
-  // for (i = 0; i < (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])); i ++)
-  {
- 
+  if (!cupsGetOption("MFG", num_did, did) && (value = cupsGetOption("MANUFACTURER", num_did, did)) != NULL)
+    num_did = cupsAddOption("MFG", value, num_did, &did);
+  if (!cupsGetOption("MDL", num_did, did) && (value = cupsGetOption("MODEL", num_did, did)) != NULL)
+    num_did = cupsAddOption("MDL", value, num_did, &did);
+  if (!cupsGetOption("CMD", num_did, did) && (value = cupsGetOption("COMMAND SET", num_did, did)) != NULL)
+    num_did = cupsAddOption("CMD", value, num_did, &did);
 
-    if (brf_drivers[i].device_id)
+  // Then find the best match, the first one wins a tie...
+  for (i = 0; i < brf_num_matches; i ++)
+  {
+    score = match_id(num_did, did, brf_matches + i);
+    if (score > best_score)
     {
-      // See if we have a matching device ID...
-      score = match_id(num_did, did, brf_drivers[i].device_id);
-      if (score > best_score)
-      {
-        best_score = score;
-        best_name  = brf_drivers[i].name;
-      }
+      best_score = score;
+      best_name  = brf_matches[i].driver_name;
     }
-   }
+  }
 
   // Clean up and return...
   cupsFreeOptions(num_did, did);
@@ -119,9 +351,110 @@ autoadd_cb(const char *device_info,	// I - Device information/name (not used)
 }
 
 
+//
+// 'autoadd_run()' - Find and add printers in the background.
+//
+// The devices found are saved next to the state file, and later starts
+// without a state file add them again instead of scanning.  Delete the
+// file to scan again.
+//
+
+static void *				// O - Thread exit status (unused)
+autoadd_run(brf_autoadd_t *autoadd)	// I - Devices found
+{
+  char	filename[1100];			// Device file
+
+
+  snprintf(filename, sizeof(filename), "%s.devices", brf_statefile);
+
+  if (load_devices(autoadd, filename))
+  {
+    papplLog(autoadd->system, PAPPL_LOGLEVEL_INFO, "Auto-adding %d printer(s) found earlier, delete '%s' to scan again.", autoadd->num_devices, filename);
+  }
+  else
+  {
+    papplDeviceList(PAPPL_DEVTYPE_USB, (pappl_device_cb_t)printer_cb, autoadd, papplLogDevice, autoadd->system);
+
+    papplLog(autoadd->system, PAPPL_LOGLEVEL_INFO, "Auto-adding %d printer(s).", autoadd->num_devices);
+
+    if (autoadd->num_devices > 0)
+      save_devices(autoadd, filename);
+  }
+
+  add_printers(autoadd);
+  free(autoadd);
+
+  return (NULL);
+}
+
+
+//
+// 'load_devices()' - Load the devices found by an earlier scan.
+//
+// Each line holds the device URI, driver name, printer name and device ID,
+// separated by tabs.
+//
+
+static bool				// O - `true` if devices were loaded
+load_devices(brf_autoadd_t *autoadd,	// I - Devices found
+             const char    *filename)	// I - Device file
+{
+  cups_file_t	*fp;			// Device file
+  char		line[4096],		// Line from file
+		*fields[4],		// Fields in line
+		*ptr;			// Pointer into line
+  int		i,			// Looping var
+		num_fields;		// Number of fields
+  const char	*driver_name;		// Driver name
+
+
+  if ((fp = cupsFileOpen(filename, "r")) == NULL)
+    return (false);
+
+  while (cupsFileGets(fp, line, sizeof(line)) && autoadd->num_devices < (int)(sizeof(autoadd->devices) / sizeof(autoadd->devices[0])))
+  {
+    if (line[0] == '#' || !line[0])
+      continue;
+
+    for (num_fields = 1, fields[0] = ptr = line; num_fields < 4 && (ptr = strchr(ptr, '\t')) != NULL; num_fields ++)
+    {
+      *ptr++ = '\0';
+      fields[num_fields] = ptr;
+    }
+
+    if (num_fields < 4)
+      continue;
+
+    // Only add devices for drivers that still exist...
+    for (i = 0, driver_name = NULL; i < (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])); i ++)
+    {
+      if (!strcmp(fields[1], brf_drivers[i].name))
+      {
+        driver_name = brf_drivers[i].name;
+        break;
+      }
+    }
+
+    if (!driver_name)
+      continue;
+
+    i = autoadd->num_devices ++;
+
+    papplCopyString(autoadd->devices[i].device_uri, fields[0], sizeof(autoadd->devices[i].device_uri));
+    papplCopyString(autoadd->devices[i].driver_name, driver_name, sizeof(autoadd->devices[i].driver_name));
+    papplCopyString(autoadd->devices[i].name, fields[2], sizeof(autoadd->devices[i].name));
+    papplCopyString(autoadd->devices[i].device_id, fields[3], sizeof(autoadd->devices[i].device_id));
+    autoadd->devices[i].added = false;
+  }
+
+  cupsFileClose(fp);
+
+  return (autoadd->num_devices > 0);
+}
+
 
 //
-// 'match_id()' - Compare two IEEE-1284 device IDs and return a score.
+// 'match_id()' - Compare a device ID with a driver's match keys and return a score.
 //
 // The score is 2 for each exact match and 1 for a partial match in a comma-
 // delimited field.  Any non-match results in a score of 0.
@@ -130,23 +463,17 @@ autoadd_cb(const char *device_info,	// I - Device information/name (not used)
 static int				// O - Score
 match_id(int           num_did,		// I - Number of device ID key/value pairs
          cups_option_t *did,		// I - Device ID key/value pairs
-         const char    *match_id)	// I - Driver's device ID match string
+         brf_match_t   *match)		// I - Driver's device ID match keys
 {
   int		i,			// Looping var
-		score = 0,		// Score
-		num_mid;		// Number of match ID key/value pairs
-  cups_option_t	*mid,			// Match ID key/value pairs
-		*current;		// Current key/value pair
+		score = 0;		// Score
+  cups_option_t	*current;		// Current key/value pair
   const char	*value,			// Device ID value
 		*valptr;		// Pointer into value
 
 
-  // Parse the matching device ID into key/value pairs...
-  if ((num_mid = papplDeviceParseID(match_id, &mid)) == 0)
-    return (0);
-
   // Loop through the match pairs to find matches (or not)
-  for (i = num_mid, current = mid; i > 0; i --, current ++)
+  for (i = match->num_keys, current = match->keys; i > 0; i --, current ++)
   {
     if ((value = cupsGetOption(current->name, num_did, did)) == NULL)
     {
@@ -184,8 +511,46 @@ match_id(int           num_did,		// I - Number of device ID key/value pairs
       break;
     }
   }
+
+  return (score);
+}
+
+
+//
+// 'match_init()' - Parse the device IDs of the known models and drivers.
+//
+
+static void
+match_init(void)
+{
+  int		i;			// Looping var
+  brf_match_t	*match;			// Current match
+
+
+  for (i = 0; i < (int)(sizeof(brf_models) / sizeof(brf_models[0])); i ++)
+  {
+    match = brf_matches + brf_num_matches;
+
+    if ((match->num_keys = papplDeviceParseID(brf_models[i].device_id, &match->keys)) > 0)
+    {
+      match->driver_name = brf_models[i].driver_name;
+      brf_num_matches ++;
+    }
+  }
+
+  for (i = 0; i < (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])); i ++)
+  {
+    match = brf_matches + brf_num_matches;
+
+    if (brf_drivers[i].device_id && (match->num_keys = papplDeviceParseID(brf_drivers[i].device_id, &match->keys)) > 0)
+    {
+      match->driver_name = brf_drivers[i].name;
+      brf_num_matches ++;
+    }
+  }
 }
 
+
 //
 // 'driver_cb()' - Main driver callback.
 //
@@ -213,8 +578,8 @@ driver_cb(
     }
   }
 
-  // Pages per minute 
-  data->ppm = 60;
+  // Pages per minute, measured or 60 per embosser...
+  data->ppm = brf_pool_ppm(device_uri);
 
  
   // Color values...
@@ -238,7 +603,7 @@ driver_cb(
  // data->testpage_cb = lprintTestPageCB;
 
   // Use the corresponding sub-driver callback to set things up...
-  if (!strncmp(driver_name, "gen_", 4))
+  if (!strncmp(driver_name, "gen_", 4) || !strncmp(driver_name, "index_", 6))
     return (brf_gen(system, driver_name, device_uri, device_id, data, attrs, cbdata));
  
   else
@@ -248,75 +613,136 @@ driver_cb(
 //
 // 'mime_cb()' - MIME typing callback...
 //
+// Ready BRF is typed as the driver format, so it goes straight to the
+// printer's print file callback without a filter chain.
+//
 
 static const char *			// O - MIME media type or `NULL` if none
 mime_cb(const unsigned char *header,	// I - Header data
         size_t              headersize,	// I - Size of header data
         void                *cbdata)	// I - Callback data (not used)
 {
-  
-    return (brf_TESTPAGE_MIMETYPE);
-  
-  
+  (void)cbdata;
+
+  return (brf_mime_type(header, headersize));
+}
+
+
+//
+// 'pool_uri_cb()' - Print the device URI of a pool of embossers.
+//
+// "brf-printer-app pool-uri NAME DEVICE-URI DEVICE-URI ..." prints the URI
+// to give to "add -v" or "modify -v" for a printer with a pool of devices.
+//
+
+static int				// O - Exit status
+pool_uri_cb(
+    const char    *base_name,		// I - Base name of program
+    int           num_options,		// I - Number of options (unused)
+    cups_option_t *options,		// I - Options (unused)
+    int           num_files,		// I - Number of arguments
+    char          **files,		// I - Pool name and member device URIs
+    void          *data)		// I - Callback data (unused)
+{
+  char	uri[1024];			// Pool device URI
+
+
+  (void)num_options;
+  (void)options;
+  (void)data;
+
+  if (num_files < 3)
+  {
+    fprintf(stderr, "Usage: %s pool-uri NAME DEVICE-URI DEVICE-URI ...\n", base_name);
+    return (1);
+  }
+
+  if (!brf_pool_uri(files[0], num_files - 1, (const char **)files + 1, uri, sizeof(uri)))
+  {
+    fprintf(stderr, "%s: Too many or too long device URIs for a pool.\n", base_name);
+    return (1);
+  }
+
+  puts(uri);
+
+  return (0);
 }
 
 
 //
-// 'printer_cb()' - Try auto-adding printers.
+// 'printer_cb()' - Collect the devices to auto-add.
 //
 
 static bool				// O - `false` to continue
 printer_cb(const char     *device_info,	// I - Device information
 	   const char     *device_uri,	// I - Device URI
 	   const char     *device_id,	// I - IEEE-1284 device ID
-	   pappl_system_t *system)	// I - System
+	   brf_autoadd_t  *autoadd)	// I - Devices found
 {
-  const char *driver_name = autoadd_cb(device_info, device_uri, device_id, system);
+  const char *driver_name = autoadd_cb(device_info, device_uri, device_id, autoadd->system);
 					// Driver name, if any
 
-  if (driver_name)
+  if (driver_name && autoadd->num_devices < (int)(sizeof(autoadd->devices) / sizeof(autoadd->devices[0])))
   {
-    char	name[128],		// Printer name
-		*nameptr;		// Pointer in name
-    papplCopyString(name, device_info, sizeof(name));
+    char	*nameptr;		// Pointer in name
+    int		i = autoadd->num_devices ++;
+					// New device
 
-    if ((nameptr = strstr(name, " (")) != NULL)
-      *nameptr = '\0';
+    papplCopyString(autoadd->devices[i].name, device_info, sizeof(autoadd->devices[i].name));
 
-    if (!papplPrinterCreate(system, 0, name, driver_name, device_id, device_uri))
-    {
-      // Printer already exists with this name, so try adding a number to the
-      // name...
-      int	i;			// Looping var
-      char	newname[128],		// New name
-		number[4];		// Number string
-      size_t	namelen = strlen(name),	// Length of original name string
-		numberlen;		// Length of number string
+    if ((nameptr = strstr(autoadd->devices[i].name, " (")) != NULL)
+      *nameptr = '\0';
 
-      for (i = 2; i < 100; i ++)
-      {
-        // Append " NNN" to the name, truncating the existing name as needed to
-        // include the number at the end...
-        snprintf(number, sizeof(number), " %d", i);
-        numberlen = strlen(number);
-
-        papplCopyString(newname, name, sizeof(newname));
-        if ((namelen + numberlen) < sizeof(newname))
-          memcpy(newname + namelen, number, numberlen + 1);
-        else
-          memcpy(newname + sizeof(newname) - numberlen - 1, number, numberlen + 1);
-
-        // Try creating with this name...
-        if (papplPrinterCreate(system, 0, newname, driver_name, device_id, device_uri))
-          break;
-      }
-    }
+    papplCopyString(autoadd->devices[i].driver_name, driver_name, sizeof(autoadd->devices[i].driver_name));
+    papplCopyString(autoadd->devices[i].device_id, device_id ? device_id : "", sizeof(autoadd->devices[i].device_id));
+    papplCopyString(autoadd->devices[i].device_uri, device_uri, sizeof(autoadd->devices[i].device_uri));
+    autoadd->devices[i].added = false;
   }
 
   return (false);
 }
 
 
+//
+// 'save_devices()' - Save the devices found by a scan.
+//
+
+static void
+save_devices(brf_autoadd_t *autoadd,	// I - Devices found
+             const char    *filename)	// I - Device file
+{
+  cups_file_t	*fp;			// Device file
+  char		tempfile[1200];		// Temporary file
+  int		i;			// Looping var
+
+
+  snprintf(tempfile, sizeof(tempfile), "%s.tmp-%d", filename, (int)getpid());
+
+  if ((fp = cupsFileOpen(tempfile, "w")) == NULL)
+  {
+    papplLog(autoadd->system, PAPPL_LOGLEVEL_WARN, "Unable to save devices to '%s': %s", filename, strerror(errno));
+    return;
+  }
+
+  cupsFilePuts(fp, "# Printers found by brf, delete this file to scan again.\n");
+
+  for (i = 0; i < autoadd->num_devices; i ++)
+  {
+    // Tabs and line breaks would split the fields...
+    if (strpbrk(autoadd->devices[i].device_uri, "\t\r\n") || strpbrk(autoadd->devices[i].name, "\t\r\n") || strpbrk(autoadd->devices[i].device_id, "\t\r\n"))
+      continue;
+
+    cupsFilePrintf(fp, "%s\t%s\t%s\t%s\n", autoadd->devices[i].device_uri, autoadd->devices[i].driver_name, autoadd->devices[i].name, autoadd->devices[i].device_id);
+  }
+
+  if (cupsFileClose(fp) || rename(tempfile, filename))
+  {
+    papplLog(autoadd->system, PAPPL_LOGLEVEL_WARN, "Unable to save devices to '%s': %s", filename, strerror(errno));
+    unlink(tempfile);
+  }
+}
+
+
 //
 // 'system_cb()' - Setup the system object.
 //
@@ -331,9 +757,22 @@ system_cb(
   const char		*val,		// Current option value
 			*hostname,	// Hostname, if any
 			*logfile,	// Log file, if any
-			*system_name;	// System name, if any
+			*system_name,	// System name, if any
+			*convs_file;	// Conversions file
   pappl_loglevel_t	loglevel;	// Log level
-  int			port = 0;	// Port number, if any
+  int			port = 0,	// Port number, if any
+			render_threads = 0,
+					// Number of render worker threads
+			cache_size = 64,
+					// Translation cache size in MiB
+			filter_helpers = 0,
+					// Number of filter helper processes
+			filter_helper_jobs = 100;
+					// Jobs per filter helper
+  bool			pools = true;	// Pool identical embossers?
+  brf_autoadd_t		*autoadd;	// Devices found for auto-adding
+  pthread_t		tid;		// Auto-add thread
+  int			error;		// pthread_create() error
   pappl_soptions_t	soptions = PAPPL_SOPTIONS_MULTI_QUEUE | PAPPL_SOPTIONS_WEB_INTERFACE | PAPPL_SOPTIONS_WEB_LOG | PAPPL_SOPTIONS_WEB_SECURITY;
 					// System options
   static pappl_version_t versions[1] =	// Software versions
@@ -367,6 +806,9 @@ system_cb(
   hostname    = cupsGetOption("server-hostname", num_options, options);
   system_name = cupsGetOption("system-name", num_options, options);
 
+  if ((convs_file = cupsGetOption("conversions-file", num_options, options)) == NULL)
+    convs_file = CUPS_DATADIR "/mime/braille.convs";
+
   if ((val = cupsGetOption("server-port", num_options, options)) != NULL)
   {
     if (!isdigit(*val & 255))
@@ -378,14 +820,97 @@ system_cb(
       port = atoi(val);
   }
 
-  // State file...
-  if ((val = getenv("SNAP_DATA")) != NULL)
+  if ((val = cupsGetOption("render-threads", num_options, options)) != NULL)
   {
-    snprintf(brf_statefile, sizeof(brf_statefile), "%s/brf.conf", val);
+    if (!isdigit(*val & 255))
+    {
+      fprintf(stderr, "brf: Bad render-threads value '%s'.\n", val);
+      return (NULL);
+    }
+    else
+      render_threads = atoi(val);
   }
-  else if ((val = getenv("XDG_DATA_HOME")) != NULL)
+
+  if ((val = cupsGetOption("cache-size", num_options, options)) != NULL)
   {
-    snprintf(brf_statefile, sizeof(brf_statefile), "%s/.brf.conf", val);
+    if (!isdigit(*val & 255))
+    {
+      fprintf(stderr, "brf: Bad cache-size value '%s'.\n", val);
+      return (NULL);
+    }
+    else
+      cache_size = atoi(val);
+  }
+
+  if ((val = cupsGetOption("filter-helpers", num_options, options)) != NULL)
+  {
+    if (!isdigit(*val & 255))
+    {
+      fprintf(stderr, "brf: Bad filter-helpers value '%s'.\n", val);
+      return (NULL);
+    }
+    else
+      filter_helpers = atoi(val);
+  }
+
+  if ((val = cupsGetOption("filter-helper-jobs", num_options, options)) != NULL)
+  {
+    if (!isdigit(*val & 255))
+    {
+      fprintf(stderr, "brf: Bad filter-helper-jobs value '%s'.\n", val);
+      return (NULL);
+    }
+    else
+      filter_helper_jobs = atoi(val);
+  }
+
+  if ((val = cupsGetOption("pool-embossers", num_options, options)) != NULL)
+  {
+    if (!strcmp(val, "yes") || !strcmp(val, "true"))
+      pools = true;
+    else if (!strcmp(val, "no") || !strcmp(val, "false"))
+      pools = false;
+    else
+    {
+      fprintf(stderr, "brf: Bad pool-embossers value '%s'.\n", val);
+      return (NULL);
+    }
+  }
+
+  if (!brf_batch_set_separator(cupsGetOption("batch-separator", num_options, options)))
+  {
+    fprintf(stderr, "brf: Bad batch-separator value '%s'.\n", cupsGetOption("batch-separator", num_options, options));
+    return (NULL);
+  }
+
+  // In-process translation tables, the texttobrf filter is used without...
+  brf_louis_set_tables(cupsGetOption("liblouis-tables", num_options, options));
+
+  // Spool directory for debug copies and translated jobs...
+  if ((val = getenv("SPOOL_DIR")) == NULL && (val = cupsGetOption("spool-directory", num_options, options)) == NULL)
+  {
+    if ((val = getenv("TMPDIR")) == NULL)
+      val = "/tmp";
+
+    snprintf(brf_global_data.spool_dir, sizeof(brf_global_data.spool_dir), "%s/brf-printer-app", val);
+  }
+  else
+    papplCopyString(brf_global_data.spool_dir, val, sizeof(brf_global_data.spool_dir));
+
+  if (mkdir(brf_global_data.spool_dir, 0700) && errno != EEXIST)
+  {
+    fprintf(stderr, "brf: Unable to create spool directory '%s': %s\n", brf_global_data.spool_dir, strerror(errno));
+    return (NULL);
+  }
+
+  // State file...
+  if ((val = getenv("SNAP_DATA")) != NULL)
+  {
+    snprintf(brf_statefile, sizeof(brf_statefile), "%s/brf.conf", val);
+  }
+  else if ((val = getenv("XDG_DATA_HOME")) != NULL)
+  {
+    snprintf(brf_statefile, sizeof(brf_statefile), "%s/.brf.conf", val);
   }
 #ifdef _WIN32
   else if ((val = getenv("USERPROFILE")) != NULL)
@@ -411,11 +936,28 @@ system_cb(
   if ((system = papplSystemCreate(soptions, system_name ? system_name : "Braille printer app", port, "_print,_universal", cupsGetOption("spool-directory", num_options, options), logfile ? logfile : "-", loglevel, cupsGetOption("auth-service", num_options, options), /* tls_only */false)) == NULL)
     return (NULL);
 
+  brf_global_data.system = system;
+
+  // Pre-fork filter helpers before there are threads or listeners...
+  if (filter_helpers > 0 && !brf_helper_start(system, filter_helpers, filter_helper_jobs))
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to start filter helpers, running filters directly.");
+
   papplSystemAddListeners(system, NULL);
   papplSystemSetHostName(system, hostname);
 
+  // Printers may have a pool of embossers as their device...
+  brf_pool_start(system);
+
+  // Build the conversion graph, in-process filters first with the costs of
+  // the CUPS filters they replace...
+  brf_convs_add("text/plain", brf_TESTPAGE_MIMETYPE, 0, brf_louis_filter_function, &brf_texttobrf_params, "texttobrf");
+  brf_convs_add("application/pdf", brf_TESTPAGE_MIMETYPE, 100, brf_louis_filter_function, &brf_texttobrf_params, "texttobrf");
+  brf_convs_add("application/vnd.cups-ubrl", brf_TESTPAGE_MIMETYPE, 0, brf_mime_ubrl_filter_function, NULL, "ubrl");
+  brf_convs_add("multipart/mixed", brf_TESTPAGE_MIMETYPE, 0, brf_batch_filter_function, NULL, "batch");
+  brf_convs_load(system, convs_file);
+
   papplSystemSetMIMECallback(system, mime_cb, NULL);
-  papplSystemAddMIMEFilter(system, "application/pdf", brf_TESTPAGE_MIMETYPE, BRFTestFilterCB, NULL);
+  brf_convs_register(system, brf_TESTPAGE_MIMETYPE, BRFTestFilterCB);
 
   papplSystemSetPrinterDrivers(system, (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])), brf_drivers, autoadd_cb, /*create_cb*/NULL, driver_cb, system);
 
@@ -424,6 +966,24 @@ system_cb(
   papplSystemSetSaveCallback(system, (pappl_save_cb_t)papplSystemSaveState, (void *)brf_statefile);
   papplSystemSetVersions(system, (int)(sizeof(versions) / sizeof(versions[0])), versions);
 
+  // Time the filter chains of jobs...
+  if (!brf_stats_start(system))
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to set up job statistics.");
+
+#ifdef BRF_TRACE
+  // Record job events for "/trace", before there are filter processes...
+  if (!brf_trace_start(system))
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to set up event tracing.");
+#endif // BRF_TRACE
+
+  // Keep translations of reprinted documents...
+  if (!brf_cache_start(system, brf_global_data.spool_dir, (size_t)cache_size * 1048576))
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to set up the translation cache, translating every job.");
+
+  // Translate queued jobs ahead of the embossers...
+  if (render_threads > 0 && !brf_render_start(system, render_threads))
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to start render threads, translating jobs when printing.");
+
   fprintf(stderr, "brf: statefile='%s'\n", brf_statefile);
 
   if (!papplSystemLoadState(system, brf_statefile))
@@ -432,7 +992,21 @@ system_cb(
     papplSystemSetDNSSDName(system, system_name ? system_name : "brf");
 
     papplLog(system, PAPPL_LOGLEVEL_INFO, "Auto-adding printers...");
-    papplDeviceList(PAPPL_DEVTYPE_USB, (pappl_device_cb_t)printer_cb, system, papplLogDevice, system);
+
+    // Scan on a thread so that the system accepts requests right away...
+    if ((autoadd = (brf_autoadd_t *)calloc(1, sizeof(brf_autoadd_t))) != NULL)
+    {
+      autoadd->system = system;
+      autoadd->pools  = pools;
+
+      if ((error = pthread_create(&tid, NULL, (void *(*)(void *))autoadd_run, autoadd)) != 0)
+      {
+        papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to create auto-add thread: %s", strerror(error));
+        autoadd_run(autoadd);
+      }
+      else
+        pthread_detach(tid);
+    }
   }
 
   return (system);
@@ -443,50 +1017,6 @@ system_cb(
 // 'BRFTestFilterCB()' - Print a test page.
 //
 
-// Items to configure the properties of this Printer Application
-// These items do not change while the Printer Application is running
-typedef struct brf_printer_app_config_s
-{
-  // Identification of the Printer Application
-  const char        *system_name;        // Name of the system
-  const char        *system_package_name;// Name of Printer Application
-                                         // package/executable
-  const char        *version;            // Program version number string
-  unsigned short    numeric_version[4];  // Numeric program version
-  const char        *web_if_footer;      // HTML Footer for web interface
-  
-  pappl_pr_autoadd_cb_t autoadd_cb;
-
-  
-  pappl_pr_identify_cb_t identify_cb;
-
-
-  pappl_pr_testpage_cb_t testpage_cb;
-
-
-  cups_array_t      *spooling_conversions;
-
-  
-  cups_array_t      *stream_formats;
-  const char        *backends_ignore;
-
-  const char        *backends_only;
-
-  void              *testpage_data;
-
-} pr_printer_app_config_t;
-
-typedef struct brf_printer_app_global_data_s
-{
-  pr_printer_app_config_t *config;
-  pappl_system_t          *system;
-  int                     num_drivers;     // Number of drivers (from the PPDs)
-  pappl_pr_driver_t       *drivers;        // Driver index (for menu and
-                                           // auto-add)
-   char              spool_dir[1024];     // Spool directory, customizable via
-                                         // SPOOL_DIR environment variable                                         
-
-} brf_printer_app_global_data_t;
 
 
 
@@ -498,6 +1028,11 @@ typedef struct brf_print_filter_function_data_s
   const char *device_uri;                          // Printer device URI
   pappl_job_t *job;                          // Job
   brf_printer_app_global_data_t *global_data; // Global data
+  char resume_key[65];                       // Cache key for resume records
+  int resume_job;                            // Job of the resume record in
+                                             // effect
+  int first_page;                            // First page sent, 1 unless
+                                             // resumed
 } brf_print_filter_function_data_t;
 
 typedef struct brf_cups_device_data_s
@@ -518,28 +1053,237 @@ typedef struct brf_cups_device_data_s
                                              // internal?
 } brf_cups_device_data_t;
 
-typedef struct brf_spooling_conversion_s
+
+//
+// 'brf_job_filter_data()' - Create the filter function data for a job.
+//
+
+cf_filter_data_t *			// O - Filter data
+brf_job_filter_data(
+    pappl_job_t                     *job,	// I - Job
+    const brf_spooling_conversion_t *conversion)// I - Pre-filter chain
 {
-  char *srctype;                   // Input data type
-  char *dsttype;                   // Output data type
-  int num_filters;                       // Number of filters
-  cf_filter_filter_in_chain_t filters[]; // List of filters with
-                                         // parameters
-} brf_spooling_conversion_t;
-
-static brf_spooling_conversion_t brf_convert_pdf_to_brf =
-    {
-        "application/pdf",
-        "application/vnd.cups-paged-brf",
-        1,
-        {
-          {
-          cfFilterExternal,
-          NULL,
-          "txttobrf"
-          }
-        }
-     };
+  brf_arena_t	*arena;			// Memory of the job's filter chain
+  cf_filter_data_t *filter_data;	// Filter data
+  pappl_pr_driver_data_t driver_data;	// Printer driver data
+  const brf_driver_t *driver;		// Driver extension
+  brf_louis_t	*louis;			// liblouis tables for the job
+  pappl_pr_options_t *options;		// Job options
+  ipp_t		*driver_attrs = NULL;	// Printer driver attributes
+  ipp_attribute_t *attr;		// "braille-translation-threads" value
+
+
+  // Prepare job data to be supplied to filter functions/CUPS filters
+  // called during job execution, everything is released with the arena
+  if ((arena = brf_arena_new()) == NULL || (filter_data = (cf_filter_data_t *)brf_arena_alloc(arena, sizeof(cf_filter_data_t))) == NULL)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to allocate filter data: %s", strerror(errno));
+    brf_arena_delete(arena);
+    return (NULL);
+  }
+
+  filter_data->printer = brf_arena_strdup(arena, papplPrinterGetName(papplJobGetPrinter(job)));
+  filter_data->job_id = papplJobGetID(job);
+  filter_data->job_user = brf_arena_strdup(arena, papplJobGetUsername(job));
+  filter_data->job_title = brf_arena_strdup(arena, papplJobGetName(job));
+  filter_data->copies = papplJobGetCopies(job);
+  filter_data->content_type = conversion->srctype;
+  filter_data->final_content_type = conversion->dsttype;
+  filter_data->job_attrs = NULL;     // We use PPD/filter options
+  filter_data->printer_attrs = NULL; // We use the printer's PPD file
+  filter_data->num_options = 0;
+  filter_data->options = NULL; // PPD/filter options
+  filter_data->extension = NULL;
+  filter_data->back_pipe[0] = -1;
+  filter_data->back_pipe[1] = -1;
+  filter_data->side_pipe[0] = -1;
+  filter_data->side_pipe[1] = -1;
+  filter_data->logfunc = brf_job_log;
+  filter_data->logdata = job;
+  filter_data->iscanceledfunc = brf_job_is_canceled; // Function to indicate
+                                                     // whether the job got
+                                                     // canceled
+  filter_data->iscanceleddata = job;
+
+  cfFilterDataAddExt(filter_data, BRF_ARENA_EXT, arena);
+
+  // Compiled liblouis tables of the printer, if any...
+  if (papplPrinterGetDriverData(papplJobGetPrinter(job), &driver_data) && (driver = (const brf_driver_t *)driver_data.extension) != NULL && driver->louis && (louis = (brf_louis_t *)brf_arena_alloc(arena, sizeof(brf_louis_t))) != NULL)
+  {
+    // Copy them with the job's page layout and number of translation
+    // processes...
+    memcpy(louis, driver->louis, sizeof(brf_louis_t));
+
+    options = papplJobCreatePrintOptions(job, INT_MAX, false);
+    if (!brf_louis_media(louis, &options->media))
+      papplLogJob(job, PAPPL_LOGLEVEL_WARN, "Media '%s' too small for braille, using %dx%d cell pages.", options->media.size_name, louis->width, louis->height);
+    papplJobDeletePrintOptions(options);
+
+    if ((attr = papplJobGetAttribute(job, "braille-translation-threads")) != NULL || ((driver_attrs = papplPrinterGetDriverAttributes(papplJobGetPrinter(job))) != NULL && (attr = ippFindAttribute(driver_attrs, "braille-translation-threads-default", IPP_TAG_INTEGER)) != NULL))
+      louis->workers = ippGetInteger(attr, 0);
+
+    ippDelete(driver_attrs);
+
+    if (louis->workers < 1)
+      louis->workers = 1;
+    else if (louis->workers > BRF_LOUIS_MAX_WORKERS)
+      louis->workers = BRF_LOUIS_MAX_WORKERS;
+
+    cfFilterDataAddExt(filter_data, BRF_LOUIS_EXT, louis);
+  }
+
+  return (filter_data);
+}
+
+
+//
+// 'brf_filter_data_arena()' - Get the arena of a job's filter data.
+//
+// Memory for the filter chain of the job, such as filter parameters, is
+// allocated from it so brf_filter_data_delete() releases it.
+//
+
+brf_arena_t *				// O - Arena
+brf_filter_data_arena(
+    cf_filter_data_t *data)		// I - Filter data
+{
+  return ((brf_arena_t *)cfFilterDataGetExt(data, BRF_ARENA_EXT));
+}
+
+
+//
+// 'brf_filter_data_delete()' - Free the filter function data of a job.
+//
+
+void
+brf_filter_data_delete(
+    cf_filter_data_t *data)		// I - Filter data
+{
+  brf_arena_t	*arena;			// Arena with the filter data
+
+
+  if (!data)
+    return;
+
+  // The printer owns the extension data itself...
+  arena = (brf_arena_t *)cfFilterDataRemoveExt(data, BRF_ARENA_EXT);
+  cfFilterDataRemoveExt(data, BRF_LOUIS_EXT);
+  cupsArrayDelete((cups_array_t *)data->extension);
+
+  brf_arena_delete(arena);
+}
+
+
+//
+// 'brf_job_translate()' - Run the pre-filter chain of a job into a file.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_job_translate(
+    pappl_job_t               *job,	// I - Job
+    brf_spooling_conversion_t *conversion,
+					// I - Pre-filter chain
+    const char                *filename)// I - Output file
+{
+  cf_filter_data_t *filter_data;	// Data for the filter functions
+  cups_array_t	*chain;			// Filter chain
+  brf_stats_t	*stats;			// Stage timing
+  int		i,			// Looping var
+		infd,			// Job file descriptor
+		outfd;			// Output file descriptor
+  bool		ret;			// Return value
+
+
+  if ((infd = open(papplJobGetFilename(job), O_RDONLY)) < 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open input file '%s' for translation: %s", papplJobGetFilename(job), strerror(errno));
+    return (false);
+  }
+
+  if ((outfd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to create translation file '%s': %s", filename, strerror(errno));
+    close(infd);
+    return (false);
+  }
+
+  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Translating into '%s'.", filename);
+
+  if ((filter_data = brf_job_filter_data(job, conversion)) == NULL)
+  {
+    close(infd);
+    close(outfd);
+    return (false);
+  }
+
+  chain = cupsArrayNew(NULL, NULL);
+
+  for (i = 0; i < conversion->num_filters; i ++)
+    cupsArrayAdd(chain, &(conversion->filters[i]));
+
+  stats = brf_stats_new(chain);
+  ret   = cfFilterChain(infd, outfd, 1, filter_data, chain) == 0;
+
+  brf_stats_finish(stats, job);
+  cupsArrayDelete(chain);
+  brf_filter_data_delete(filter_data);
+
+  return (ret);
+}
+
+
+//
+// 'brf_job_is_canceled()' - Tell the filter functions whether the job was
+//                           canceled.
+//
+
+static int				// O - 1 if canceled, 0 otherwise
+brf_job_is_canceled(void *data)		// I - Job
+{
+  return (papplJobIsCanceled((pappl_job_t *)data) ? 1 : 0);
+}
+
+
+//
+// 'brf_job_log()' - Log a filter function message to the job log.
+//
+
+static void
+brf_job_log(void          *data,	// I - Job
+            cf_loglevel_t level,	// I - Log level
+            const char    *message,	// I - Printf-style message
+            ...)			// I - Additional arguments
+{
+  va_list	ap;			// Pointer to arguments
+  char		buffer[2048];		// Formatted message
+
+
+  if (level == CF_LOGLEVEL_CONTROL)
+    return;
+
+  va_start(ap, message);
+  vsnprintf(buffer, sizeof(buffer), message, ap);
+  va_end(ap);
+
+  papplLogJob((pappl_job_t *)data, (pappl_loglevel_t)level, "%s", buffer);
+}
+
+
+//
+// 'brf_job_prefilter()' - Run the filters before the backend of a job.
+//
+// cfFilterChain() closes both file descriptors, so the backend sees the
+// end of the data when the last filter is done.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_job_prefilter(
+    brf_prefilter_t *prefilter)		// I - Filters before the backend
+{
+  prefilter->status = cfFilterChain(prefilter->inputfd, prefilter->outputfd, 1, prefilter->data, prefilter->chain);
+
+  return (NULL);
+}
 
 
 bool // O - `true` on success, `false` on failure
@@ -548,127 +1292,105 @@ BRFTestFilterCB(
     pappl_device_t *device, // I - Output device
     void *cbdata)           // I - Callback data (not used)
 {
-  pappl_pr_options_t *job_options = papplJobCreatePrintOptions(job, INT_MAX, 0);
   brf_spooling_conversion_t *conversion;     // Spooling conversion to use
                                              // for pre-filtering
   cf_filter_filter_in_chain_t *chain_filter, // Filter from PPD file
-      *print;
+      *print,
+      *backend,                              // Backend, possibly wrapped
+      page_filter;                           // Page range selection
+  brf_pages_t pages = {0, NULL};             // Selected pages
+  ipp_attribute_t *page_ranges;              // "page-ranges" attribute
+  ipp_attribute_t *resume_attr;              // "braille-resume-job" attribute
   brf_cups_device_data_t *device_data = NULL;
-  cf_filter_external_t *filter_data_ext;
   brf_print_filter_function_data_t *print_params;
-  brf_printer_app_global_data_t *global_data;
   cf_filter_data_t *filter_data;
-  cups_array_t *spooling_conversions;
   cups_array_t *chain;
+  brf_stats_t *stats;                        // Stage timing
   const char *informat;
+  char cache_key[65] = "";   // Cache key of translated BRF
+  char page_index[2048];     // Page index of translated BRF
+  int resume_pages = 0;      // Pages embossed before a failure
+  int resume_job = 0;        // Job that embossed them
+  int impressions = 0;       // Pages to print, 0 if unknown
   const char *filename;     // Input filename
   int fd;                   // Input file descriptor
 
   int nullfd;               // File descriptor for /dev/null
+  int pipefds[2];           // Pipe from the pre-filters to the backend
+  brf_prefilter_t prefilter; // Filters before the backend
+  pthread_t tid;            // Pre-filter thread
+  int error;               // pthread_create() error
 
   bool ret = false;    // Return value
-  int num_options = 0; // Number of PPD print options
-  cups_option_t *options = NULL;
   cf_filter_external_t *ext_filter_params;
 
   pappl_pr_driver_data_t driver_data;
   pappl_printer_t *printer = papplJobGetPrinter(job);
   const char *device_uri = papplPrinterGetDeviceURI(printer);
 
-  // Prepare job data to be supplied to filter functions/CUPS filters
-  // called during job execution
-  filter_data = (cf_filter_data_t *)calloc(1, sizeof(cf_filter_data_t));
-  // job_data->filter_data = filter_data;
-  filter_data->printer = strdup(papplPrinterGetName(printer));
-  filter_data->job_id = papplJobGetID(job);
-  filter_data->job_user = strdup(papplJobGetUsername(job));
-  filter_data->job_title = strdup(papplJobGetName(job));
-  filter_data->copies = job_options->copies;
-  filter_data->job_attrs = NULL;     // We use PPD/filter options
-  filter_data->printer_attrs = NULL; // We use the printer's PPD file
-  filter_data->num_options = num_options;
-  filter_data->options = options; // PPD/filter options
-  filter_data->extension = NULL;
-  filter_data->back_pipe[0] = -1;
-
-  filter_data->back_pipe[1] = -1;
-  filter_data->side_pipe[0] = -1;
-  filter_data->side_pipe[1] = -1;
-  filter_data->logdata = job;
-  //filter_data->iscanceledfunc = papplJobIsCanceled(job); // Function to indicate
-                                                         // whether the job got
-                                                         // canceled
-  filter_data->iscanceleddata = job;
-  // //
-  // // Load the printer's assigned PPD file, and find out which PPD option
-  // // seetings correspond to our job options
-  // //
+  //
+  // Get input file format
+  //
 
-  // papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-  //             "Printing job in spooling mode");
+  informat = papplJobGetFormat(job);
+  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+              "Input file format: %s", informat);
 
-  // filter_data_ext =
-  //     (ppd_filter_data_ext_t *)cf_filter_external_tilterDataGetExt(filter_data,
-  //                                                 PPD_FILTER_DATA_EXT);
+  BRF_TRACE_EVENT(BRF_TRACE_JOB_START, papplJobGetID(job), informat, 0);
 
   //
-  // Open the input file...
+  // Find filters to use for this job
   //
 
-  filename = papplJobGetFilename(job);
-  if ((fd = open(filename, O_RDONLY)) < 0)
+  if ((conversion = brf_find_job_conversion(job)) == NULL)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open input file '%s' for printing: %s",
-                filename, strerror(errno));
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
+                "No pre-filter found for input format %s",
+                informat);
     return (false);
   }
 
-  //
-  // Get input file format
-  //
-
-  informat = papplJobGetFormat(job);
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-              "Input file format: %s", informat);
-  //
-  // Passing values to ppdFilterExternalCUPS()
-  //
-  filter_data_ext = (cf_filter_external_t *)calloc(1, sizeof(cf_filter_external_t));
-  
-  filter_data_ext->filter = "usr/lib/cups/filter/txttobrf"; 
-  filter_data_ext->num_options =0;
-  filter_data_ext->options = NULL;
-  filter_data_ext->envp= NULL;
+  if ((filter_data = brf_job_filter_data(job, conversion)) == NULL)
+    return (false);
 
+  chain = cupsArrayNew(NULL, NULL);
 
   //
-  // Find filters to use for this job
+  // Open the input file, the render workers may already have translated
+  // it or the translation may be cached...
   //
 
-  for (conversion =
-           (brf_spooling_conversion_t *)
-               cupsArrayFirst(spooling_conversions);
-       conversion;
-       conversion =
-           (brf_spooling_conversion_t *)
-               cupsArrayNext(spooling_conversions))
-   
+  filename = papplJobGetFilename(job);
+  if ((fd = brf_render_open(job)) >= 0 || (brf_cache_enabled() && (fd = brf_cache_open(job, conversion)) >= 0))
   {
-    if (strcmp(conversion->srctype, informat) == 0)
+    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Printing translated BRF.");
+    filter_data->content_type = conversion->dsttype;
 
-      break;
-    
+    // An earlier print of the document may have failed part way, it is
+    // only continued for that job or a job naming it...
+    if (brf_cache_job_key(job, cache_key, sizeof(cache_key)) && (resume_pages = brf_cache_get_resume(cache_key, papplPrinterGetID(printer), &resume_job)) > 0 && resume_job != papplJobGetID(job) && ((resume_attr = papplJobGetAttribute(job, "braille-resume-job")) == NULL || ippGetInteger(resume_attr, 0) != resume_job))
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Job %d stopped after page %d of this document, print with \"braille-resume-job=%d\" to continue from there.", resume_job, resume_pages, resume_job);
+      resume_pages = 0;
+    }
   }
-  if (conversion == NULL )
+  else if ((fd = open(filename, O_RDONLY)) < 0)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
-                "No pre-filter found for input format %s",
-                informat);
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open input file '%s' for printing: %s",
+                filename, strerror(errno));
+    cupsArrayDelete(chain);
+    brf_filter_data_delete(filter_data);
     return (false);
   }
-  // Set input and output formats for the filter chain
-  filter_data->content_type = conversion->srctype;
-  filter_data->final_content_type = conversion->dsttype;
+  else
+  {
+    //
+    // Set up filter function chain
+    //
+
+    for (int i = 0; i < conversion->num_filters; i++)
+      cupsArrayAdd(chain, &(conversion->filters[i]));
+  }
 
   //
   // Connect the job's filter_data to the backend
@@ -683,29 +1405,77 @@ BRFTestFilterCB(
     device_data->filter_data = filter_data;
   }
 
-  //
-  // Set up filter function chain
-  //
+    chain_filter = NULL;
 
-  chain = cupsArrayNew(NULL, NULL);
+  // Select the requested pages in-process by scanning for form feeds, only
+  // when the job asks for a subset or resumes a failed print...
+  if ((page_ranges = papplJobGetAttribute(job, "page-ranges")) == NULL && resume_pages > 0)
+  {
+    // Skip the pages embossed before the device failed...
+    char	resume_from[32];	// Pages to print
 
-  for (int i = 0; i < conversion->num_filters; i++){
-    cupsArrayAdd(chain, &(conversion->filters[i]));
-    cupsArrayAdd(chain,&(filter_data_ext));
+    snprintf(resume_from, sizeof(resume_from), "%d-", resume_pages + 1);
+
+    if (brf_pages_parse(&pages, resume_from))
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Resuming with page %d, the earlier pages were embossed by job %d.", resume_pages + 1, resume_job);
+
+      page_filter.function   = brf_pages_filter_function;
+      page_filter.parameters = &pages;
+      page_filter.name       = "PageRanges";
+      cupsArrayAdd(chain, &page_filter);
     }
-    
-    chain_filter = NULL;
-  print =
-      (cf_filter_filter_in_chain_t *)calloc(1, sizeof(cf_filter_filter_in_chain_t));
+    else
+      resume_pages = 0;
+  }
+  else if (page_ranges)
+  {
+    if (brf_pages_from_ipp(&pages, page_ranges))
+    {
+      page_filter.function   = brf_pages_filter_function;
+      page_filter.parameters = &pages;
+      page_filter.name       = "PageRanges";
+      cupsArrayAdd(chain, &page_filter);
+    }
+    else
+      papplLogJob(job, PAPPL_LOGLEVEL_WARN, "Ignoring invalid page-ranges, printing all pages.");
+  }
+
+  // Cached translations have a page index to go straight to the pages and
+  // to give the number of pages before printing...
+  if (cache_key[0] && brf_cache_index(cache_key, page_index, sizeof(page_index)))
+  {
+    if (pages.ranges)
+      pages.index = page_index;
+
+    impressions = brf_pages_count(&pages, page_index);
+  }
+
   // Put filter function to send data to PAPPL's built-in backend at the end
-  // of the chain
-  print_params =
-      (brf_print_filter_function_data_t *)
-          calloc(1, sizeof(brf_print_filter_function_data_t));
+  // of the chain, it is released with the filter data
+  print = (cf_filter_filter_in_chain_t *)brf_arena_alloc(brf_filter_data_arena(filter_data), sizeof(cf_filter_filter_in_chain_t));
+  print_params = (brf_print_filter_function_data_t *)brf_arena_alloc(brf_filter_data_arena(filter_data), sizeof(brf_print_filter_function_data_t));
+
+  if (!print || !print_params)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to allocate the print filter: %s", strerror(errno));
+    close(fd);
+    brf_pages_free(&pages);
+    cupsArrayDelete(chain);
+    brf_filter_data_delete(filter_data);
+    return (false);
+  }
+
   print_params->device = device;
   print_params->device_uri = device_uri;
   print_params->job = job;
-  print_params->global_data = global_data;
+  print_params->global_data = &brf_global_data;
+  // Pages are numbered differently when only some are printed, so only
+  // record where to resume for whole documents...
+  if (!page_ranges)
+    papplCopyString(print_params->resume_key, cache_key, sizeof(print_params->resume_key));
+  print_params->first_page = resume_pages + 1;
+  print_params->resume_job = resume_pages > 0 ? resume_job : papplJobGetID(job);
   print->function = brf_print_filter_function;
   print->parameters = print_params;
   print->name = "Backend";
@@ -721,13 +1491,65 @@ BRFTestFilterCB(
   // Fire up the filter functions
   //
 
-  papplJobSetImpressions(job, 1);
+  // Otherwise the impressions are counted while the device takes the pages...
+  if (impressions > 0)
+    papplJobSetImpressions(job, impressions);
 
-  // The filter chain has no output, data is going to the device
+  // The backend has no output, data is going to the device.  It runs on
+  // the job thread since cfFilterChain() forks the filters of a longer
+  // chain and impressions or printer state reasons set in a child are
+  // lost, the filters before it run on a thread feeding it through a
+  // pipe...
   nullfd = open("/dev/null", O_RDWR);
 
-  if (cfFilterChain(fd, nullfd, 1, filter_data, chain) == 0)
-    ret = true;
+  stats   = brf_stats_new(chain);
+  backend = (cf_filter_filter_in_chain_t *)cupsArrayLast(chain);
+  cupsArrayRemove(chain, backend);
+
+  if (cupsArrayCount(chain) == 0)
+  {
+    if ((backend->function)(fd, nullfd, 1, filter_data, backend->parameters) == 0)
+      ret = true;
+  }
+  else if (pipe(pipefds))
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to create pipe for filter chain: %s", strerror(errno));
+    close(fd);
+    close(nullfd);
+  }
+  else
+  {
+    prefilter.inputfd  = fd;
+    prefilter.outputfd = pipefds[1];
+    prefilter.data     = filter_data;
+    prefilter.chain    = chain;
+    prefilter.status   = 1;
+
+    if ((error = pthread_create(&tid, NULL, (void *(*)(void *))brf_job_prefilter, &prefilter)) != 0)
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to create filter chain thread: %s", strerror(error));
+      close(fd);
+      close(pipefds[0]);
+      close(pipefds[1]);
+      close(nullfd);
+    }
+    else
+    {
+      ret = (backend->function)(pipefds[0], nullfd, 0, filter_data, backend->parameters) == 0;
+
+      pthread_join(tid, NULL);
+
+      if (prefilter.status)
+        ret = false;
+    }
+  }
+
+  BRF_TRACE_EVENT(BRF_TRACE_JOB_END, papplJobGetID(job), NULL, ret);
+
+  brf_stats_finish(stats, job);
+  brf_pages_free(&pages);
+  cupsArrayDelete(chain);
+  brf_filter_data_delete(filter_data);
 
   // //
   // // Update status
@@ -750,8 +1572,7 @@ brf_print_filter_function(int inputfd,            // I - File descriptor input
                           cf_filter_data_t *data, // I - Job and printer data
                           void *parameters)       // I - PAPPL output device
 {
-  ssize_t bytes;                    // Bytes read/written
-  char buffer[65536];               // Read/write buffer
+  ssize_t bytes;                    // Bytes written
   cf_logfunc_t log = data->logfunc; // Log function
   void *ld = data->logdata;         // log function data
   brf_print_filter_function_data_t *params =
@@ -762,7 +1583,10 @@ brf_print_filter_function(int inputfd,            // I - File descriptor input
   brf_printer_app_global_data_t *global_data = params->global_data;
   char filename[2048]; // Name for debug copy of the
                        // job
+  char index[2048];    // Page index of cached BRF
   int debug_fd = -1;   // File descriptor for debug copy
+  bool debug_copy;     // Was a debug copy requested?
+  int pages = 0;       // Pages accepted by the device
 
   (void)inputseekable;
 
@@ -784,34 +1608,53 @@ brf_print_filter_function(int inputfd,            // I - File descriptor input
     debug_fd = open(filename, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
   }
 
-  while ((bytes = read(inputfd, buffer, sizeof(buffer))) > 0)
+  debug_copy = debug_fd >= 0;
+  // Pools split cached documents at the pages of the index...
+  if (strncmp(params->device_uri, "pool:", 5) || !params->resume_key[0] || !brf_cache_index(params->resume_key, index, sizeof(index)))
+    index[0] = '\0';
+
+  bytes = brf_pool_copy(device, job, params->device_uri, inputfd, index[0] ? index : NULL, &debug_fd, &pages);
+
+  if (bytes >= 0)
+    brf_stats_bytes((size_t)bytes, (size_t)bytes);
+
+  if (debug_copy && debug_fd < 0 && log)
+    log(ld, CF_LOGLEVEL_ERROR,
+        "Backend: Debug copy: Unable to write, stopped debug copy, continued job output.");
+
+  if (bytes < 0)
   {
-    if (debug_fd >= 0)
-      if (write(debug_fd, buffer, (size_t)bytes) != bytes)
-      {
-        if (log)
-          log(ld, CF_LOGLEVEL_ERROR,
-              "Backend: Debug copy: Unable to write %d bytes, stopping debug copy, continuing job output.",
-              (int)bytes);
-        close(debug_fd);
-        debug_fd = -1;
-      }
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR,
+          "Backend: Output to device: Unable to send data to printer.");
 
-    if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
+    // Remember the pages the embosser finished, less the one it may still
+    // have been working on, so that printing again continues from there...
+    if (params->resume_key[0] && pages > 1 && !papplJobIsCanceled(job))
     {
+      brf_cache_set_resume(params->resume_key,
+                           papplPrinterGetID(papplJobGetPrinter(job)),
+                           papplJobGetID(job),
+                           params->first_page + pages - 2);
       if (log)
-        log(ld, CF_LOGLEVEL_ERROR,
-            "Backend: Output to device: Unable to send %d bytes to printer.",
-            (int)bytes);
-      if (debug_fd >= 0)
-        close(debug_fd);
-      close(inputfd);
-      close(outputfd);
-      return (1);
+        log(ld, CF_LOGLEVEL_INFO,
+            "Backend: Print the document again on this printer with \"braille-resume-job=%d\" to continue with page %d.",
+            papplJobGetID(job), params->first_page + pages - 1);
     }
+
+    if (debug_fd >= 0)
+      close(debug_fd);
+    close(inputfd);
+    close(outputfd);
+    return (1);
   }
   papplDeviceFlush(device);
 
+  if (params->resume_key[0])
+    brf_cache_set_resume(params->resume_key,
+                         papplPrinterGetID(papplJobGetPrinter(job)),
+                         params->resume_job, 0);
+
   if (debug_fd >= 0)
     close(debug_fd);
 
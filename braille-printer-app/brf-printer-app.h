@@ -0,0 +1,207 @@
+//
+// Common header for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef BRF_PRINTER_APP_H
+#  define BRF_PRINTER_APP_H
+
+//
+// Include necessary headers...
+//
+
+#  include <cupsfilters/log.h>
+#  include <cupsfilters/filter.h>
+#  include <pappl/pappl.h>
+
+
+//
+// Constants...
+//
+
+#  ifndef CUPS_DATADIR
+#    define CUPS_DATADIR	"/usr/share/cups"
+#  endif // !CUPS_DATADIR
+#  ifndef CUPS_SERVERBIN
+#    define CUPS_SERVERBIN	"/usr/lib/cups"
+#  endif // !CUPS_SERVERBIN
+
+#  define BRF_CELL_WIDTH	600	// Cell width with spacing, 1/100mm (2.5mm dots)
+#  define BRF_CELL_HEIGHT	1000	// Cell height with line spacing, 1/100mm
+#  define BRF_CELL_SPACING	350	// Space between cells, 1/100mm
+#  define BRF_LINE_SPACING	500	// Space between lines, 1/100mm
+
+#  define BRF_ARENA_EXT		"brf-arena"
+					// Filter data extension for brf_arena_t
+#  define BRF_LOUIS_EXT		"brf-louis"
+					// Filter data extension for brf_louis_t
+#  define BRF_LOUIS_MAX_WORKERS	64	// Maximum translation processes per job
+
+#  ifdef BRF_TRACE
+#    define BRF_TRACE_EVENT(event,job_id,name,value) brf_trace(event, job_id, name, value)
+					// Record a trace event
+#  else
+#    define BRF_TRACE_EVENT(event,job_id,name,value)
+#  endif // BRF_TRACE
+
+
+//
+// Types...
+//
+
+typedef struct brf_arena_s brf_arena_t;	// Memory released with a job
+typedef struct brf_encode_s brf_encode_t;
+					// Embosser encoder state of a job
+typedef struct brf_encoder_s brf_encoder_t;
+					// Embosser model family
+
+typedef bool (*brf_encode_cb_t)(void *ctx, const char *buffer, size_t bytes);
+					// Encoded output callback
+
+typedef struct brf_louis_s		// Compiled liblouis tables of a printer
+{
+  char		tables[1024];		// Table list
+  int		width,			// Cells per line
+		height,			// Lines per page
+		workers;		// Translation processes, 1 for none
+} brf_louis_t;
+
+typedef struct brf_driver_s		// Driver extension of a printer
+{
+  const brf_encoder_t *encoder;		// Embosser model family or `NULL`
+  brf_louis_t	*louis;			// Compiled liblouis tables or `NULL`
+} brf_driver_t;
+
+typedef struct brf_page_range_s	// Page range
+{
+  int		first,			// First page in range
+		last;			// Last page in range (`INT_MAX` for "N-")
+} brf_page_range_t;
+
+typedef struct brf_pages_s	// List of selected pages
+{
+  int		num_ranges;		// Number of ranges
+  brf_page_range_t *ranges;		// Sorted, non-overlapping ranges
+  const char	*index;			// Page index of the input or `NULL`
+} brf_pages_t;
+
+typedef struct brf_stats_s brf_stats_t;	// Statistics of a filter chain
+
+typedef enum brf_trace_e		// Trace events
+{
+  BRF_TRACE_JOB_START,			// Job started, name is the format
+  BRF_TRACE_JOB_END,			// Job done, value is 1 on success
+  BRF_TRACE_STAGE_START,		// Filter started, name is the filter
+  BRF_TRACE_STAGE_END,			// Filter done, value is its status
+  BRF_TRACE_DEVICE_WRITE,		// Device write, value is the bytes
+  BRF_TRACE_RASTER_LINE			// Raster line, value is the line
+} brf_trace_t;
+
+typedef struct brf_spooling_conversion_s
+					// Pre-filter chain for an input format
+{
+  char		*srctype;		// Input data type
+  char		*dsttype;		// Output data type
+  int		num_filters;		// Number of filters
+  cf_filter_filter_in_chain_t filters[];// List of filters with parameters
+} brf_spooling_conversion_t;
+
+
+//
+// Globals...
+//
+
+extern const char brf_gen_ascii[64];	// BRF character for dots 1-6
+
+
+//
+// Functions...
+//
+
+extern void	*brf_arena_alloc(brf_arena_t *arena, size_t size);
+extern void	brf_arena_delete(brf_arena_t *arena);
+extern brf_arena_t *brf_arena_new(void);
+extern char	*brf_arena_strdup(brf_arena_t *arena, const char *s);
+
+extern int	brf_batch_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+extern bool	brf_batch_set_separator(const char *value);
+
+extern bool	brf_cache_enabled(void);
+extern int	brf_cache_get_resume(const char *key, int printer_id, int *job_id);
+extern bool	brf_cache_index(const char *key, char *filename, size_t filesize);
+extern bool	brf_cache_job_key(pappl_job_t *job, char *key, size_t keysize);
+extern int	brf_cache_open(pappl_job_t *job, brf_spooling_conversion_t *conversion);
+extern void	brf_cache_set_resume(const char *key, int printer_id, int job_id, int pages);
+extern bool	brf_cache_start(pappl_system_t *system, const char *spool_dir, size_t max_size);
+
+extern bool	brf_convs_add(const char *srctype, const char *dsttype, int cost, cf_filter_function_t function, void *parameters, const char *name);
+extern int	brf_convs_load(pappl_system_t *system, const char *filename);
+extern void	brf_convs_register(pappl_system_t *system, const char *dsttype, pappl_mime_filter_cb_t cb);
+
+extern ssize_t	brf_device_copy(pappl_device_t *device, pappl_job_t *job, int fd, int *debug_fd, int *pages);
+extern ssize_t	brf_device_send(pappl_device_t *device, pappl_job_t *job, const char *buffer, size_t bytes, int *pages);
+
+extern int	brf_encode_copies(pappl_job_t *job);
+extern void	brf_encode_delete(brf_encode_t *enc);
+extern const brf_encoder_t *brf_encode_find(const char *driver_name);
+extern bool	brf_encode_finish(brf_encode_t *enc);
+extern brf_encode_t *brf_encode_new(pappl_job_t *job, brf_encode_cb_t cb, void *ctx);
+extern int	brf_encode_pages(brf_encode_t *enc);
+extern bool	brf_encode_write(brf_encode_t *enc, const char *buffer, size_t bytes);
+
+extern brf_arena_t *brf_filter_data_arena(cf_filter_data_t *data);
+extern void	brf_filter_data_delete(cf_filter_data_t *data);
+extern brf_spooling_conversion_t *brf_find_conversion(const char *srctype, const char *dsttype);
+extern brf_spooling_conversion_t *brf_find_job_conversion(pappl_job_t *job);
+
+extern bool	brf_gen(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
+
+extern int	brf_helper_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+extern int	brf_helper_main(void);
+extern bool	brf_helper_start(pappl_system_t *system, int num_helpers, int max_jobs);
+
+extern cf_filter_data_t *brf_job_filter_data(pappl_job_t *job, const brf_spooling_conversion_t *conversion);
+extern bool	brf_job_translate(pappl_job_t *job, brf_spooling_conversion_t *conversion, const char *filename);
+
+extern brf_louis_t *brf_louis_create(pappl_system_t *system, const pappl_pr_driver_data_t *driver_data);
+extern int	brf_louis_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+extern int	brf_louis_main(void);
+extern bool	brf_louis_media(brf_louis_t *louis, const pappl_media_col_t *media);
+extern void	brf_louis_set_tables(const char *tables);
+
+extern int	brf_mime_ubrl_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+extern const char *brf_mime_type(const unsigned char *header, size_t headersize);
+
+extern bool	brf_pages_build_index(int fd, const char *filename);
+extern bool	brf_pages_contains(const brf_pages_t *pages, int page, int *cursor);
+extern int	brf_pages_count(const brf_pages_t *pages, const char *index);
+extern int	brf_pages_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+extern void	brf_pages_free(brf_pages_t *pages);
+extern int	brf_pages_offsets(const char *buffer, size_t bytes, const char *index, size_t **offsets);
+extern bool	brf_pages_from_ipp(brf_pages_t *pages, ipp_attribute_t *attr);
+extern bool	brf_pages_parse(brf_pages_t *pages, const char *value);
+
+extern ssize_t	brf_pool_copy(pappl_device_t *device, pappl_job_t *job, const char *device_uri, int fd, const char *index, int *debug_fd, int *pages);
+extern int	brf_pool_ppm(const char *device_uri);
+extern void	brf_pool_start(pappl_system_t *system);
+extern char	*brf_pool_uri(const char *name, int num_members, const char **members, char *uri, size_t urisize);
+
+extern int	brf_render_open(pappl_job_t *job);
+extern bool	brf_render_start(pappl_system_t *system, int num_threads);
+
+extern void	brf_stats_bytes(size_t bytes_in, size_t bytes_out);
+extern void	brf_stats_finish(brf_stats_t *stats, pappl_job_t *job);
+extern brf_stats_t *brf_stats_new(cups_array_t *chain);
+extern double	brf_stats_now(void);
+extern void	brf_stats_stage(const char *name, double seconds, size_t bytes_in, size_t bytes_out);
+extern bool	brf_stats_start(pappl_system_t *system);
+
+extern void	brf_trace(brf_trace_t event, int job_id, const char *name, long long value);
+extern bool	brf_trace_start(pappl_system_t *system);
+
+
+#endif // !BRF_PRINTER_APP_H
@@ -0,0 +1,340 @@
+//
+// Render worker pool for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// PAPPL processes the jobs of a printer one at a time, in order, on the
+// printer's job thread.  With the "render-threads" option a pool of worker
+// threads translates each job to BRF (or finds it in the translation cache)
+// as soon as it is queued, so the job thread only has to send it to the
+// embosser.  Device output stays in PAPPL's job order.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <pthread.h>
+
+
+//
+// Local types...
+//
+
+typedef enum brf_render_state_e		// Pre-translation state
+{
+  BRF_RENDER_QUEUED,			// Waiting for a worker
+  BRF_RENDER_RUNNING,			// Being translated
+  BRF_RENDER_DONE,			// Translated BRF available
+  BRF_RENDER_FAILED,			// Translation failed
+  BRF_RENDER_SKIPPED			// Job was not ready, may be re-queued
+} brf_render_state_t;
+
+typedef struct brf_render_s		// Pre-translation of a job
+{
+  pappl_printer_t	*printer;	// Printer
+  int			printer_id,	// Printer ID
+			job_id;		// Job ID
+  brf_render_state_t	state;		// Translation state
+  bool			completed;	// Job completed while translating?
+  int			fd;		// Translated BRF file descriptor
+} brf_render_t;
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t	brf_render_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for the pool
+static pthread_cond_t	brf_render_cond = PTHREAD_COND_INITIALIZER;
+					// Queue/state change condition
+static cups_array_t	*brf_render_jobs = NULL;
+					// Jobs by printer and job ID
+static cups_array_t	*brf_render_queue = NULL;
+					// Jobs waiting for a worker, in order
+
+
+//
+// Local functions...
+//
+
+static int	brf_render_compare(brf_render_t *a, brf_render_t *b, void *data);
+static void	brf_render_event_cb(pappl_system_t *system, pappl_printer_t *printer, pappl_job_t *job, pappl_event_t event, void *data);
+static brf_render_t *brf_render_find(pappl_printer_t *printer, int job_id);
+static void	brf_render_free(brf_render_t *render);
+static void	*brf_render_run(void *data);
+
+
+//
+// 'brf_render_open()' - Open the pre-translated BRF of a job.
+//
+// If a worker is translating the job, wait for it to finish.  A job that is
+// still queued is taken out of the queue.
+//
+
+int					// O - File descriptor or -1 to translate inline
+brf_render_open(pappl_job_t *job)	// I - Job
+{
+  brf_render_t	*render;		// Pre-translation of the job
+  int		fd = -1;		// File descriptor
+
+
+  if (!brf_render_jobs)
+    return (-1);
+
+  pthread_mutex_lock(&brf_render_mutex);
+
+  if ((render = brf_render_find(papplJobGetPrinter(job), papplJobGetID(job))) != NULL)
+  {
+    if (render->state == BRF_RENDER_QUEUED)
+      cupsArrayRemove(brf_render_queue, render);
+
+    while (render->state == BRF_RENDER_RUNNING)
+      pthread_cond_wait(&brf_render_cond, &brf_render_mutex);
+
+    if (render->state == BRF_RENDER_DONE)
+    {
+      fd         = render->fd;
+      render->fd = -1;
+    }
+
+    cupsArrayRemove(brf_render_jobs, render);
+    brf_render_free(render);
+  }
+
+  pthread_mutex_unlock(&brf_render_mutex);
+
+  return (fd);
+}
+
+
+//
+// 'brf_render_start()' - Start the render worker pool.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_render_start(
+    pappl_system_t *system,		// I - System
+    int            num_threads)		// I - Number of worker threads
+{
+  int		i,			// Looping var
+		error;			// pthread_create() error
+  pthread_t	tid;			// Worker thread
+
+
+  brf_render_jobs  = cupsArrayNew((cups_array_func_t)brf_render_compare, NULL);
+  brf_render_queue = cupsArrayNew(NULL, NULL);
+
+  for (i = 0; i < num_threads; i ++)
+  {
+    if ((error = pthread_create(&tid, NULL, brf_render_run, NULL)) != 0)
+    {
+      papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to create render thread: %s", strerror(error));
+      break;
+    }
+
+    pthread_detach(tid);
+  }
+
+  if (i == 0)
+  {
+    cupsArrayDelete(brf_render_jobs);
+    cupsArrayDelete(brf_render_queue);
+    brf_render_jobs = brf_render_queue = NULL;
+
+    return (false);
+  }
+
+  papplSystemSetEventCallback(system, brf_render_event_cb, NULL);
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Started %d render thread(s).", i);
+
+  return (true);
+}
+
+
+//
+// 'brf_render_compare()' - Compare two pre-translations.
+//
+
+static int				// O - Result of comparison
+brf_render_compare(brf_render_t *a,	// I - First pre-translation
+                   brf_render_t *b,	// I - Second pre-translation
+                   void         *data)	// I - Callback data (unused)
+{
+  (void)data;
+
+  if (a->printer_id != b->printer_id)
+    return (a->printer_id < b->printer_id ? -1 : 1);
+  else
+    return (a->job_id < b->job_id ? -1 : a->job_id > b->job_id);
+}
+
+
+//
+// 'brf_render_event_cb()' - Queue new jobs and forget completed ones.
+//
+// PAPPL may hold the job lock while sending events, so only the job ID is
+// read here; the workers look at the job itself.
+//
+
+static void
+brf_render_event_cb(
+    pappl_system_t  *system,		// I - System
+    pappl_printer_t *printer,		// I - Printer, if any
+    pappl_job_t     *job,		// I - Job, if any
+    pappl_event_t   event,		// I - Event
+    void            *data)		// I - Callback data (unused)
+{
+  brf_render_t	*render;		// Pre-translation of the job
+  int		job_id;			// Job ID
+
+
+  (void)system;
+  (void)data;
+
+  if (!printer || !job || !(event & (PAPPL_EVENT_JOB_COMPLETED | PAPPL_EVENT_JOB_CREATED | PAPPL_EVENT_JOB_STATE_CHANGED)))
+    return;
+
+  job_id = papplJobGetID(job);
+
+  pthread_mutex_lock(&brf_render_mutex);
+
+  render = brf_render_find(printer, job_id);
+
+  if (event & PAPPL_EVENT_JOB_COMPLETED)
+  {
+    if (render && render->state == BRF_RENDER_RUNNING)
+    {
+      // Let the worker clean up...
+      render->completed = true;
+    }
+    else if (render)
+    {
+      if (render->state == BRF_RENDER_QUEUED)
+        cupsArrayRemove(brf_render_queue, render);
+
+      cupsArrayRemove(brf_render_jobs, render);
+      brf_render_free(render);
+    }
+  }
+  else if (render && render->state == BRF_RENDER_SKIPPED)
+  {
+    // Held or incomplete before, try again...
+    render->state = BRF_RENDER_QUEUED;
+    cupsArrayAdd(brf_render_queue, render);
+    pthread_cond_broadcast(&brf_render_cond);
+  }
+  else if (!render && (render = (brf_render_t *)calloc(1, sizeof(brf_render_t))) != NULL)
+  {
+    render->printer    = printer;
+    render->printer_id = papplPrinterGetID(printer);
+    render->job_id     = job_id;
+    render->state      = BRF_RENDER_QUEUED;
+    render->fd         = -1;
+
+    cupsArrayAdd(brf_render_jobs, render);
+    cupsArrayAdd(brf_render_queue, render);
+    pthread_cond_broadcast(&brf_render_cond);
+  }
+
+  pthread_mutex_unlock(&brf_render_mutex);
+}
+
+
+//
+// 'brf_render_find()' - Find the pre-translation of a job.
+//
+// The pool mutex must be held.
+//
+
+static brf_render_t *			// O - Pre-translation or `NULL`
+brf_render_find(pappl_printer_t *printer,// I - Printer
+                int             job_id)	// I - Job ID
+{
+  brf_render_t	key;			// Search key
+
+
+  key.printer_id = papplPrinterGetID(printer);
+  key.job_id     = job_id;
+
+  return ((brf_render_t *)cupsArrayFind(brf_render_jobs, &key));
+}
+
+
+//
+// 'brf_render_free()' - Free a pre-translation.
+//
+
+static void
+brf_render_free(brf_render_t *render)	// I - Pre-translation
+{
+  if (render->fd >= 0)
+    close(render->fd);
+
+  free(render);
+}
+
+
+//
+// 'brf_render_run()' - Worker thread.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_render_run(void *data)		// I - Thread data (unused)
+{
+  brf_render_t	*render;		// Current pre-translation
+  pappl_job_t	*job;			// Job
+  brf_spooling_conversion_t *conversion;// Pre-filter chain
+  brf_render_state_t state;		// New state
+
+
+  (void)data;
+
+  pthread_mutex_lock(&brf_render_mutex);
+
+  for (;;)
+  {
+    while ((render = (brf_render_t *)cupsArrayFirst(brf_render_queue)) == NULL)
+      pthread_cond_wait(&brf_render_cond, &brf_render_mutex);
+
+    cupsArrayRemove(brf_render_queue, render);
+    render->state = BRF_RENDER_RUNNING;
+
+    pthread_mutex_unlock(&brf_render_mutex);
+
+    // Only translate pending jobs whose document has arrived; held jobs and
+    // jobs without a document get queued again on their next state change...
+    if ((job = papplPrinterFindJob(render->printer, render->job_id)) == NULL || papplJobGetState(job) != IPP_JSTATE_PENDING || !papplJobGetFilename(job))
+      state = BRF_RENDER_SKIPPED;
+    else if ((conversion = brf_find_job_conversion(job)) == NULL)
+      state = BRF_RENDER_FAILED;
+    else if ((render->fd = brf_cache_open(job, conversion)) >= 0)
+      state = BRF_RENDER_DONE;
+    else
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_WARN, "Translation ahead of printing failed, will retry when printing.");
+      state = BRF_RENDER_FAILED;
+    }
+
+    pthread_mutex_lock(&brf_render_mutex);
+
+    if (render->completed)
+    {
+      cupsArrayRemove(brf_render_jobs, render);
+      brf_render_free(render);
+    }
+    else
+    {
+      render->state = state;
+      pthread_cond_broadcast(&brf_render_cond);
+    }
+  }
+
+  return (NULL);
+}
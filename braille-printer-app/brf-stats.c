@@ -0,0 +1,553 @@
+//
+// Pipeline statistics for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Every filter of a job's chain is wrapped to time it with the monotonic
+// clock.  cfFilterChain() runs the filters of a longer chain in child
+// processes, so the stage records live in a shared anonymous mapping.
+// Filters which know their byte counts report them with brf_stats_bytes(),
+// and filters with an inner step worth telling apart (pdftotext) add it
+// with brf_stats_stage().  When the job is done the stages are logged and
+// added to per-printer latency histograms, which the web interface shows.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+
+
+//
+// Constants...
+//
+
+#define BRF_STATS_MAX_STAGES	16	// Stages recorded per chain
+#define BRF_STATS_BUCKETS	160	// Histogram buckets, 4 per power of 2 us
+
+
+//
+// Local types...
+//
+
+typedef struct brf_stats_stage_s	// Stage record, in shared memory
+{
+  char		name[32];		// Stage name
+  double	seconds;		// Time spent
+  size_t	bytes_in,		// Bytes read
+		bytes_out;		// Bytes written
+  bool		done;			// Stage finished?
+} brf_stats_stage_t;
+
+typedef struct brf_stats_wrap_s		// Wrapped filter
+{
+  brf_stats_t	*stats;			// Job statistics
+  int		slot;			// Stage number
+  cf_filter_filter_in_chain_t *filter,	// Original filter
+		chain;			// Filter in the chain
+} brf_stats_wrap_t;
+
+struct brf_stats_s			// Statistics of a filter chain
+{
+  brf_stats_stage_t *stages;		// Stage records (shared)
+  int		*num_stages;		// Number of stage records (shared)
+  int		num_filters;		// Number of wrapped filters
+  brf_stats_wrap_t *wraps;		// Wrapped filters
+  double	start;			// Start time
+};
+
+typedef struct brf_stats_hist_s		// Latency histogram of a stage
+{
+  int		printer_id;		// Printer ID
+  char		printer[256],		// Printer name
+		name[32];		// Stage name
+  int		order;			// Position of the stage in the chain
+  unsigned long	count;			// Number of samples
+  double	seconds;		// Total time
+  unsigned long long bytes_in,		// Total bytes read
+		bytes_out;		// Total bytes written
+  unsigned	buckets[BRF_STATS_BUCKETS];
+					// Samples per bucket
+} brf_stats_hist_t;
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t	brf_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for the histograms
+static cups_array_t	*brf_stats_hists = NULL;
+					// Histograms by printer and stage
+static __thread brf_stats_wrap_t *brf_stats_current = NULL;
+					// Filter running in this thread
+
+
+//
+// Local functions...
+//
+
+static void	brf_stats_add(pappl_printer_t *printer, const brf_stats_stage_t *stage, int order);
+static int	brf_stats_bucket(double seconds);
+static double	brf_stats_bucket_seconds(int bucket);
+static int	brf_stats_compare(brf_stats_hist_t *a, brf_stats_hist_t *b, void *data);
+static int	brf_stats_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+static double	brf_stats_percentile(const brf_stats_hist_t *hist, double percent);
+static bool	brf_stats_status_cb(pappl_client_t *client, void *data);
+
+
+//
+// 'brf_stats_bytes()' - Report the byte counts of the running filter.
+//
+
+void
+brf_stats_bytes(size_t bytes_in,	// I - Bytes read
+                size_t bytes_out)	// I - Bytes written
+{
+  brf_stats_stage_t	*stage;		// Stage record
+
+
+  if (!brf_stats_current)
+    return;
+
+  stage            = brf_stats_current->stats->stages + brf_stats_current->slot;
+  stage->bytes_in  = bytes_in;
+  stage->bytes_out = bytes_out;
+}
+
+
+//
+// 'brf_stats_finish()' - Log the stages of a chain and add them to the
+//                        histograms of the printer.
+//
+// Byte counts a filter did not report are taken from its neighbours.
+//
+
+void
+brf_stats_finish(brf_stats_t *stats,	// I - Statistics or `NULL`
+                 pappl_job_t *job)	// I - Job
+{
+  int			i,		// Looping var
+			num_stages;	// Number of stages
+  brf_stats_stage_t	*stage;		// Current stage
+  pappl_printer_t	*printer = papplJobGetPrinter(job);
+					// Printer
+
+
+  if (!stats)
+    return;
+
+  if ((num_stages = *stats->num_stages) > BRF_STATS_MAX_STAGES)
+    num_stages = BRF_STATS_MAX_STAGES;
+
+  for (i = 0; i < stats->num_filters; i ++)
+  {
+    stage = stats->stages + i;
+
+    if (!stage->bytes_out && i + 1 < stats->num_filters)
+      stage->bytes_out = stage[1].bytes_in;
+    if (!stage->bytes_in && i > 0)
+      stage->bytes_in = stage[-1].bytes_out;
+  }
+
+  for (i = 0, stage = stats->stages; i < num_stages; i ++, stage ++)
+  {
+    if (!stage->done)
+      continue;
+
+    if (stage->seconds > 0.0 && !strcmp(stage->name, "Backend"))
+      papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Stage %s: %.3f seconds, %lu bytes to the device, %.1f KiB/s.", stage->name, stage->seconds, (unsigned long)stage->bytes_in, stage->bytes_in / stage->seconds / 1024.0);
+    else
+      papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Stage %s: %.3f seconds, %lu bytes in, %lu bytes out.", stage->name, stage->seconds, (unsigned long)stage->bytes_in, (unsigned long)stage->bytes_out);
+
+    brf_stats_add(printer, stage, i);
+  }
+
+  papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Filter chain took %.3f seconds.", brf_stats_now() - stats->start);
+
+  munmap(stats->stages, BRF_STATS_MAX_STAGES * sizeof(brf_stats_stage_t) + sizeof(int));
+  free(stats->wraps);
+  free(stats);
+}
+
+
+//
+// 'brf_stats_new()' - Wrap the filters of a chain to time them.
+//
+// The chain array is changed in place and must not be used after
+// brf_stats_finish().  On error `NULL` is returned and the chain is left
+// alone.
+//
+
+brf_stats_t *				// O - Statistics or `NULL` on error
+brf_stats_new(cups_array_t *chain)	// I - Filter chain
+{
+  brf_stats_t	*stats;			// Statistics
+  brf_stats_wrap_t *wrap;		// Current wrapped filter
+  cf_filter_filter_in_chain_t *filter;	// Current filter
+  void		*shared;		// Shared stage records
+  int		i;			// Looping var
+
+
+  if (!brf_stats_hists || cupsArrayCount(chain) > BRF_STATS_MAX_STAGES)
+    return (NULL);
+
+  if ((stats = (brf_stats_t *)calloc(1, sizeof(brf_stats_t))) == NULL)
+    return (NULL);
+
+  stats->num_filters = cupsArrayCount(chain);
+
+  if ((stats->wraps = (brf_stats_wrap_t *)calloc((size_t)stats->num_filters, sizeof(brf_stats_wrap_t))) == NULL)
+  {
+    free(stats);
+    return (NULL);
+  }
+
+  if ((shared = mmap(NULL, BRF_STATS_MAX_STAGES * sizeof(brf_stats_stage_t) + sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+  {
+    free(stats->wraps);
+    free(stats);
+    return (NULL);
+  }
+
+  stats->stages      = (brf_stats_stage_t *)shared;
+  stats->num_stages  = (int *)(stats->stages + BRF_STATS_MAX_STAGES);
+  *stats->num_stages = stats->num_filters;
+
+  for (i = 0, wrap = stats->wraps, filter = (cf_filter_filter_in_chain_t *)cupsArrayFirst(chain); filter; i ++, wrap ++, filter = (cf_filter_filter_in_chain_t *)cupsArrayNext(chain))
+  {
+    wrap->stats            = stats;
+    wrap->slot             = i;
+    wrap->filter           = filter;
+    wrap->chain.function   = brf_stats_filter_function;
+    wrap->chain.parameters = wrap;
+    wrap->chain.name       = filter->name;
+
+    papplCopyString(stats->stages[i].name, filter->name ? filter->name : "filter", sizeof(stats->stages[i].name));
+  }
+
+  cupsArrayClear(chain);
+
+  for (i = 0; i < stats->num_filters; i ++)
+    cupsArrayAdd(chain, &(stats->wraps[i].chain));
+
+  stats->start = brf_stats_now();
+
+  return (stats);
+}
+
+
+//
+// 'brf_stats_now()' - Get the monotonic time in seconds.
+//
+
+double					// O - Time in seconds
+brf_stats_now(void)
+{
+  struct timespec	ts;		// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec + ts.tv_nsec * 0.000000001);
+}
+
+
+//
+// 'brf_stats_stage()' - Add an inner stage of the running filter.
+//
+
+void
+brf_stats_stage(const char *name,	// I - Stage name
+                double     seconds,	// I - Time spent
+                size_t     bytes_in,	// I - Bytes read
+                size_t     bytes_out)	// I - Bytes written
+{
+  int			slot;		// Stage number
+  brf_stats_stage_t	*stage;		// Stage record
+
+
+  if (!brf_stats_current)
+    return;
+
+  if ((slot = __atomic_fetch_add(brf_stats_current->stats->num_stages, 1, __ATOMIC_SEQ_CST)) >= BRF_STATS_MAX_STAGES)
+    return;
+
+  stage = brf_stats_current->stats->stages + slot;
+
+  papplCopyString(stage->name, name, sizeof(stage->name));
+  stage->seconds   = seconds;
+  stage->bytes_in  = bytes_in;
+  stage->bytes_out = bytes_out;
+  stage->done      = true;
+}
+
+
+//
+// 'brf_stats_start()' - Set up the histograms and their web page.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_stats_start(pappl_system_t *system)	// I - System
+{
+  if ((brf_stats_hists = cupsArrayNew((cups_array_func_t)brf_stats_compare, NULL)) == NULL)
+    return (false);
+
+  papplSystemAddResourceCallback(system, "/stats", "text/html", brf_stats_status_cb, NULL);
+  papplSystemAddLink(system, "Job Statistics", "/stats", PAPPL_LOPTIONS_OTHER);
+
+  return (true);
+}
+
+
+//
+// 'brf_stats_add()' - Add a stage to the histograms of a printer.
+//
+
+static void
+brf_stats_add(
+    pappl_printer_t         *printer,	// I - Printer
+    const brf_stats_stage_t *stage,	// I - Stage record
+    int                     order)	// I - Position in the chain
+{
+  brf_stats_hist_t	key,		// Search key
+			*hist;		// Histogram
+
+
+  key.printer_id = papplPrinterGetID(printer);
+  papplCopyString(key.name, stage->name, sizeof(key.name));
+
+  pthread_mutex_lock(&brf_stats_mutex);
+
+  if ((hist = (brf_stats_hist_t *)cupsArrayFind(brf_stats_hists, &key)) == NULL && (hist = (brf_stats_hist_t *)calloc(1, sizeof(brf_stats_hist_t))) != NULL)
+  {
+    hist->printer_id = key.printer_id;
+    hist->order      = order;
+    papplCopyString(hist->printer, papplPrinterGetName(printer), sizeof(hist->printer));
+    papplCopyString(hist->name, stage->name, sizeof(hist->name));
+
+    cupsArrayAdd(brf_stats_hists, hist);
+  }
+
+  if (hist)
+  {
+    hist->count ++;
+    hist->seconds   += stage->seconds;
+    hist->bytes_in  += stage->bytes_in;
+    hist->bytes_out += stage->bytes_out;
+    hist->buckets[brf_stats_bucket(stage->seconds)] ++;
+  }
+
+  pthread_mutex_unlock(&brf_stats_mutex);
+}
+
+
+//
+// 'brf_stats_bucket()' - Get the histogram bucket for a time.
+//
+// Buckets 0 to 3 hold 0 to 3 microseconds, then every power of 2 is split
+// into 4 buckets, so percentiles are within 25%.
+//
+
+static int				// O - Bucket number
+brf_stats_bucket(double seconds)	// I - Time in seconds
+{
+  unsigned long long	us;		// Time in microseconds
+  int			msb,		// Most significant bit
+			bucket;		// Bucket number
+
+
+  if (seconds <= 0.0)
+    return (0);
+
+  if ((us = (unsigned long long)(seconds * 1000000.0)) < 4)
+    return ((int)us);
+
+  msb    = 63 - __builtin_clzll(us);
+  bucket = 4 * (msb - 1) + (int)((us >> (msb - 2)) & 3);
+
+  return (bucket < BRF_STATS_BUCKETS ? bucket : BRF_STATS_BUCKETS - 1);
+}
+
+
+//
+// 'brf_stats_bucket_seconds()' - Get the upper limit of a histogram bucket.
+//
+
+static double				// O - Time in seconds
+brf_stats_bucket_seconds(int bucket)	// I - Bucket number
+{
+  if (bucket < 4)
+    return ((bucket + 1) * 0.000001);
+  else
+    return ((double)((unsigned long long)(5 + bucket % 4) << (bucket / 4 - 1)) * 0.000001);
+}
+
+
+//
+// 'brf_stats_compare()' - Compare two histograms.
+//
+
+static int				// O - Result of comparison
+brf_stats_compare(brf_stats_hist_t *a,	// I - First histogram
+                  brf_stats_hist_t *b,	// I - Second histogram
+                  void             *data)// I - Callback data (unused)
+{
+  (void)data;
+
+  if (a->printer_id != b->printer_id)
+    return (a->printer_id < b->printer_id ? -1 : 1);
+  else
+    return (strcmp(a->name, b->name));
+}
+
+
+//
+// 'brf_stats_filter_function()' - Time a filter of the chain.
+//
+
+static int				// O - Error status
+brf_stats_filter_function(
+    int              inputfd,		// I - File descriptor input stream
+    int              outputfd,		// I - File descriptor output stream
+    int              inputseekable,	// I - Is input stream seekable?
+    cf_filter_data_t *data,		// I - Job and printer data
+    void             *parameters)	// I - Wrapped filter
+{
+  brf_stats_wrap_t	*wrap = (brf_stats_wrap_t *)parameters;
+					// Wrapped filter
+  brf_stats_stage_t	*stage = wrap->stats->stages + wrap->slot;
+					// Stage record
+  struct stat		fileinfo;	// Input file information
+  double		start;		// Start time
+  int			ret;		// Return value
+
+
+  if (!fstat(inputfd, &fileinfo) && S_ISREG(fileinfo.st_mode))
+    stage->bytes_in = (size_t)fileinfo.st_size;
+
+  BRF_TRACE_EVENT(BRF_TRACE_STAGE_START, data->job_id, wrap->filter->name, 0);
+
+  brf_stats_current = wrap;
+  start             = brf_stats_now();
+  ret               = (wrap->filter->function)(inputfd, outputfd, inputseekable, data, wrap->filter->parameters);
+  stage->seconds    = brf_stats_now() - start;
+  stage->done       = true;
+  brf_stats_current = NULL;
+
+  BRF_TRACE_EVENT(BRF_TRACE_STAGE_END, data->job_id, wrap->filter->name, ret);
+
+  return (ret);
+}
+
+
+//
+// 'brf_stats_percentile()' - Get a percentile of a histogram.
+//
+
+static double				// O - Time in seconds
+brf_stats_percentile(
+    const brf_stats_hist_t *hist,	// I - Histogram
+    double                 percent)	// I - Percentile
+{
+  int		bucket;			// Current bucket
+  unsigned long	count = 0,		// Samples so far
+		target;			// Samples needed
+
+
+  if ((target = (unsigned long)(hist->count * percent / 100.0 + 0.999999)) < 1)
+    target = 1;
+
+  for (bucket = 0; bucket < BRF_STATS_BUCKETS; bucket ++)
+  {
+    if ((count += hist->buckets[bucket]) >= target)
+      break;
+  }
+
+  return (brf_stats_bucket_seconds(bucket < BRF_STATS_BUCKETS ? bucket : BRF_STATS_BUCKETS - 1));
+}
+
+
+//
+// 'brf_stats_status_cb()' - Show the latency histograms.
+//
+
+static bool				// O - `true` on success
+brf_stats_status_cb(
+    pappl_client_t *client,		// I - Client
+    void           *data)		// I - Callback data (unused)
+{
+  brf_stats_hist_t	*hist,		// Current histogram
+			*hists = NULL;	// Copy of the histograms
+  int			i, j,		// Looping vars
+			count;		// Number of histograms
+  int			printer_id = 0;	// Current printer
+
+
+  (void)data;
+
+  // Copy the histograms, sorted by printer and position in the chain...
+  pthread_mutex_lock(&brf_stats_mutex);
+
+  if ((count = cupsArrayCount(brf_stats_hists)) > 0 && (hists = (brf_stats_hist_t *)calloc((size_t)count, sizeof(brf_stats_hist_t))) != NULL)
+  {
+    for (i = 0, hist = (brf_stats_hist_t *)cupsArrayFirst(brf_stats_hists); hist; hist = (brf_stats_hist_t *)cupsArrayNext(brf_stats_hists))
+    {
+      for (j = i ++; j > 0 && (hists[j - 1].printer_id > hist->printer_id || (hists[j - 1].printer_id == hist->printer_id && hists[j - 1].order > hist->order)); j --)
+        hists[j] = hists[j - 1];
+
+      hists[j] = *hist;
+    }
+  }
+
+  pthread_mutex_unlock(&brf_stats_mutex);
+
+  papplClientHTMLHeader(client, "Job Statistics", 0);
+  papplClientHTMLPuts(client,
+		      "    <div class=\"content\">\n"
+		      "      <div class=\"row\">\n"
+		      "        <div class=\"col-12\">\n"
+		      "          <h1 class=\"title\">Job Statistics</h1>\n");
+
+  if (!hists)
+    papplClientHTMLPuts(client, "          <p>No jobs have been printed yet.</p>\n");
+
+  for (i = 0, hist = hists; hists && i < count; i ++, hist ++)
+  {
+    if (i == 0 || hist->printer_id != printer_id)
+    {
+      if (i > 0)
+        papplClientHTMLPuts(client, "            </tbody>\n          </table>\n");
+
+      printer_id = hist->printer_id;
+
+      papplClientHTMLPrintf(client,
+			    "          <h2 class=\"title\">%s</h2>\n"
+			    "          <table class=\"list\">\n"
+			    "            <thead><tr><th>Stage</th><th>Runs</th><th>p50</th><th>p95</th><th>p99</th><th>Mean</th><th>KiB in</th><th>KiB out</th><th>KiB/s</th></tr></thead>\n"
+			    "            <tbody>\n", hist->printer);
+    }
+
+    papplClientHTMLPrintf(client, "              <tr><td>%s</td><td>%lu</td><td>%.1f ms</td><td>%.1f ms</td><td>%.1f ms</td><td>%.1f ms</td><td>%llu</td><td>%llu</td><td>%.1f</td></tr>\n", hist->name, hist->count, 1000.0 * brf_stats_percentile(hist, 50.0), 1000.0 * brf_stats_percentile(hist, 95.0), 1000.0 * brf_stats_percentile(hist, 99.0), 1000.0 * hist->seconds / hist->count, hist->bytes_in / 1024, hist->bytes_out / 1024, hist->seconds > 0.0 ? hist->bytes_in / hist->seconds / 1024.0 : 0.0);
+  }
+
+  if (hists)
+    papplClientHTMLPuts(client, "            </tbody>\n          </table>\n");
+
+  papplClientHTMLPuts(client,
+		      "        </div>\n"
+		      "      </div>\n"
+		      "    </div>\n");
+  papplClientHTMLFooter(client);
+
+  free(hists);
+
+  return (true);
+}
@@ -0,0 +1,202 @@
+//
+// Event tracing for the Braille Printer Application.
+//
+// Copyright © 2022 by Chandresh Soni.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// When built with BRF_TRACE ("--enable-brf-trace"), jobs record events at
+// their start and end, around every filter of the chain, for every write
+// to the device and for every raster line.  Events go to a ring buffer of
+// the most recent ones, in a shared anonymous mapping like the filter
+// statistics, so that filters which cfFilterChain() runs in child processes
+// record into it too.  Recording an event takes one atomic add and no lock.
+// The "/trace" resource of the web interface dumps the ring as text, for
+// the same users as the other administrative pages.
+//
+// With <sys/sdt.h> every event is also a "brf:event" USDT probe with the
+// event, job ID, name and value as arguments, for perf and bpftrace.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <sys/mman.h>
+#if defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define BRF_TRACE_USDT 1
+#  endif // __has_include(<sys/sdt.h>)
+#endif // __has_include
+
+
+//
+// Constants...
+//
+
+#define BRF_TRACE_SIZE		16384	// Events kept, a power of 2
+
+
+//
+// Local types...
+//
+
+typedef struct brf_trace_event_s	// Trace event, in shared memory
+{
+  unsigned long long seq;		// Sequence number + 1, 0 while written
+  double	time;			// Monotonic time in seconds
+  int		pid,			// Process ID
+		job_id;			// Job ID
+  brf_trace_t	event;			// Event
+  long long	value;			// Value (bytes, line, status)
+  char		name[24];		// Stage or format name
+} brf_trace_event_t;
+
+typedef struct brf_trace_ring_s		// Trace ring buffer, in shared memory
+{
+  unsigned long long next;		// Next sequence number
+  brf_trace_event_t events[BRF_TRACE_SIZE];
+					// Events
+} brf_trace_ring_t;
+
+
+//
+// Local globals...
+//
+
+static brf_trace_ring_t	*brf_trace_ring = NULL;
+					// Ring buffer
+static const char * const brf_trace_names[] =
+{					// Event names
+  "job-start",
+  "job-end",
+  "stage-start",
+  "stage-end",
+  "device-write",
+  "raster-line"
+};
+
+
+//
+// Local functions...
+//
+
+static bool	brf_trace_dump_cb(pappl_client_t *client, void *data);
+
+
+//
+// 'brf_trace()' - Record an event.
+//
+
+void
+brf_trace(brf_trace_t event,		// I - Event
+          int         job_id,		// I - Job ID
+          const char  *name,		// I - Stage or format name or `NULL`
+          long long   value)		// I - Value
+{
+  unsigned long long	seq;		// Sequence number
+  brf_trace_event_t	*e;		// Event record
+
+
+#ifdef BRF_TRACE_USDT
+  DTRACE_PROBE4(brf, event, (int)event, job_id, name, value);
+#endif // BRF_TRACE_USDT
+
+  if (!brf_trace_ring)
+    return;
+
+  seq = __atomic_fetch_add(&brf_trace_ring->next, 1, __ATOMIC_RELAXED);
+  e   = brf_trace_ring->events + (seq & (BRF_TRACE_SIZE - 1));
+
+  // Mark the record as being written, the dump skips it...
+  __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  e->time   = brf_stats_now();
+  e->pid    = (int)getpid();
+  e->job_id = job_id;
+  e->event  = event;
+  e->value  = value;
+
+  if (name)
+    papplCopyString(e->name, name, sizeof(e->name));
+  else
+    e->name[0] = '\0';
+
+  __atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+
+//
+// 'brf_trace_start()' - Set up the ring buffer and its web resource.
+//
+// Must be called before there are filter processes.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_trace_start(pappl_system_t *system)	// I - System
+{
+  brf_trace_ring_t	*ring;		// Ring buffer
+
+
+  if ((ring = (brf_trace_ring_t *)mmap(NULL, sizeof(brf_trace_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+    return (false);
+
+  brf_trace_ring = ring;
+
+  papplSystemAddResourceCallback(system, "/trace", "text/plain", brf_trace_dump_cb, NULL);
+
+  return (true);
+}
+
+
+//
+// 'brf_trace_dump_cb()' - Dump the recorded events, oldest first.
+//
+// The events tell what is being printed, so the client must be authorized
+// as for the printer settings.
+//
+
+static bool				// O - `true` on success
+brf_trace_dump_cb(
+    pappl_client_t *client,		// I - Client
+    void           *data)		// I - Callback data (unused)
+{
+  unsigned long long	next,		// Next sequence number
+			seq;		// Current sequence number
+  brf_trace_event_t	e;		// Copy of event
+  http_status_t		status;		// Authorization status
+
+
+  (void)data;
+
+  if ((status = papplClientIsAuthorized(client)) != HTTP_STATUS_CONTINUE)
+    return (papplClientRespond(client, status, NULL, NULL, 0, 0));
+
+  if (!papplClientRespond(client, HTTP_STATUS_OK, NULL, "text/plain", 0, 0))
+    return (false);
+
+  next = __atomic_load_n(&brf_trace_ring->next, __ATOMIC_ACQUIRE);
+  seq  = next > BRF_TRACE_SIZE ? next - BRF_TRACE_SIZE : 0;
+
+  papplClientPrintf(client, "# %llu events, time pid job event name value\n", next);
+
+  for (; seq < next; seq ++)
+  {
+    // Copy the record and skip it if it was (re)written meanwhile...
+    e = brf_trace_ring->events[seq & (BRF_TRACE_SIZE - 1)];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (e.seq != seq + 1 || __atomic_load_n(&brf_trace_ring->events[seq & (BRF_TRACE_SIZE - 1)].seq, __ATOMIC_RELAXED) != seq + 1)
+      continue;
+
+    e.name[sizeof(e.name) - 1] = '\0';
+
+    papplClientPrintf(client, "%.6f %d %d %s %s %lld\n", e.time, e.pid, e.job_id, (unsigned)e.event < (sizeof(brf_trace_names) / sizeof(brf_trace_names[0])) ? brf_trace_names[e.event] : "unknown", e.name[0] ? e.name : "-", e.value);
+  }
+
+  return (httpWrite2(papplClientGetHTTP(client), "", 0) >= 0);
+}
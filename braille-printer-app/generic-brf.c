@@ -1,21 +1,114 @@
-
-
 //
 // Include necessary headers...
 //
 
-#include <pappl/pappl.h>
+#include "brf-printer-app.h"
 #include<math.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+
+//
+// Constants...
+//
+
+#define BRF_GEN_DOT_DISTANCE	200	// Default graphic dot distance, 1/100mm
+#define BRF_GEN_CELL_DOTS	6	// Default dots per cell
+#define BRF_GEN_THRESHOLD	128	// Ink level of an embossed dot
+#define BRF_GEN_BANDS		5	// Number of texture gray bands
+#define BRF_GEN_TILE_ROWS	12	// Dot rows per texture tile
+
+
+//
+// Local types...
+//
+
+typedef struct brf_gen_raster_s		// Raster job data
+{
+  unsigned	width,			// Graphic dots per row
+		height,			// Graphic dots per column
+		cell_rows,		// Dot rows per cell (3 or 4)
+		top;			// Top margin in raster lines
+  double	pitch;			// Raster lines per dot row
+  bool		negate,			// Emboss blank areas instead of ink?
+		mirror,			// Mirror horizontally?
+		rotate,			// Rotate 180 degrees?
+		dither,			// Diffuse errors instead of thresholding?
+		gray,			// 8-bit raster?
+		white,			// 8-bit raster has 255 for white?
+		texture;		// Fill areas with textures?
+  int		edge;			// Edge detection factor, 0 for none
+  unsigned	pixels;			// Pixels per raster line
+  unsigned	*x0;			// First pixel of each dot column, plus end
+  unsigned	*counts,		// Ink per dot of the current row
+		*maxes;			// Strongest edge per dot of the current row
+  unsigned	row,			// Current dot row
+		row_lines;		// Raster lines seen in the current row
+  unsigned char	*ink[3],		// Last 3 ink lines for edge detection
+		*edges;			// Edge line
+  unsigned	ink_lines;		// Ink lines seen on the page
+  int		*errors;		// Dither errors of this and the next row
+  unsigned char	*dots,			// Ink levels, then dots of the current page
+		*outline,		// Edge levels of the current page
+		*bands;			// Texture band of each cell
+  char		*buffer;		// Output buffer for a page of cells
+  size_t	bufsize;		// Size of output buffer
+  brf_encode_t	*encode;		// Embosser encoder or `NULL`
+} brf_gen_raster_t;
+
+
+//
+// Globals...
+//
+
+const char brf_gen_ascii[64] =		// BRF character for dots 1-6
+  " A1B'K2L@CIF/MSP\"E3H9O6R^DJG>NTQ,*5<-U8V.%[$+X!&;:4\\0Z7(_?W]#Y)=";
+
 
 //
 // Local globals...
 //
 
+static const unsigned char brf_gen_bits[4][2] =
+{					// Cell bit for each dot
+  { 0x01, 0x08 },
+  { 0x02, 0x10 },
+  { 0x04, 0x20 },
+  { 0x40, 0x80 }
+};
+
+static const char * const brf_gen_patterns[BRF_GEN_BANDS] =
+{					// 4x4 dot texture of each gray band
+  "................",			// White
+  "#.........#.....",			// Light: scattered dots
+  "#....#....#....#",			// Medium: diagonal lines
+  "####....####....",			// Dark: horizontal lines
+  "################"			// Black: solid
+};
+
+static pthread_once_t brf_gen_tiles_once = PTHREAD_ONCE_INIT;
+					// Texture tiles initialization
+static unsigned char brf_gen_tiles[2][BRF_GEN_BANDS][BRF_GEN_TILE_ROWS / 3][2];
+					// Cells of the texture tiles for 6 and
+					// 8-dot cells, by band, row and column
+
+static const unsigned char brf_gen_popcount[256] =
+{					// Set bits per byte
+#define B2(n)	n, n + 1, n + 1, n + 2
+#define B4(n)	B2(n), B2(n + 1), B2(n + 1), B2(n + 2)
+#define B6(n)	B4(n), B4(n + 1), B4(n + 1), B4(n + 2)
+  B6(0), B6(1), B6(1), B6(2)
+#undef B2
+#undef B4
+#undef B6
+};
+
 
 //
 // Local functions...
 //
 
+static void	brf_gen_delete_cb(pappl_printer_t *printer, pappl_pr_driver_data_t *data);
 static bool	brf_gen_printfile(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	brf_gen_rendjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	brf_gen_rendpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
@@ -23,6 +116,22 @@ static bool	brf_gen_rstartjob(pappl_job_t *job, pappl_pr_options_t *options, pap
 static bool	brf_gen_rstartpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
 static bool	brf_gen_status(pappl_printer_t *printer);
 static bool	brf_gen_rwriteline(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned y, const unsigned char *line);
+static bool	brf_gen_write_cb(pappl_device_t *device, const char *buffer, size_t bytes);
+
+static void	brf_gen_raster_add(brf_gen_raster_t *raster, const unsigned char *ink, const unsigned char *edges);
+static void	brf_gen_raster_bands(brf_gen_raster_t *raster);
+static bool	brf_gen_raster_blank(const unsigned char *line, size_t bytes);
+static void	brf_gen_raster_commit(brf_gen_raster_t *raster);
+static unsigned	brf_gen_raster_count(const unsigned char *line, unsigned x0, unsigned x1);
+static void	brf_gen_raster_edges(brf_gen_raster_t *raster, unsigned y);
+static void	brf_gen_raster_free(brf_gen_raster_t *raster);
+static void	brf_gen_raster_invert(unsigned char *dst, const unsigned char *src, size_t bytes);
+static size_t	brf_gen_raster_pack(brf_gen_raster_t *raster);
+static bool	brf_gen_raster_row(brf_gen_raster_t *raster, unsigned y);
+static void	brf_gen_raster_threshold(brf_gen_raster_t *raster);
+static void	brf_gen_raster_tiles(void);
+static bool	brf_gen_vendor_bool(pappl_pr_options_t *options, const char *name);
+static int	brf_gen_vendor_int(pappl_pr_options_t *options, const char *name, int defvalue);
 
 static const char * const brf_gen_media[] =
 {       // Supported media sizes for Generic BRF printers
@@ -51,6 +160,16 @@ brf_gen(
     ipp_t                  **attrs,	// O - Pointer to driver attributes
     void                   *cbdata)	// I - Callback data (not used)
 {
+  static const int distances[] = { 160, 200, 250 };
+					// Graphic dot distances, 1/100mm
+  static const int cell_dots[] = { 6, 8 };
+					// Dots per cell
+  static const int rotations[] = { 0, 180 };
+					// Rotations
+  static const int edge_factors[] = { 0, 1, 2, 5, 10 };
+					// Edge detection factors
+  brf_driver_t	*driver;		// Driver extension
+
   driver_data->printfile_cb  = brf_gen_printfile;
   driver_data->rendjob_cb    = brf_gen_rendjob;
   driver_data->rendpage_cb   = brf_gen_rendpage;
@@ -104,10 +223,90 @@ brf_gen(
   papplCopyString(driver_data->media_default.type, "labels", sizeof(driver_data->media_default.type));
   driver_data->media_ready[0] = driver_data->media_default;
 
+  // Braille graphics options for raster jobs...
+  // Bi-level jobs come dithered by PAPPL, monochrome jobs as 8-bit gray for
+  // edge detection and dithering at the dot grid...
+  driver_data->raster_types     = PAPPL_PWG_RASTER_TYPE_BLACK_1 | PAPPL_PWG_RASTER_TYPE_BLACK_8;
+  driver_data->color_supported |= PAPPL_COLOR_MODE_BI_LEVEL;
+
+  driver_data->num_vendor = 10;
+  driver_data->vendor[0]  = "braille-graphic-dot-distance";
+  driver_data->vendor[1]  = "braille-graphic-dots";
+  driver_data->vendor[2]  = "braille-negate";
+  driver_data->vendor[3]  = "braille-mirror";
+  driver_data->vendor[4]  = "braille-rotate";
+  driver_data->vendor[5]  = "braille-edge-factor";
+  driver_data->vendor[6]  = "braille-dither";
+  driver_data->vendor[7]  = "braille-texture";
+  driver_data->vendor[8]  = "braille-translation-threads";
+  driver_data->vendor[9]  = "braille-resume-job";
+
+  if (!*attrs)
+    *attrs = ippNew();
+
+  ippAddIntegers(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "braille-graphic-dot-distance-supported", (int)(sizeof(distances) / sizeof(distances[0])), distances);
+  ippAddInteger(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "braille-graphic-dot-distance-default", BRF_GEN_DOT_DISTANCE);
+  ippAddIntegers(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "braille-graphic-dots-supported", (int)(sizeof(cell_dots) / sizeof(cell_dots[0])), cell_dots);
+  ippAddInteger(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "braille-graphic-dots-default", BRF_GEN_CELL_DOTS);
+  ippAddBoolean(*attrs, IPP_TAG_PRINTER, "braille-negate-supported", 1);
+  ippAddBoolean(*attrs, IPP_TAG_PRINTER, "braille-negate-default", 0);
+  ippAddBoolean(*attrs, IPP_TAG_PRINTER, "braille-mirror-supported", 1);
+  ippAddBoolean(*attrs, IPP_TAG_PRINTER, "braille-mirror-default", 0);
+  ippAddIntegers(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "braille-rotate-supported", (int)(sizeof(rotations) / sizeof(rotations[0])), rotations);
+  ippAddInteger(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "braille-rotate-default", 0);
+  ippAddIntegers(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "braille-edge-factor-supported", (int)(sizeof(edge_factors) / sizeof(edge_factors[0])), edge_factors);
+  ippAddInteger(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "braille-edge-factor-default", 0);
+  ippAddBoolean(*attrs, IPP_TAG_PRINTER, "braille-dither-supported", 1);
+  ippAddBoolean(*attrs, IPP_TAG_PRINTER, "braille-dither-default", 0);
+  ippAddBoolean(*attrs, IPP_TAG_PRINTER, "braille-texture-supported", 1);
+  ippAddBoolean(*attrs, IPP_TAG_PRINTER, "braille-texture-default", 0);
+
+  // Translation processes for liblouis jobs, 1 translates in the server...
+  ippAddRange(*attrs, IPP_TAG_PRINTER, "braille-translation-threads-supported", 1, BRF_LOUIS_MAX_WORKERS);
+  ippAddInteger(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "braille-translation-threads-default", 1);
+
+  // Failed job to continue, 0 prints whole documents...
+  ippAddRange(*attrs, IPP_TAG_PRINTER, "braille-resume-job-supported", 0, INT_MAX);
+  ippAddInteger(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "braille-resume-job-default", 0);
+
+  // Pick the embosser encoder and compile the liblouis tables once for all
+  // jobs of this printer...
+  if ((driver = (brf_driver_t *)calloc(1, sizeof(brf_driver_t))) == NULL)
+    return (false);
+
+  driver->encoder = brf_encode_find(driver_name);
+  driver->louis   = brf_louis_create(system, driver_data);
+
+  driver_data->extension = driver;
+  driver_data->delete_cb = brf_gen_delete_cb;
+
   return (true);
 }
 
 
+//
+// 'brf_gen_delete_cb()' - Free the driver extension of a printer.
+//
+
+static void
+brf_gen_delete_cb(
+    pappl_printer_t        *printer,	// I - Printer
+    pappl_pr_driver_data_t *data)	// I - Driver data
+{
+  brf_driver_t	*driver = (brf_driver_t *)data->extension;
+					// Driver extension
+
+
+  (void)printer;
+
+  if (driver)
+    free(driver->louis);
+
+  free(driver);
+  data->extension = NULL;
+}
+
+
 //
 // 'Brf_generic_print()' - Print a file.
 //
@@ -119,33 +318,29 @@ brf_gen_printfile(
     pappl_device_t     *device)		// I - Output device
 {
   int		fd;			// Input file
-  ssize_t	bytes;			// Bytes read/written
-  char		buffer[65536];		// Read/write buffer
+  bool		ret;			// Return value
 
 
-  // Copy the raw file...
-  papplJobSetImpressions(job, 1);
+  BRF_TRACE_EVENT(BRF_TRACE_JOB_START, papplJobGetID(job), papplJobGetFormat(job), 0);
 
+  // Copy the raw file, the impressions are counted on the way...
   if ((fd  = open(papplJobGetFilename(job), O_RDONLY)) < 0)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open print file '%s': %s", papplJobGetFilename(job), strerror(errno));
+    BRF_TRACE_EVENT(BRF_TRACE_JOB_END, papplJobGetID(job), NULL, 0);
     return (false);
   }
 
-  while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
-  {
-    if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
-    {
-      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
-      close(fd);
-      return (false);
-    }
-  }
+  ret = brf_pool_copy(device, job, papplPrinterGetDeviceURI(papplJobGetPrinter(job)), fd, NULL, NULL, NULL) >= 0;
+
+  if (!ret)
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send print file to printer.");
+
   close(fd);
 
-  papplJobSetImpressionsCompleted(job, 1);
+  BRF_TRACE_EVENT(BRF_TRACE_JOB_END, papplJobGetID(job), NULL, ret);
 
-  return (true);
+  return (ret);
 }
 
 
@@ -159,11 +354,20 @@ brf_gen_rendjob(
     pappl_pr_options_t *options,	// I - Job options
     pappl_device_t     *device)		// I - Output device
 {
-  (void)job;
+  brf_gen_raster_t	*raster = (brf_gen_raster_t *)papplJobGetData(job);
+					// Raster job data
+  bool			ret;		// Return value
+
+
   (void)options;
   (void)device;
 
-  return (true);
+  ret = !raster || !raster->encode || brf_encode_finish(raster->encode);
+
+  brf_gen_raster_free(raster);
+  papplJobSetData(job, NULL);
+
+  return (ret);
 }
 
 
@@ -178,19 +382,36 @@ brf_gen_rendpage(
     pappl_device_t     *device,		// I - Output device
     unsigned           page)		// I - Page number
 {
-  (void)job;
+  brf_gen_raster_t	*raster = (brf_gen_raster_t *)papplJobGetData(job);
+					// Raster job data
+  size_t		bytes;		// Bytes of cells
+
+
+  (void)options;
   (void)page;
 
-  papplDevicePuts(device, "P1\n");
+  // The last ink line still needs its edges...
+  if (raster->edge && raster->ink_lines > 0)
+    brf_gen_raster_edges(raster, raster->ink_lines - 1);
 
+  brf_gen_raster_commit(raster);
+  brf_gen_raster_threshold(raster);
 
-  return (true);
+  bytes = brf_gen_raster_pack(raster);
+
+  if (raster->encode)
+    return (brf_encode_write(raster->encode, raster->buffer, bytes));
+  else
+    return (papplDeviceWrite(device, raster->buffer, bytes) >= 0);
 }
 
 
 //
 // 'Brf_generic_rstartjob()' - Start a job.
 //
+// The page is sampled on a grid of graphic dots inside the media margins,
+// every 2 dot columns and 3 or 4 dot rows make a braille cell.
+//
 
 static bool				// O - `true` on success, `false` on failure
 brf_gen_rstartjob(
@@ -198,15 +419,117 @@ brf_gen_rstartjob(
     pappl_pr_options_t *options,	// I - Job options
     pappl_device_t     *device)		// I - Output device
 {
-  (void)job;
-  (void)options;
-  (void)device;
+  brf_gen_raster_t	*raster;	// Raster job data
+  cups_page_header2_t	*header = &options->header;
+					// Raster header
+  int			distance;	// Graphic dot distance, 1/100mm
+  unsigned		left,		// Left margin in pixels
+			right,		// Right margin in pixels
+			bottom,		// Bottom margin in pixels
+			i;		// Looping var
+  double		pitch;		// Pixels per dot column
+
+
+  if ((header->cupsBitsPerPixel != 1 && header->cupsBitsPerPixel != 8) || header->HWResolution[0] == 0 || header->HWResolution[1] == 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unsupported raster format with %u bits per pixel.", header->cupsBitsPerPixel);
+    return (false);
+  }
+
+  if ((raster = (brf_gen_raster_t *)calloc(1, sizeof(brf_gen_raster_t))) == NULL)
+    return (false);
+
+  distance          = brf_gen_vendor_int(options, "braille-graphic-dot-distance", BRF_GEN_DOT_DISTANCE);
+  raster->cell_rows = brf_gen_vendor_int(options, "braille-graphic-dots", BRF_GEN_CELL_DOTS) == 8 ? 4 : 3;
+  raster->negate    = brf_gen_vendor_bool(options, "braille-negate");
+  raster->mirror    = brf_gen_vendor_bool(options, "braille-mirror");
+  raster->rotate    = brf_gen_vendor_int(options, "braille-rotate", 0) == 180;
+  raster->dither    = brf_gen_vendor_bool(options, "braille-dither");
+  raster->texture   = brf_gen_vendor_bool(options, "braille-texture");
+
+  if (raster->texture)
+    pthread_once(&brf_gen_tiles_once, brf_gen_raster_tiles);
+  raster->gray      = header->cupsBitsPerPixel == 8;
+  raster->white     = header->cupsColorSpace == CUPS_CSPACE_W || header->cupsColorSpace == CUPS_CSPACE_SW;
+  raster->pixels    = header->cupsWidth;
+
+  if (raster->gray)
+    raster->edge = brf_gen_vendor_int(options, "braille-edge-factor", 0);
+
+  if (distance < 100)
+    distance = BRF_GEN_DOT_DISTANCE;
+
+  left          = (unsigned)options->media.left_margin * header->HWResolution[0] / 2540;
+  right         = (unsigned)options->media.right_margin * header->HWResolution[0] / 2540;
+  raster->top   = (unsigned)options->media.top_margin * header->HWResolution[1] / 2540;
+  bottom        = (unsigned)options->media.bottom_margin * header->HWResolution[1] / 2540;
+  pitch         = distance * header->HWResolution[0] / 2540.0;
+  raster->pitch = distance * header->HWResolution[1] / 2540.0;
+
+  if (left + right < header->cupsWidth)
+    raster->width = (unsigned)((header->cupsWidth - left - right) / pitch) / 2 * 2;
+  if (raster->top + bottom < header->cupsHeight)
+    raster->height = (unsigned)((header->cupsHeight - raster->top - bottom) / raster->pitch) / raster->cell_rows * raster->cell_rows;
+
+  if (raster->width == 0 || raster->height == 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Media too small for braille graphics.");
+    free(raster);
+    return (false);
+  }
+
+  // Each cell takes up to 3 bytes of UTF-8, plus CR LF per line and FF...
+  raster->bufsize = (size_t)(raster->width / 2 * 3 + 2) * (raster->height / raster->cell_rows) + 1;
+  raster->x0      = (unsigned *)calloc(raster->width + 1, sizeof(unsigned));
+  raster->counts  = (unsigned *)calloc(raster->width, sizeof(unsigned));
+  raster->dots    = (unsigned char *)calloc(raster->width, raster->height);
+  raster->buffer  = (char *)malloc(raster->bufsize);
+  raster->errors  = (int *)calloc(2 * (raster->width + 2), sizeof(int));
+
+  if (raster->texture)
+    raster->bands = (unsigned char *)calloc(raster->width / 2, raster->height / raster->cell_rows);
+
+  if (raster->gray)
+  {
+    // Ink lines have a pixel of padding on each side for edge detection...
+    for (i = 0; i < 3; i ++)
+      raster->ink[i] = (unsigned char *)malloc(raster->pixels + 2);
+
+    raster->edges = (unsigned char *)malloc(raster->pixels);
+  }
+
+  if (raster->edge)
+  {
+    raster->maxes   = (unsigned *)calloc(raster->width, sizeof(unsigned));
+    raster->outline = (unsigned char *)calloc(raster->width, raster->height);
+  }
+
+  if (!raster->x0 || !raster->counts || !raster->dots || !raster->buffer || !raster->errors || (raster->texture && !raster->bands) || (raster->gray && (!raster->ink[0] || !raster->ink[1] || !raster->ink[2] || !raster->edges)) || (raster->edge && (!raster->maxes || !raster->outline)))
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to allocate %ux%u dot page buffers.", raster->width, raster->height);
+    brf_gen_raster_free(raster);
+    return (false);
+  }
+
+  for (i = 0; i <= raster->width; i ++)
+    raster->x0[i] = left + (unsigned)(i * pitch + 0.5);
+
+  raster->encode = brf_encode_new(job, (brf_encode_cb_t)brf_gen_write_cb, device);
+
+  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Embossing %ux%u graphic dots in %u-dot cells from %u-bit raster, edge factor %d.", raster->width, raster->height, raster->cell_rows * 2, header->cupsBitsPerPixel, raster->edge);
+
+  papplJobSetData(job, raster);
 
   return (true);
 }
 //
 // 'brf_gen_rwriteline()' - Write a raster line.
 //
+// 1-bit lines have their inked pixels counted per graphic dot, blank lines
+// only advance the current dot row.  8-bit lines are turned into ink levels
+// a word at a time and, with edge detection, run through a Sobel filter one
+// line behind; without it, lines without ink also only advance the row.
+//
 static bool				// O - `true` on success, `false` on failure
 brf_gen_rwriteline(
     pappl_job_t         *job,		// I - Job
@@ -215,21 +538,50 @@ brf_gen_rwriteline(
     unsigned            y,		// I - Line number
     const unsigned char *line)		// I - Line
 {
-  if (line[0] || memcmp(line, line + 1, options->header.cupsBytesPerLine - 1))
+  brf_gen_raster_t	*raster = (brf_gen_raster_t *)papplJobGetData(job);
+					// Raster job data
+  unsigned char		*ink;		// Ink line
+  unsigned		i;		// Looping var
+
+
+  (void)device;
+
+  BRF_TRACE_EVENT(BRF_TRACE_RASTER_LINE, papplJobGetID(job), NULL, y);
+
+  if (!raster->gray)
   {
-    unsigned		i;		// Looping var
-    const unsigned char	*lineptr;	// Pointer into line
-    unsigned char	buffer[300],
-			*bufptr;	// Pointer into buffer
+    if (!brf_gen_raster_row(raster, y) || brf_gen_raster_blank(line, options->header.cupsBytesPerLine))
+      return (true);
+
+    for (i = 0; i < raster->width; i ++)
+      raster->counts[i] += brf_gen_raster_count(line, raster->x0[i], raster->x0[i + 1]);
+
+    return (true);
+  }
+
+  ink = raster->ink[y % 3] + 1;
+
+  if (raster->white)
+    brf_gen_raster_invert(ink, line, raster->pixels);
+  else
+    memcpy(ink, line, raster->pixels);
 
-    for (i = options->header.cupsBytesPerLine, lineptr = line, bufptr = buffer; i > 0; i --)
-      *bufptr++ = ~*lineptr++;
+  ink[-1]             = ink[0];
+  ink[raster->pixels] = ink[raster->pixels - 1];
 
-    papplDevicePrintf(device, "GW0,%u,%u,1\n", y, options->header.cupsBytesPerLine);
-    papplDeviceWrite(device, buffer, options->header.cupsBytesPerLine);
-    papplDevicePuts(device, "\n");
+  if (!raster->edge)
+  {
+    if (brf_gen_raster_row(raster, y) && !brf_gen_raster_blank(ink, raster->pixels))
+      brf_gen_raster_add(raster, ink, NULL);
+
+    return (true);
   }
 
+  raster->ink_lines = y + 1;
+
+  if (y > 0)
+    brf_gen_raster_edges(raster, y - 1);
+
   return (true);
 }
 
@@ -245,16 +597,27 @@ brf_gen_rstartpage(
     pappl_device_t     *device,		// I - Output device
     unsigned           page)		// I - Page number
 {
-  int		ips;			// Inches per second
+  brf_gen_raster_t	*raster = (brf_gen_raster_t *)papplJobGetData(job);
+					// Raster job data
 
 
-  (void)job;
+  (void)options;
+  (void)device;
   (void)page;
 
-  papplDevicePuts(device, "\nN\n");
+  memset(raster->dots, 0, (size_t)raster->width * raster->height);
+  memset(raster->counts, 0, raster->width * sizeof(unsigned));
+
+  if (raster->edge)
+  {
+    memset(raster->outline, 0, (size_t)raster->width * raster->height);
+    memset(raster->maxes, 0, raster->width * sizeof(unsigned));
+  }
 
+  raster->row       = 0;
+  raster->row_lines = 0;
+  raster->ink_lines = 0;
 
- 
   return (true);
 }
 
@@ -273,3 +636,571 @@ brf_gen_status(
 
   return (true);
 }
+
+
+//
+// 'brf_gen_write_cb()' - Write encoded output to the device.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_gen_write_cb(
+    pappl_device_t *device,		// I - Output device
+    const char     *buffer,		// I - Data
+    size_t         bytes)		// I - Number of bytes
+{
+  return (papplDeviceWrite(device, buffer, bytes) >= 0);
+}
+
+
+//
+// 'brf_gen_raster_add()' - Add a line of ink levels to the current dot row.
+//
+
+static void
+brf_gen_raster_add(
+    brf_gen_raster_t    *raster,	// I - Raster job data
+    const unsigned char *ink,		// I - Ink levels
+    const unsigned char *edges)		// I - Edge levels or `NULL`
+{
+  unsigned	i,			// Looping var
+		x,			// Pixel
+		level;			// Sum or maximum of the dot
+
+
+  for (i = 0; i < raster->width; i ++)
+  {
+    for (x = raster->x0[i], level = raster->counts[i]; x < raster->x0[i + 1]; x ++)
+      level += ink[x];
+
+    raster->counts[i] = level;
+  }
+
+  if (!edges)
+    return;
+
+  for (i = 0; i < raster->width; i ++)
+  {
+    for (x = raster->x0[i], level = raster->maxes[i]; x < raster->x0[i + 1]; x ++)
+      level = edges[x] > level ? edges[x] : level;
+
+    raster->maxes[i] = level;
+  }
+}
+
+
+//
+// 'brf_gen_raster_bands()' - Choose the texture band of each cell.
+//
+
+static void
+brf_gen_raster_bands(
+    brf_gen_raster_t *raster)		// I - Raster job data
+{
+  unsigned	cx, cy,			// Cell
+		dx, dy,			// Dot in the cell
+		level;			// Sum of ink levels
+  unsigned char	*band = raster->bands;	// Current cell
+  const unsigned char *dots;		// First dot of the cell
+
+
+  for (cy = 0; cy < raster->height / raster->cell_rows; cy ++)
+  {
+    for (cx = 0; cx < raster->width / 2; cx ++)
+    {
+      dots = raster->dots + (size_t)cy * raster->cell_rows * raster->width + cx * 2;
+
+      for (level = 0, dy = 0; dy < raster->cell_rows; dy ++, dots += raster->width)
+      {
+        for (dx = 0; dx < 2; dx ++)
+          level += dots[dx];
+      }
+
+      level /= 2 * raster->cell_rows;
+
+      if (raster->negate)
+        level = 255 - level;
+
+      *band++ = (unsigned char)(level * BRF_GEN_BANDS / 256);
+    }
+  }
+}
+
+
+//
+// 'brf_gen_raster_blank()' - Determine whether a raster line has no dots.
+//
+
+static bool				// O - `true` if blank, `false` otherwise
+brf_gen_raster_blank(
+    const unsigned char *line,		// I - Line
+    size_t              bytes)		// I - Bytes per line
+{
+  uint64_t	word,			// Current word
+		bits = 0;		// Or'ed bits
+
+
+  for (; bytes >= sizeof(word); bytes -= sizeof(word), line += sizeof(word))
+  {
+    memcpy(&word, line, sizeof(word));
+    bits |= word;
+  }
+
+  while (bytes-- > 0)
+    bits |= *line++;
+
+  return (bits == 0);
+}
+
+
+//
+// 'brf_gen_raster_commit()' - Set the ink levels of the current dot row.
+//
+// Pixels are averaged over the dot, edges take the strongest edge in the
+// dot so that thin lines survive.
+//
+
+static void
+brf_gen_raster_commit(
+    brf_gen_raster_t *raster)		// I - Raster job data
+{
+  unsigned	i,			// Looping var
+		area,			// Pixels in the dot
+		level;			// Ink level
+  size_t	offset;			// Offset of the row
+
+
+  if (raster->row_lines == 0)
+    return;
+
+  for (i = 0, offset = (size_t)raster->row * raster->width; i < raster->width; i ++)
+  {
+    area = (raster->x0[i + 1] - raster->x0[i]) * raster->row_lines;
+
+    if (raster->gray)
+      level = area ? (raster->counts[i] + area / 2) / area : 0;
+    else
+      level = area ? (raster->counts[i] * 255 + area / 2) / area : 0;
+
+    raster->dots[offset + i] = (unsigned char)(level > 255 ? 255 : level);
+    raster->counts[i]        = 0;
+
+    if (raster->edge)
+    {
+      raster->outline[offset + i] = (unsigned char)(raster->maxes[i] > 255 ? 255 : raster->maxes[i]);
+      raster->maxes[i]            = 0;
+    }
+  }
+
+  raster->row_lines = 0;
+}
+
+
+//
+// 'brf_gen_raster_count()' - Count the inked pixels in a range of a line.
+//
+
+static unsigned				// O - Number of inked pixels
+brf_gen_raster_count(
+    const unsigned char *line,		// I - Line
+    unsigned            x0,		// I - First pixel
+    unsigned            x1)		// I - End pixel (exclusive)
+{
+  unsigned	count;			// Number of inked pixels
+  unsigned	b0 = x0 / 8,		// First byte
+		b1 = x1 / 8;		// Last (partial) byte
+
+
+  if (x1 <= x0)
+    return (0);
+
+  if (b0 == b1)
+    return (brf_gen_popcount[line[b0] & (0xff >> (x0 & 7)) & ~(0xff >> (x1 & 7))]);
+
+  for (count = brf_gen_popcount[line[b0 ++] & (0xff >> (x0 & 7))]; b0 < b1; b0 ++)
+    count += brf_gen_popcount[line[b0]];
+
+  if (x1 & 7)
+    count += brf_gen_popcount[line[b1] & ~(0xff >> (x1 & 7)) & 0xff];
+
+  return (count);
+}
+
+
+//
+// 'brf_gen_raster_edges()' - Find the edges of an ink line.
+//
+// A Sobel filter over the line and its neighbours, written as plain loops
+// over bytes that the compiler can vectorize.  A black/white step gives
+// 255 with the factor 1.
+//
+
+static void
+brf_gen_raster_edges(
+    brf_gen_raster_t *raster,		// I - Raster job data
+    unsigned         y)			// I - Line number
+{
+  const unsigned char * restrict r0,	// Line above
+		* restrict r1,		// Line
+		* restrict r2;		// Line below
+  unsigned char	* restrict edges = raster->edges;
+					// Edge line
+  int		x,			// Pixel
+		pixels = (int)raster->pixels,
+					// Pixels per line
+		factor = raster->edge,	// Edge factor
+		gx, gy,			// Gradients
+		g;			// Edge strength
+
+
+  if (!brf_gen_raster_row(raster, y))
+    return;
+
+  r1 = raster->ink[y % 3] + 1;
+  r0 = y > 0 ? raster->ink[(y - 1) % 3] + 1 : r1;
+  r2 = y + 1 < raster->ink_lines ? raster->ink[(y + 1) % 3] + 1 : r1;
+
+  for (x = 0; x < pixels; x ++)
+  {
+    gx = (r0[x + 1] + 2 * r1[x + 1] + r2[x + 1]) - (r0[x - 1] + 2 * r1[x - 1] + r2[x - 1]);
+    gy = (r2[x - 1] + 2 * r2[x] + r2[x + 1]) - (r0[x - 1] + 2 * r0[x] + r0[x + 1]);
+    g  = (((gx < 0 ? -gx : gx) + (gy < 0 ? -gy : gy)) * factor) >> 2;
+
+    edges[x] = (unsigned char)(g > 255 ? 255 : g);
+  }
+
+  brf_gen_raster_add(raster, r1, edges);
+}
+
+
+//
+// 'brf_gen_raster_free()' - Free raster job data.
+//
+
+static void
+brf_gen_raster_free(
+    brf_gen_raster_t *raster)		// I - Raster job data
+{
+  if (!raster)
+    return;
+
+  free(raster->x0);
+  free(raster->counts);
+  free(raster->maxes);
+  free(raster->outline);
+  free(raster->bands);
+  free(raster->ink[0]);
+  free(raster->ink[1]);
+  free(raster->ink[2]);
+  free(raster->edges);
+  free(raster->errors);
+  free(raster->dots);
+  free(raster->buffer);
+  brf_encode_delete(raster->encode);
+  free(raster);
+}
+
+
+//
+// 'brf_gen_raster_invert()' - Invert raster bytes a word at a time.
+//
+
+static void
+brf_gen_raster_invert(
+    unsigned char       *dst,		// I - Destination
+    const unsigned char *src,		// I - Source
+    size_t              bytes)		// I - Number of bytes
+{
+  uint64_t	word;			// Current word
+
+
+  for (; bytes >= sizeof(word); bytes -= sizeof(word), src += sizeof(word), dst += sizeof(word))
+  {
+    memcpy(&word, src, sizeof(word));
+    word = ~word;
+    memcpy(dst, &word, sizeof(word));
+  }
+
+  while (bytes-- > 0)
+    *dst++ = (unsigned char)~*src++;
+}
+
+
+//
+// 'brf_gen_raster_pack()' - Pack the dots of a page into braille cells.
+//
+// 6-dot cells are written as BRF, 8-dot cells as UTF-8 Unicode braille.
+// Trailing blank cells and lines are dropped, the page ends with a form
+// feed.
+//
+
+static size_t				// O - Number of bytes in buffer
+brf_gen_raster_pack(
+    brf_gen_raster_t *raster)		// I - Raster job data
+{
+  unsigned	cx, cy,			// Cell column and row
+		dx, dy,			// Dot within the cell
+		x, y,			// Dot on the page
+		cell,			// Dots of the cell
+		tile_rows = BRF_GEN_TILE_ROWS / raster->cell_rows;
+					// Cell rows per texture tile
+  char		*bufptr = raster->buffer,
+					// Pointer into buffer
+		*linestart,		// Start of line
+		*lineend,		// End of last non-blank cell on line
+		*pageend = raster->buffer;
+					// End of last non-blank line
+  unsigned char	dot;			// Embossed?
+  bool		negate = raster->negate && !raster->texture;
+					// Negate dots?
+
+
+  for (cy = 0; cy < raster->height / raster->cell_rows; cy ++)
+  {
+    for (cx = 0, linestart = lineend = bufptr; cx < raster->width / 2; cx ++)
+    {
+      for (cell = 0, dy = 0; dy < raster->cell_rows; dy ++)
+      {
+        for (dx = 0; dx < 2; dx ++)
+        {
+          x = cx * 2 + dx;
+          y = cy * raster->cell_rows + dy;
+
+          if (raster->mirror)
+            x = raster->width - 1 - x;
+
+          if (raster->rotate)
+          {
+            x = raster->width - 1 - x;
+            y = raster->height - 1 - y;
+          }
+
+          dot = raster->dots[(size_t)y * raster->width + x];
+
+          if (dot != negate)
+            cell |= brf_gen_bits[dy][dx];
+        }
+      }
+
+      if (raster->texture)
+      {
+        // Mirrored and rotated like the dots, but the texture stays upright...
+        x = raster->mirror != raster->rotate ? raster->width / 2 - 1 - cx : cx;
+        y = raster->rotate ? raster->height / raster->cell_rows - 1 - cy : cy;
+
+        cell |= brf_gen_tiles[raster->cell_rows == 4][raster->bands[(size_t)y * (raster->width / 2) + x]][cy % tile_rows][cx % 2];
+      }
+
+      if (raster->cell_rows == 3)
+        *bufptr++ = brf_gen_ascii[cell];
+      else
+      {
+        // U+2800 + cell...
+        *bufptr++ = (char)0xe2;
+        *bufptr++ = (char)(0xa0 | (cell >> 6));
+        *bufptr++ = (char)(0x80 | (cell & 0x3f));
+      }
+
+      if (cell)
+        lineend = bufptr;
+    }
+
+    // Drop trailing blank cells, remember the last line with dots...
+    bufptr    = lineend;
+    *bufptr++ = '\r';
+    *bufptr++ = '\n';
+
+    if (lineend > linestart)
+      pageend = bufptr;
+  }
+
+  bufptr    = pageend;
+  *bufptr++ = '\f';
+
+  return ((size_t)(bufptr - raster->buffer));
+}
+
+
+//
+// 'brf_gen_raster_row()' - Start the dot row of a raster line.
+//
+
+static bool				// O - `true` if the line is on the dot grid
+brf_gen_raster_row(
+    brf_gen_raster_t *raster,		// I - Raster job data
+    unsigned         y)			// I - Line number
+{
+  unsigned	row;			// Dot row
+
+
+  if (y < raster->top || (row = (unsigned)((y - raster->top) / raster->pitch)) >= raster->height)
+    return (false);
+
+  if (row != raster->row)
+  {
+    brf_gen_raster_commit(raster);
+    raster->row = row;
+  }
+
+  raster->row_lines ++;
+
+  return (true);
+}
+
+
+//
+// 'brf_gen_raster_threshold()' - Turn the ink levels of a page into dots.
+//
+// Either a fixed threshold or Floyd-Steinberg error diffusion over the dot
+// grid.  With edges or textures only the edges are dots, textures are added
+// when packing the cells.
+//
+
+static void
+brf_gen_raster_threshold(
+    brf_gen_raster_t *raster)		// I - Raster job data
+{
+  int		x, y,			// Dot
+		width = (int)raster->width,
+					// Dots per row
+		height = (int)raster->height;
+					// Dots per column
+  unsigned char	*dots = raster->dots,	// Current dot
+		*outline;		// Current edge
+  int		*cur,			// Errors of this row
+		*next,			// Errors of the next row
+		*temp,			// Swap
+		level;			// Ink level with error
+
+
+  if (raster->texture)
+    brf_gen_raster_bands(raster);
+
+  if (raster->edge || raster->texture)
+  {
+    // Only outlines are embossed as dots...
+    for (x = width * height, outline = raster->outline; x > 0; x --, dots ++)
+      *dots = outline && *outline++ >= BRF_GEN_THRESHOLD;
+
+    return;
+  }
+
+  if (!raster->dither)
+  {
+    for (x = width * height; x > 0; x --, dots ++)
+      *dots = *dots >= BRF_GEN_THRESHOLD;
+
+    return;
+  }
+
+  cur  = raster->errors + 1;
+  next = cur + width + 2;
+
+  memset(raster->errors, 0, 2 * (size_t)(width + 2) * sizeof(int));
+
+  for (y = 0; y < height; y ++)
+  {
+    for (x = 0; x < width; x ++, dots ++)
+    {
+      level = *dots + cur[x] / 16;
+      *dots = level >= BRF_GEN_THRESHOLD;
+
+      if (*dots)
+        level -= 255;
+
+      cur[x + 1]  += 7 * level;
+      next[x - 1] += 3 * level;
+      next[x]     += 5 * level;
+      next[x + 1] += level;
+    }
+
+    temp = cur;
+    cur  = next;
+    next = temp;
+
+    memset(next - 1, 0, (size_t)(width + 2) * sizeof(int));
+  }
+}
+
+
+//
+// 'brf_gen_raster_tiles()' - Build the cells of the texture tiles.
+//
+// A tile is 2 cells wide and 12 dot rows high, so the 4x4 dot patterns
+// repeat seamlessly with 3 and 4 dot high cells.
+//
+
+static void
+brf_gen_raster_tiles(void)
+{
+  int		dots,			// 6 or 8-dot cells
+		rows,			// Dot rows per cell
+		band,			// Gray band
+		tr, tc,			// Cell in the tile
+		dx, dy,			// Dot in the cell
+		x, y;			// Dot in the tile
+  unsigned char	cell;			// Cell dots
+
+
+  for (dots = 0; dots < 2; dots ++)
+  {
+    rows = dots ? 4 : 3;
+
+    for (band = 0; band < BRF_GEN_BANDS; band ++)
+    {
+      for (tr = 0; tr < BRF_GEN_TILE_ROWS / rows; tr ++)
+      {
+        for (tc = 0; tc < 2; tc ++)
+        {
+          for (cell = 0, dy = 0; dy < rows; dy ++)
+          {
+            for (dx = 0; dx < 2; dx ++)
+            {
+              x = tc * 2 + dx;
+              y = tr * rows + dy;
+
+              if (brf_gen_patterns[band][(y % 4) * 4 + x % 4] == '#')
+                cell |= brf_gen_bits[dy][dx];
+            }
+          }
+
+          brf_gen_tiles[dots][band][tr][tc] = cell;
+        }
+      }
+    }
+  }
+}
+
+
+//
+// 'brf_gen_vendor_bool()' - Get a boolean vendor option.
+//
+
+static bool				// O - `true` if set, `false` otherwise
+brf_gen_vendor_bool(
+    pappl_pr_options_t *options,	// I - Job options
+    const char         *name)		// I - Option name
+{
+  const char	*value = cupsGetOption(name, options->num_vendor, options->vendor);
+					// Option value
+
+
+  return (value && !strcmp(value, "true"));
+}
+
+
+//
+// 'brf_gen_vendor_int()' - Get an integer vendor option.
+//
+
+static int				// O - Option value
+brf_gen_vendor_int(
+    pappl_pr_options_t *options,	// I - Job options
+    const char         *name,		// I - Option name
+    int                defvalue)	// I - Default value
+{
+  const char	*value = cupsGetOption(name, options->num_vendor, options->vendor);
+					// Option value
+
+
+  return (value && isdigit(*value & 255) ? atoi(value) : defvalue);
+}
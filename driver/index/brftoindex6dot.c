@@ -0,0 +1,268 @@
+//
+// BRF to Index 6-dot transparent mode encoder for textbrftoindexv[34]
+//
+// Copyright (c) 2015-2018, 2021 Samuel Thibault <samuel.thibault@ens-lyon.org>
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Reads software-translated BRF on stdin (or from the file given as
+// argument) and sends each line to the embosser in transparent mode:
+// ESC \ <length> NUL, the Index 6-dot codes, then CR LF.  Leading form feeds
+// are kept, CRs and SUBs are dropped.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Index printers have a bug with numbers between 128 and 255 in transparent
+// mode escape sequence. This is normally not a problem since 128 chars is more
+// than a line worth of text
+#define MAX_LINE 127
+
+//
+// Index 6-dot code of each BRF byte.  The non-standard `a-z{|}~ are
+// normalized to @A-Z[\]_, anything not BRF becomes a blank cell.
+//
+
+static const unsigned char index6[256] =
+{
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x56, 0x20, 0x74, 0x53, 0x51, 0x57, 0x04, 0x67, 0x76, 0x41, 0x54, 0x40, 0x44, 0x50, 0x14,
+  0x64, 0x02, 0x06, 0x22, 0x62, 0x42, 0x26, 0x66, 0x46, 0x24, 0x61, 0x60, 0x43, 0x77, 0x34, 0x71,
+  0x10, 0x01, 0x03, 0x11, 0x31, 0x21, 0x13, 0x33, 0x23, 0x12, 0x32, 0x05, 0x07, 0x15, 0x35, 0x25,
+  0x17, 0x37, 0x27, 0x16, 0x36, 0x45, 0x47, 0x72, 0x55, 0x75, 0x65, 0x52, 0x63, 0x73, 0x30, 0x70,
+  0x10, 0x01, 0x03, 0x11, 0x31, 0x21, 0x13, 0x33, 0x23, 0x12, 0x32, 0x05, 0x07, 0x15, 0x35, 0x25,
+  0x17, 0x37, 0x27, 0x16, 0x36, 0x45, 0x47, 0x72, 0x55, 0x75, 0x65, 0x52, 0x63, 0x73, 0x70, 0x00,
+};
+
+// Index 6-dot code of an Unicode braille pattern without dots 7 and 8
+#define INDEX6_UNICODE(j) (((j) & 0x07) | (((j) & 0x38) << 1))
+
+//
+// Output state
+//
+
+static unsigned char	outbuf[262144];	// Output buffer
+static size_t		outlen = 0;	// Bytes in output buffer
+
+// Current line
+static unsigned char	cells[MAX_LINE];// Index codes of the line
+static size_t		ncells = 0;	// Number of cells, may exceed MAX_LINE
+static int		leading = 1;	// Still in leading form feeds?
+static int		bad_control = 0;// Unsupported control character seen
+static int		bad_nonascii = 0;// Unsupported non-ASCII character seen
+
+// Write out the output buffer
+static int
+flush_output(void)
+{
+  size_t	done;
+  ssize_t	bytes;
+
+  for (done = 0; done < outlen; done += (size_t)bytes)
+  {
+    if ((bytes = write(STDOUT_FILENO, outbuf + done, outlen - done)) < 0)
+    {
+      if (errno == EINTR)
+      {
+	bytes = 0;
+	continue;
+      }
+      fprintf(stderr, "ERROR: while writing output: %s\n", strerror(errno));
+      return (-1);
+    }
+  }
+  outlen = 0;
+  return (0);
+}
+
+// Append bytes to the output buffer
+static int
+put_bytes(const unsigned char *data, size_t len)
+{
+  if (outlen + len > sizeof(outbuf) && flush_output() < 0)
+    return (-1);
+  memcpy(outbuf + outlen, data, len);
+  outlen += len;
+  return (0);
+}
+
+// Add one cell to the current line
+static inline void
+add_cell(unsigned char code)
+{
+  if (ncells < MAX_LINE)
+    cells[ncells] = code;
+  ncells ++;
+  leading = 0;
+}
+
+// Send the current line in transparent mode
+static int
+end_line(int newline)
+{
+  unsigned char header[4] = { '\033', '\\', 0, '\0' };
+
+  if (bad_control)
+    fprintf(stderr, "ERROR: unsupported control character in BRF file\n");
+  if (bad_nonascii)
+    fprintf(stderr, "ERROR: unsupported non-ASCII character in BRF file\n");
+
+  if (ncells > MAX_LINE)
+  {
+    fprintf(stderr, "ERROR: Line too long (%zu)\n", ncells);
+    return (-1);
+  }
+  if (ncells > 0)
+  {
+    // Enter transparent mode for ncells characters
+    header[2] = (unsigned char)ncells;
+    if (put_bytes(header, sizeof(header)) < 0 || put_bytes(cells, ncells) < 0)
+      return (-1);
+  }
+  if (newline && put_bytes((const unsigned char *)"\r\n", 2) < 0)
+    return (-1);
+
+  ncells = 0;
+  leading = 1;
+  bad_control = bad_nonascii = 0;
+  return (0);
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+  int fd = STDIN_FILENO;
+  static unsigned char inbuf[131072];
+  unsigned int cp = 0;		// Code point being decoded
+  int need = 0;			// Continuation bytes still needed
+  int inline_ = 0;		// Is a line in progress?
+  ssize_t bytes, i;
+  unsigned char c;
+
+  if (argc > 2)
+  {
+    fprintf(stderr, "ERROR: %s [filename]\n", argv[0]);
+    return (1);
+  }
+  if (argc == 2 && (fd = open(argv[1], O_RDONLY)) < 0)
+  {
+    fprintf(stderr, "ERROR: opening file \"%s\": %s\n", argv[1], strerror(errno));
+    return (1);
+  }
+
+  while ((bytes = read(fd, inbuf, sizeof(inbuf))) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR)
+	continue;
+      fprintf(stderr, "ERROR: while reading input: %s\n", strerror(errno));
+      return (1);
+    }
+
+    for (i = 0; i < bytes; i ++)
+    {
+      c = inbuf[i];
+
+      if (need > 0)
+      {
+	if ((c & 0xc0) == 0x80)
+	{
+	  cp = (cp << 6) | (c & 0x3f);
+	  if (-- need > 0)
+	    continue;
+
+	  if (cp == 0xa0)
+	    // Turn non-breakable spaces into spaces
+	    add_cell(index6[' ']);
+	  else if (cp >= 0x2800 && cp <= 0x283f)
+	  {
+	    add_cell(INDEX6_UNICODE(cp - 0x2800));
+	  }
+	  else
+	  {
+	    // Includes patterns with dots 7 or 8, in case the liblouis table
+	    // happened to erroneously emit one
+	    bad_nonascii = 1;
+	    add_cell(index6[' ']);
+	  }
+	  continue;
+	}
+	// Truncated sequence
+	need = 0;
+	bad_nonascii = 1;
+	add_cell(index6[' ']);
+      }
+
+      inline_ = 1;
+      if (c == '\n')
+      {
+	if (end_line(1) < 0)
+	  goto fail;
+	inline_ = 0;
+      }
+      else if (c == '\r' || c == '\032')
+	// Strip CRs, ignore SUBs
+	continue;
+      else if (c == '\f' && leading)
+      {
+	// Interpret leading FFs
+	if (put_bytes(&c, 1) < 0)
+	  goto fail;
+      }
+      else if (c < 0x20 || c == 0x7f)
+      {
+	bad_control = 1;
+	add_cell(index6[' ']);
+      }
+      else if (c < 0x80)
+	add_cell(index6[c]);
+      else if (c == 0xa0)
+	add_cell(index6[' ']);
+      else if (c >= 0xc2 && c <= 0xdf)
+      {
+	cp = c & 0x1f;
+	need = 1;
+      }
+      else if (c >= 0xe0 && c <= 0xef)
+      {
+	cp = c & 0x0f;
+	need = 2;
+      }
+      else if (c >= 0xf0 && c <= 0xf4)
+      {
+	cp = c & 0x07;
+	need = 3;
+      }
+      else
+      {
+	bad_nonascii = 1;
+	add_cell(index6[' ']);
+      }
+    }
+  }
+
+  if (need > 0)
+  {
+    bad_nonascii = 1;
+    add_cell(index6[' ']);
+  }
+  // Last line without newline
+  if (inline_ && end_line(0) < 0)
+    goto fail;
+  if (flush_output() < 0)
+    return (1);
+  return (0);
+
+fail:
+  // Send what was translated before the error
+  flush_output();
+  return (1);
+}
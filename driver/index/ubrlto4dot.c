@@ -1,28 +1,192 @@
 //
-// Character conversion table generator for imageubrltoindexv[34]
+// Unicode braille to Index 4-dot graphic mode converter for
+// imageubrltoindexv[34]
 //
 // Copyright (c) 2015 Samuel Thibault <samuel.thibault@ens-lyon.org>
 //
 // Licensed under Apache License v2.0.  See the file "LICENSE" for more
 // information.
 //
+// Reads UTF-8 text on stdin (or from the file given as argument), turns each
+// U+2800-U+28FF pattern into the two Index 4-dot bytes, drops blank cells at
+// the end of lines and terminates lines with CR.  Everything else is passed
+// through unchanged.  Memory use does not depend on the input size.
+//
 
-#include <locale.h>
-#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+//
+// Index 4-dot encoding of the 256 patterns, indexed by Unicode offset from
+// U+2800.  Embosser byte i, sent as two '@'-based nibbles with the low one
+// first, is the Unicode pattern UBRL_J(i).
+//
+
+#define UBRL_J(i)	(((i) & 0x7) | (((i) & 0x8) << 3) | (((i) & 0x70) >> 1) | ((i) & 0x80))
+#define UBRL_CELL(i)	[UBRL_J(i)] = { '@' + ((i) & 0xf), '@' + (((i) & 0xf0) >> 4) }
+#define UBRL_CELL4(i)	UBRL_CELL(i), UBRL_CELL(i + 1), UBRL_CELL(i + 2), UBRL_CELL(i + 3)
+#define UBRL_CELL16(i)	UBRL_CELL4(i), UBRL_CELL4(i + 4), UBRL_CELL4(i + 8), UBRL_CELL4(i + 12)
+#define UBRL_CELL64(i)	UBRL_CELL16(i), UBRL_CELL16(i + 16), UBRL_CELL16(i + 32), UBRL_CELL16(i + 48)
+
+static const unsigned char ubrl_cells[256][2] =
+{
+  UBRL_CELL64(0), UBRL_CELL64(64), UBRL_CELL64(128), UBRL_CELL64(192)
+};
+
+//
+// Output state
+//
+
+static unsigned char	outbuf[262144];	// Output buffer
+static size_t		outlen = 0;	// Bytes in output buffer
+static size_t		blanks = 0;	// Pending blank cell bytes ('@')
+static int		last = 0;	// Last byte written on this line, if any
+static int		inline_ = 0;	// Is a line in progress?
+
+
+// Write out the output buffer
+static int
+flush_output(void)
+{
+  size_t	done;
+  ssize_t	bytes;
+
+  for (done = 0; done < outlen; done += (size_t)bytes)
+  {
+    if ((bytes = write(STDOUT_FILENO, outbuf + done, outlen - done)) < 0)
+    {
+      if (errno == EINTR)
+      {
+	bytes = 0;
+	continue;
+      }
+      fprintf(stderr, "ERROR: while writing output: %s\n", strerror(errno));
+      return (-1);
+    }
+  }
+  outlen = 0;
+  return (0);
+}
+
+// Append one byte to the output buffer
+static inline int
+put_byte(unsigned char c)
+{
+  if (outlen == sizeof(outbuf) && flush_output() < 0)
+    return (-1);
+  outbuf[outlen++] = c;
+  return (0);
+}
+
+// Emit one byte of line content.  Runs of '@' are held back until we know
+// they are not at the end of the line.
+static inline int
+emit(unsigned char c)
+{
+  inline_ = 1;
+  if (c == '@')
+  {
+    blanks ++;
+    return (0);
+  }
+  for (; blanks > 0; blanks --)
+    if (put_byte('@') < 0)
+      return (-1);
+  last = c;
+  return (put_byte(c));
+}
+
+// Terminate a line: drop trailing blank cells and make sure it ends with CR
+static int
+end_line(void)
+{
+  blanks = 0;
+  if (last != '\r' && put_byte('\r') < 0)
+    return (-1);
+  last = 0;
+  inline_ = 0;
+  return (0);
+}
 
 int
 main(int argc,
      char *argv[])
 {
-  int i, j, lo, hi;
-  setlocale(LC_ALL, "");
-  for (i = 0; i < 256; i ++)
+  int fd = STDIN_FILENO;
+  static unsigned char inbuf[131072];
+  unsigned char seq[2] = { 0, 0 };	// Pending start of an UTF-8 sequence
+  int nseq = 0;
+  ssize_t bytes, i;
+  unsigned char c;
+
+  if (argc > 2)
+  {
+    fprintf(stderr, "ERROR: %s [filename]\n", argv[0]);
+    return (1);
+  }
+  if (argc == 2 && (fd = open(argv[1], O_RDONLY)) < 0)
+  {
+    fprintf(stderr, "ERROR: opening file \"%s\": %s\n", argv[1], strerror(errno));
+    return (1);
+  }
+
+  while ((bytes = read(fd, inbuf, sizeof(inbuf))) != 0)
   {
-    j = (i & 0x7) | ((i & 0x8) << 3) | ((i & 0x70) >> 1) | (i & 0x80);
-    lo = i & 0xf;
-    hi = (i & 0xf0) >> 4;
-    printf("	-e 's/%lc/%c%c/g' \\\n", 0x2800 + j, '@' + lo, '@' + hi);
+    if (bytes < 0)
+    {
+      if (errno == EINTR)
+	continue;
+      fprintf(stderr, "ERROR: while reading input: %s\n", strerror(errno));
+      return (1);
+    }
+
+    for (i = 0; i < bytes; i ++)
+    {
+      c = inbuf[i];
+
+      if (nseq == 2 && c >= 0x80 && c <= 0xbf)
+      {
+	// U+2800-U+28FF complete
+	const unsigned char *cell = ubrl_cells[((seq[1] & 0x03) << 6) | (c & 0x3f)];
+	nseq = 0;
+	if (emit(cell[0]) < 0 || emit(cell[1]) < 0)
+	  return (1);
+	continue;
+      }
+      if (nseq == 1 && c >= 0xa0 && c <= 0xa3)
+      {
+	seq[nseq++] = c;
+	continue;
+      }
+      if (nseq > 0)
+      {
+	// Not a braille pattern, pass it through
+	if (emit(seq[0]) < 0 || (nseq == 2 && emit(seq[1]) < 0))
+	  return (1);
+	nseq = 0;
+      }
+
+      if (c == 0xe2)
+	seq[nseq++] = c;
+      else if (c == '\n')
+      {
+	if (end_line() < 0 || put_byte('\n') < 0)
+	  return (1);
+      }
+      else if (emit(c) < 0)
+	return (1);
+    }
   }
+
+  if (nseq > 0 && (emit(seq[0]) < 0 || (nseq == 2 && emit(seq[1]) < 0)))
+    return (1);
+  // Last line without newline
+  if (inline_ && end_line() < 0)
+    return (1);
+  if (flush_output() < 0)
+    return (1);
   return (0);
 }